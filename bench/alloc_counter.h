@@ -0,0 +1,51 @@
+#pragma once
+
+// Counts heap allocations made through global operator new/delete.
+// Include from exactly one translation unit per executable: it replaces the global operators.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace bench {
+
+class AllocCounter {
+ public:
+  struct Counts {
+    std::size_t allocations;
+    std::size_t live_bytes;
+  };
+
+  static Counts Snapshot() noexcept { return {allocations_.load(), live_bytes_.load()}; }
+
+  static void* Allocate(std::size_t size) {
+    // The size is kept in front of the block so that unsized deletes can be accounted for.
+    auto* block = static_cast<std::max_align_t*>(std::malloc(size + sizeof(std::max_align_t)));
+    if (!block) throw std::bad_alloc();
+    *reinterpret_cast<std::size_t*>(block) = size;
+    allocations_.fetch_add(1, std::memory_order_relaxed);
+    live_bytes_.fetch_add(size, std::memory_order_relaxed);
+    return block + 1;
+  }
+
+  static void Free(void* p) noexcept {
+    if (!p) return;
+    auto* block = static_cast<std::max_align_t*>(p) - 1;
+    live_bytes_.fetch_sub(*reinterpret_cast<std::size_t*>(block), std::memory_order_relaxed);
+    std::free(block);
+  }
+
+ private:
+  static inline std::atomic<std::size_t> allocations_{0};
+  static inline std::atomic<std::size_t> live_bytes_{0};
+};
+
+}  // namespace bench
+
+void* operator new(std::size_t size) { return bench::AllocCounter::Allocate(size); }
+void* operator new[](std::size_t size) { return bench::AllocCounter::Allocate(size); }
+void operator delete(void* p) noexcept { bench::AllocCounter::Free(p); }
+void operator delete[](void* p) noexcept { bench::AllocCounter::Free(p); }
+void operator delete(void* p, std::size_t) noexcept { bench::AllocCounter::Free(p); }
+void operator delete[](void* p, std::size_t) noexcept { bench::AllocCounter::Free(p); }
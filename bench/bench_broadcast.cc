@@ -0,0 +1,89 @@
+// Compares delivering one event to a large population of machines with a plain ProcessEvent() loop against
+// ufsm::Broadcast(), which dispatches the machines grouped by leaf state.
+#include <ufsm/broadcast.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr int kLeafStates = 16;
+
+FSM_EVENT(EvTick){};
+FSM_EVENT(EvJump) {
+  explicit EvJump(int target) : target(target) {}
+  int target;
+};
+
+struct Hub;
+
+FSM_STATE_MACHINE(Session, Hub) { std::uint64_t acc = 1; };
+
+// Leaves differ in their reaction code, like the states of a real machine do.
+template <int N>
+struct Leaf : ufsm::State<Leaf<N>, Session> {
+  using reactions = ufsm::List<ufsm::Reaction<EvTick>>;
+  ufsm::Result React(const EvTick&) {
+    auto& acc = this->OutermostContext().acc;
+    for (int i = 0; i <= N % 4; ++i) acc = acc * (2 * N + 3) + (acc >> (N % 7 + 1));
+    return this->DiscardEvent();
+  }
+};
+
+FSM_STATE(Hub, Session) {
+  using reactions = ufsm::List<ufsm::Reaction<EvJump>>;
+  ufsm::Result React(const EvJump& ev) { return Jump(ev.target, std::make_integer_sequence<int, kLeafStates>{}); }
+
+  template <int... N>
+  ufsm::Result Jump(int target, std::integer_sequence<int, N...>) {
+    ufsm::Result result = ufsm::Result::kForwardEvent;
+    (void)((N == target && (result = Transit<Leaf<N>>(), true)) || ...);
+    return result;
+  }
+};
+
+template <class F>
+double BestOf(int rounds, F&& f) {
+  double best = 1e300;
+  for (int r = 0; r < rounds; ++r) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    if (elapsed.count() < best) best = elapsed.count();
+  }
+  return best;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::size_t instances = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 500000;
+  std::vector<std::unique_ptr<Session>> pool;
+  pool.reserve(instances);
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<int> leaf(0, kLeafStates - 1);
+  for (std::size_t i = 0; i < instances; ++i) {
+    pool.push_back(std::make_unique<Session>());
+    pool.back()->Initiate();
+    pool.back()->ProcessEvent(EvJump{leaf(rng)});
+  }
+
+  EvTick tick;
+  double naive = BestOf(5, [&] {
+    for (auto& machine : pool) machine->ProcessEvent(tick);
+  });
+  double grouped = BestOf(5, [&] { ufsm::Broadcast(pool, tick); });
+
+  std::uint64_t checksum = 0;
+  for (auto& machine : pool) checksum ^= machine->acc;
+  std::printf("%zu machines in %d leaf states (checksum %llx)\n", instances, kLeafStates,
+              static_cast<unsigned long long>(checksum));
+  std::printf("  ProcessEvent loop: %8.2f ms  %6.1f ns/machine\n", naive, naive * 1e6 / instances);
+  std::printf("  Broadcast:         %8.2f ms  %6.1f ns/machine\n", grouped, grouped * 1e6 / instances);
+  return 0;
+}
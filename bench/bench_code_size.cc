@@ -0,0 +1,185 @@
+// Code-size report: reads the symbol table of a binary with nm and sums the text bytes of ufsm code per machine, per
+// state and per transition, plus the shared non-template core.
+//
+//   ufsm_bench_code_size <binary> [nm]
+//
+// Symbols are attributed by their demangled names: members of ufsm::State<S, ...>, S's own functions, S's state pool
+// and the reactions instantiated for S count for state S; Transit()/TransitImpl() of S to D and the Transition<E, D>
+// reactions of S count for the transition S -> D; members of ufsm::StateMachine<M, ...>, M's own functions and the
+// construction chains of M count for machine M. Inlined code counts where it was inlined: at -O2 a Transition<E, D>
+// reaction and the Transit() behind it are folded into the ReactImpl() of their source state, so they count for that
+// state and the transitions section only lists what the compiler kept out of line. Symbols carry no trace of what
+// was inlined into them, so the report cannot split them further.
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+struct Symbol {
+  std::size_t size;
+  std::string name;
+};
+
+// Text symbols of the binary, demangled.
+std::vector<Symbol> ReadSymbols(const std::string& nm, const std::string& binary) {
+  std::vector<Symbol> symbols;
+  std::string command = nm + " -C -S --size-sort '" + binary + "'";
+  FILE* pipe = ::popen(command.c_str(), "r");
+  if (!pipe) return symbols;
+  std::string line;
+  char buffer[4096];
+  while (std::fgets(buffer, sizeof(buffer), pipe)) {
+    line += buffer;
+    if (line.empty() || line.back() != '\n') continue;
+    line.pop_back();
+    // <address> <size> <type> <name>
+    std::size_t a = line.find(' '), b = a == std::string::npos ? a : line.find(' ', a + 1);
+    if (b != std::string::npos && b + 2 < line.size() && line[b + 2] == ' ') {
+      char type = line[b + 1];
+      if (type == 't' || type == 'T' || type == 'W' || type == 'w')
+        symbols.push_back({std::strtoul(line.substr(a + 1, b - a - 1).c_str(), nullptr, 16), line.substr(b + 3)});
+    }
+    line.clear();
+  }
+  ::pclose(pipe);
+  return symbols;
+}
+
+// The qualified name of a demangled function, without the return type that templates carry.
+std::string StripReturnType(const std::string& name) {
+  int depth = 0;
+  for (std::size_t i = 0; i < name.size(); ++i) {
+    char c = name[i];
+    if (c == '<' || c == '(') ++depth;
+    if (c == '>' || c == ')') --depth;
+    if (depth == 0 && c == ' ' && name.compare(i >= 8 ? i - 8 : 0, 8, "operator") != 0)
+      return StripReturnType(name.substr(i + 1));
+    if (depth == 1 && c == '(') break;
+  }
+  return name;
+}
+
+// The index-th argument of the template whose '<' is at `open`.
+std::string TemplateArg(const std::string& name, std::size_t open, int index) {
+  int depth = 0;
+  std::size_t start = open + 1;
+  for (std::size_t i = open + 1; i < name.size(); ++i) {
+    char c = name[i];
+    if (c == '<' || c == '(') ++depth;
+    if ((c == '>' || c == ')') && depth-- == 0) return index == 0 ? name.substr(start, i - start) : std::string();
+    if (c == ',' && depth == 0) {
+      if (index-- == 0) return name.substr(start, i - start);
+      start = i + 2;
+    }
+  }
+  return {};
+}
+
+// The index-th argument of the first `prefix<...>` in name, or "" if there is none.
+std::string ArgOf(const std::string& name, const std::string& prefix, int index = 0) {
+  auto pos = name.find(prefix + "<");
+  return pos == std::string::npos ? std::string() : TemplateArg(name, pos + prefix.size(), index);
+}
+
+// The function's name with template arguments and parameters removed, grouping the instantiations of a template.
+std::string Family(const std::string& name) {
+  std::string family;
+  int depth = 0;
+  for (char c : name) {
+    if (c == '(' && depth == 0) break;
+    if (c == '<' || c == '(') ++depth;
+    if (depth == 0) family += c;
+    if (c == '>' || c == ')') --depth;
+  }
+  return family;
+}
+
+bool StartsWith(const std::string& s, const std::string& prefix) { return s.compare(0, prefix.size(), prefix) == 0; }
+
+void Print(const char* title, const std::map<std::string, std::size_t>& sizes, std::size_t& total) {
+  std::vector<std::pair<std::size_t, std::string>> sorted;
+  std::size_t sum = 0;
+  for (const auto& [name, size] : sizes) {
+    sorted.emplace_back(size, name);
+    sum += size;
+  }
+  std::sort(sorted.rbegin(), sorted.rend());
+  std::printf("%-60s %10zu\n", title, sum);
+  for (const auto& [size, name] : sorted) std::printf("  %-58s %10zu\n", name.c_str(), size);
+  total += sum;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "usage: %s <binary> [nm]\n", argv[0]);
+    return 2;
+  }
+  auto symbols = ReadSymbols(argc > 2 ? argv[2] : "nm", argv[1]);
+  if (symbols.empty()) {
+    std::fprintf(stderr, "no text symbols read from %s\n", argv[1]);
+    return 1;
+  }
+
+  // The states and machines are the types ufsm::State<> and ufsm::StateMachine<> are instantiated for.
+  std::set<std::string> states, machines;
+  for (auto& symbol : symbols) {
+    symbol.name = StripReturnType(symbol.name);
+    if (StartsWith(symbol.name, "ufsm::State<")) states.insert(ArgOf(symbol.name, "ufsm::State"));
+    if (StartsWith(symbol.name, "ufsm::StateMachine<")) machines.insert(ArgOf(symbol.name, "ufsm::StateMachine"));
+  }
+  auto owner = [](const std::set<std::string>& types, const std::string& name) {
+    for (const auto& type : types)
+      if (StartsWith(name, type + "::")) return type;
+    return std::string();
+  };
+
+  std::map<std::string, std::size_t> by_machine, by_state, by_transition, core, other;
+  for (const auto& [size, name] : symbols) {
+    std::string state = ArgOf(name, "ufsm::State");
+    if (StartsWith(name, "ufsm::State<") &&
+        (name.find(">::Transit<") != std::string::npos || name.find(">::TransitImpl<") != std::string::npos)) {
+      std::string dest = ArgOf(name, name.find(">::Transit<") != std::string::npos ? ">::Transit" : ">::TransitImpl");
+      by_transition[state + " -> " + dest] += size;
+    } else if (StartsWith(name, "ufsm::Transition<")) {
+      by_transition[ArgOf(name, "::React") + " -> " + ArgOf(name, "ufsm::Transition", 1)] += size;
+    } else if (StartsWith(name, "ufsm::Reaction<") || StartsWith(name, "ufsm::Deferral<")) {
+      by_state[ArgOf(name, "::React")] += size;
+    } else if (StartsWith(name, "ufsm::State<")) {
+      by_state[state] += size;
+    } else if (StartsWith(name, "ufsm::detail::StatePool<")) {
+      by_state[ArgOf(name, "ufsm::detail::StatePool")] += size;
+    } else if (StartsWith(name, "ufsm::StateMachine<")) {
+      by_machine[ArgOf(name, "ufsm::StateMachine")] += size;
+    } else if (StartsWith(name, "ufsm::detail::Constructor<")) {
+      by_machine[ArgOf(name, "ufsm::StateMachine")] += size;
+    } else if (StartsWith(name, "ufsm::detail::MachineCore::") || StartsWith(name, "ufsm::detail::StateBase::")) {
+      core[Family(name)] += size;
+    } else if (auto type = owner(states, name); !type.empty()) {
+      by_state[type] += size;
+    } else if (auto type = owner(machines, name); !type.empty()) {
+      by_machine[type] += size;
+    } else if (StartsWith(name, "ufsm::")) {
+      other[Family(name)] += size;
+    }
+  }
+
+  std::size_t total = 0;
+  std::printf("text bytes of ufsm code in %s\n\n", argv[1]);
+  Print("machines", by_machine, total);
+  Print("states", by_state, total);
+  Print("transitions", by_transition, total);
+  if (by_transition.empty() && !by_state.empty())
+    std::printf("  %-58s\n", "(inlined into their source state's ReactImpl(), counted there)");
+  Print("shared core", core, total);
+  Print("other ufsm", other, total);
+  std::printf("\n%-60s %10zu\n", "total", total);
+  return 0;
+}
@@ -0,0 +1,115 @@
+// Compile-time benchmark: generates machines of a given number of states, compiles each one with the compiler the
+// benchmarks were built with and reports wall time and peak memory of the compiler.
+//
+//   ufsm_bench_compile_time [states...]    (default: 100 500 1000)
+//
+// A generated machine nests superstates, groups and leaves three levels deep. Leaves react to four events with
+// transitions within their group, to the next group and to the next superstate, plus one Reaction<>. The program
+// initiates the machine, warms it up and sends every event once, so that every declared transition is instantiated.
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr int kGroupsPerSuper = 5;
+constexpr int kLeavesPerGroup = 9;
+constexpr int kStatesPerSuper = 1 + kGroupsPerSuper * (1 + kLeavesPerGroup);
+
+std::string Super(int s) { return "S" + std::to_string(s); }
+std::string Group(int s, int g) { return "G" + std::to_string(s) + "_" + std::to_string(g); }
+std::string Leaf(int s, int g, int l) { return "L" + std::to_string(s) + "_" + std::to_string(g) + "_" + std::to_string(l); }
+
+// Writes a machine of about `states` states to `path`; returns the exact number of states.
+int Generate(int states, const std::string& path) {
+  const int supers = states < kStatesPerSuper ? 1 : (states + kStatesPerSuper / 2) / kStatesPerSuper;
+  std::ofstream out(path);
+  out << "#include <ufsm/ufsm.h>\n\n"
+         "FSM_EVENT(EvNext){};\nFSM_EVENT(EvGroup){};\nFSM_EVENT(EvSuper){};\nFSM_EVENT(EvTick){};\n"
+         "FSM_EVENT(EvReset){};\n\n";
+  for (int s = 0; s < supers; ++s) {
+    out << "struct " << Super(s) << ";\n";
+    for (int g = 0; g < kGroupsPerSuper; ++g) {
+      out << "struct " << Group(s, g) << ";\n";
+      for (int l = 0; l < kLeavesPerGroup; ++l) out << "struct " << Leaf(s, g, l) << ";\n";
+    }
+  }
+  out << "\nstruct Gen : ufsm::StateMachine<Gen, S0> {};\n\n";
+  for (int s = 0; s < supers; ++s) {
+    out << "struct " << Super(s) << " : ufsm::State<" << Super(s) << ", Gen, " << Group(s, 0) << "> {\n"
+        << "  using reactions = ufsm::List<ufsm::Transition<EvReset, S0>>;\n};\n";
+    for (int g = 0; g < kGroupsPerSuper; ++g) {
+      out << "struct " << Group(s, g) << " : ufsm::State<" << Group(s, g) << ", " << Super(s) << ", "
+          << Leaf(s, g, 0) << "> {};\n";
+      for (int l = 0; l < kLeavesPerGroup; ++l) {
+        out << "struct " << Leaf(s, g, l) << " : ufsm::State<" << Leaf(s, g, l) << ", " << Group(s, g) << "> {\n"
+            << "  using reactions = ufsm::List<ufsm::Transition<EvNext, " << Leaf(s, g, (l + 1) % kLeavesPerGroup)
+            << ">, ufsm::Transition<EvGroup, " << Group(s, (g + 1) % kGroupsPerSuper)
+            << ">, ufsm::Transition<EvSuper, " << Leaf((s + 1) % supers, g, l)
+            << ">, ufsm::Reaction<EvTick>>;\n"
+            << "  ufsm::Result React(const EvTick&) { return ufsm::Result::kConsumed; }\n};\n";
+      }
+    }
+  }
+  out << "\nint main() {\n  Gen machine;\n  machine.WarmUp();\n  machine.Initiate();\n"
+         "  machine.ProcessEvent(EvNext{});\n  machine.ProcessEvent(EvGroup{});\n  machine.ProcessEvent(EvSuper{});\n"
+         "  machine.ProcessEvent(EvTick{});\n  machine.ProcessEvent(EvReset{});\n  return machine.Terminated();\n}\n";
+  return supers * kStatesPerSuper;
+}
+
+struct Measurement {
+  bool ok;
+  double seconds;
+  long peak_kib;
+};
+
+Measurement Compile(const std::string& source, const std::string& object) {
+  const std::string include = "-I" UFSM_BENCH_INCLUDE_DIR;
+  std::vector<const char*> argv = {UFSM_BENCH_CXX, "-std=c++17", "-O0", include.c_str(), "-c", source.c_str(), "-o",
+                                   object.c_str(), nullptr};
+  auto start = std::chrono::steady_clock::now();
+  pid_t pid = ::fork();
+  if (pid == 0) {
+    ::execvp(argv[0], const_cast<char* const*>(argv.data()));
+    std::_Exit(127);
+  }
+  int status = 0;
+  rusage usage{};
+  if (pid < 0 || ::wait4(pid, &status, 0, &usage) < 0) return {false, 0, 0};
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return {WIFEXITED(status) && WEXITSTATUS(status) == 0, elapsed.count(), usage.ru_maxrss};
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::vector<int> sizes;
+  for (int i = 1; i < argc; ++i) sizes.push_back(std::atoi(argv[i]));
+  if (sizes.empty()) sizes = {100, 500, 1000};
+
+  const char* tmp = std::getenv("TMPDIR");
+  const std::string dir = tmp ? tmp : "/tmp";
+  std::printf("compiler: %s\n", UFSM_BENCH_CXX);
+  std::printf("%8s %10s %12s\n", "states", "seconds", "peak MiB");
+  for (int size : sizes) {
+    const std::string source = dir + "/ufsm_compile_" + std::to_string(size) + ".cc";
+    const std::string object = dir + "/ufsm_compile_" + std::to_string(size) + ".o";
+    int states = Generate(size, source);
+    Measurement m = Compile(source, object);
+    if (!m.ok) {
+      std::printf("%8d   compilation failed (source kept at %s)\n", states, source.c_str());
+      continue;
+    }
+    std::printf("%8d %10.2f %12.1f\n", states, m.seconds, m.peak_kib / 1024.0);
+    if (!std::getenv("UFSM_BENCH_KEEP")) std::remove(source.c_str());
+    std::remove(object.c_str());
+  }
+  return 0;
+}
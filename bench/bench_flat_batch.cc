@@ -0,0 +1,113 @@
+// Applies one event per instance to a large population of table-driven machines: a ProcessEvent() loop over
+// StateMachine instances, the same over a FlatPool, and FlatPool::ApplyBatch() with each kernel the CPU supports.
+#include <ufsm/flat.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace {
+
+constexpr int kSlots = 8;
+
+FSM_EVENT(EvNext){};
+FSM_EVENT(EvPrev){};
+FSM_EVENT(EvReset){};
+
+template <int N>
+struct Slot;
+
+struct Dial : ufsm::StateMachine<Dial, Slot<0>> {};
+
+template <int N>
+struct Slot : ufsm::State<Slot<N>, Dial> {
+  using reactions = ufsm::List<ufsm::Transition<EvNext, Slot<(N + 1) % kSlots>>,
+                               ufsm::Transition<EvPrev, Slot<(N + kSlots - 1) % kSlots>>,
+                               ufsm::Transition<EvReset, Slot<0>>>;
+};
+
+using DialPool = ufsm::FlatPool<Dial>;
+
+template <class F>
+double BestOf(int rounds, F&& f) {
+  double best = 1e300;
+  for (int r = 0; r < rounds; ++r) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    if (elapsed.count() < best) best = elapsed.count();
+  }
+  return best;
+}
+
+// Dispatches a batch event index to the typed ProcessEvent() of either engine.
+template <class F>
+void WithEvent(DialPool::EventIndex event, F&& f) {
+  if (event == DialPool::EventIndexOf<EvNext>())
+    f(EvNext{});
+  else if (event == DialPool::EventIndexOf<EvPrev>())
+    f(EvPrev{});
+  else if (event == DialPool::EventIndexOf<EvReset>())
+    f(EvReset{});
+}
+
+void Report(const char* name, double ms, std::size_t instances) {
+  std::printf("  %-22s %8.2f ms  %7.1f M events/s\n", name, ms, instances / ms / 1e3);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::size_t instances = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+  std::mt19937 rng(42);
+  std::vector<DialPool::EventIndex> events(instances);
+  // Mostly steps around the dial, some resets, some instances without an event.
+  for (auto& event : events) {
+    unsigned r = rng() % 16;
+    event = r < 7 ? DialPool::EventIndexOf<EvNext>()
+            : r < 13 ? DialPool::EventIndexOf<EvPrev>()
+            : r < 14 ? DialPool::EventIndexOf<EvReset>()
+                     : DialPool::kNoEvent;
+  }
+
+  std::vector<Dial> machines(instances);
+  for (auto& machine : machines) machine.Initiate();
+  double full = BestOf(5, [&] {
+    for (std::size_t i = 0; i < instances; ++i)
+      WithEvent(events[i], [&](const auto& ev) { machines[i].ProcessEvent(ev); });
+  });
+
+  DialPool pool;
+  pool.Reserve(instances);
+  for (std::size_t i = 0; i < instances; ++i) pool.Add();
+  double flat = BestOf(5, [&] {
+    for (std::size_t i = 0; i < instances; ++i)
+      WithEvent(events[i], [&](const auto& ev) { pool.ProcessEvent(i, ev); });
+  });
+
+  std::printf("%zu instances, %d leaf states\n", instances, kSlots);
+  Report("StateMachine loop", full, instances);
+  Report("FlatPool loop", flat, instances);
+
+  const struct {
+    const char* name;
+    ufsm::BatchIsa isa;
+  } kernels[] = {{"ApplyBatch scalar", ufsm::BatchIsa::kScalar},
+                 {"ApplyBatch AVX2", ufsm::BatchIsa::kAvx2},
+                 {"ApplyBatch AVX-512", ufsm::BatchIsa::kAvx512}};
+  std::vector<DialPool::Id> custom;
+  for (const auto& kernel : kernels) {
+    if (!DialPool::Supports(kernel.isa)) {
+      std::printf("  %-22s unsupported on this CPU\n", kernel.name);
+      continue;
+    }
+    Report(kernel.name, BestOf(5, [&] { pool.ApplyBatch(events.data(), custom, kernel.isa); }), instances);
+  }
+
+  unsigned checksum = 0;
+  for (std::size_t i = 0; i < instances; ++i) checksum += pool.Leaf(i);
+  std::printf("  (checksum %u)\n", checksum);
+  return 0;
+}
@@ -0,0 +1,89 @@
+// Reports the per-instance memory footprint of state machines: sizeof() and the heap bytes and
+// allocations made by construction, Initiate() and Hibernate().
+#include <ufsm/flat.h>
+#include <ufsm/ufsm.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "alloc_counter.h"
+
+namespace {
+
+FSM_EVENT(EvNext){};
+
+struct FlatIdle;
+struct FlatBusy;
+
+FSM_STATE_MACHINE(FlatMachine, FlatIdle){};
+
+FSM_STATE(FlatIdle, FlatMachine) { using reactions = ufsm::List<ufsm::Transition<EvNext, FlatBusy>>; };
+FSM_STATE(FlatBusy, FlatMachine) { using reactions = ufsm::List<ufsm::Transition<EvNext, FlatIdle>>; };
+
+struct NestedTop;
+struct NestedMid;
+struct NestedLeaf;
+
+struct NestedPolicy : ufsm::DefaultPolicy {
+  static constexpr std::size_t kMaxDepth = 3;
+};
+
+FSM_STATE_MACHINE(NestedMachine, NestedTop, NestedPolicy){};
+
+FSM_STATE(NestedTop, NestedMachine, NestedMid){};
+FSM_STATE(NestedMid, NestedTop, NestedLeaf){};
+FSM_STATE(NestedLeaf, NestedMid){};
+
+template <typename Machine>
+void Report(const char* name, std::size_t instances) {
+  std::vector<std::unique_ptr<Machine>> machines;
+  machines.reserve(instances);
+
+  auto before = bench::AllocCounter::Snapshot();
+  for (std::size_t i = 0; i < instances; ++i) machines.push_back(std::make_unique<Machine>());
+  auto constructed = bench::AllocCounter::Snapshot();
+  for (auto& m : machines) m->Initiate();
+  auto initiated = bench::AllocCounter::Snapshot();
+  for (auto& m : machines) m->Hibernate();
+  auto hibernated = bench::AllocCounter::Snapshot();
+
+  // The machine objects themselves are part of the construction figure.
+  auto per_instance = [instances](const bench::AllocCounter::Counts& from, const bench::AllocCounter::Counts& to) {
+    return std::make_pair(static_cast<double>(to.live_bytes - from.live_bytes) / instances,
+                          static_cast<double>(to.allocations - from.allocations) / instances);
+  };
+  auto c = per_instance(before, constructed);
+  auto i = per_instance(before, initiated);
+  auto h = per_instance(before, hibernated);
+  std::printf("%-14s sizeof=%4zu  constructed: %7.1f B %4.1f allocs  initiated: %7.1f B %4.1f allocs  "
+              "hibernated: %7.1f B\n",
+              name, sizeof(Machine), c.first, c.second, i.first, i.second - c.second, h.first);
+}
+
+// The flat engine keeps one leaf index per instance.
+template <typename Machine>
+void ReportFlat(const char* name, std::size_t instances) {
+  auto before = bench::AllocCounter::Snapshot();
+  {
+    ufsm::FlatPool<Machine> pool;
+    pool.Reserve(instances);
+    for (std::size_t i = 0; i < instances; ++i) pool.Add();
+    auto filled = bench::AllocCounter::Snapshot();
+    std::printf("%-14s flat pool:   %7.1f B per instance\n", name,
+                static_cast<double>(filled.live_bytes - before.live_bytes) / instances);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::size_t instances = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+  std::printf("heap footprint per instance over %zu instances\n", instances);
+  Report<FlatMachine>("FlatMachine", instances);
+  Report<NestedMachine>("NestedMachine", instances);
+  ReportFlat<FlatMachine>("FlatMachine", instances);
+  return 0;
+}
@@ -0,0 +1,100 @@
+// Appends events to a memory-mapped journal from one thread, then replays the journal into a fresh machine.
+//
+//   ufsm_bench_journal [records] [journal prefix]
+#include <ufsm/journal.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+FSM_EVENT(BJTick) {
+  static constexpr ufsm::WireId wire_id = ufsm::HashWireName("bench.tick");
+  explicit BJTick(std::uint64_t v) : value(v) {}
+  std::size_t Encode(unsigned char* out, std::size_t capacity) const {
+    if (capacity >= sizeof(value)) std::memcpy(out, &value, sizeof(value));
+    return sizeof(value);
+  }
+  static ufsm::detail::EventBase* Decode(std::string_view bytes, void* storage) {
+    if (bytes.size() != sizeof(std::uint64_t)) return nullptr;
+    std::uint64_t value;
+    std::memcpy(&value, bytes.data(), sizeof(value));
+    return new (storage) BJTick(value);
+  }
+  std::uint64_t value;
+};
+
+struct BJCounting;
+
+FSM_STATE_MACHINE(BJMachine, BJCounting) { std::uint64_t sum = 0; };
+
+FSM_STATE(BJCounting, BJMachine) {
+  using reactions = ufsm::List<ufsm::Reaction<BJTick>>;
+  void React(const BJTick& e) { OutermostContext().sum += e.value; }
+};
+
+void RemoveSegments(const std::string& prefix) {
+  std::vector<std::uint32_t> sequences;
+  ufsm::detail::ListJournalSegments(prefix, sequences);
+  for (auto sequence : sequences) std::remove(ufsm::detail::JournalSegmentPath(prefix, sequence).c_str());
+}
+
+double Seconds(std::chrono::steady_clock::time_point since) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const std::size_t records = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4000000;
+  const std::string prefix = argc > 2 ? argv[2] : "ufsm_bench_journal";
+  RemoveSegments(prefix);
+
+  BJMachine machine;
+  machine.Initiate();
+  ufsm::JournalWriter writer;
+  if (!writer.Open(prefix)) {
+    std::perror("open journal");
+    return 1;
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < records; ++i) {
+    if (!writer.Append(BJTick{i})) {
+      std::perror("append");
+      return 1;
+    }
+  }
+  const double append = Seconds(start);
+
+  start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < records; ++i) writer.Process(machine, BJTick{i});
+  const double process = Seconds(start);
+  const auto segments = writer.segment() + 1;
+  writer.Close();
+
+  ufsm::WireRegistry registry;
+  registry.Register<BJTick>();
+  ufsm::JournalReader reader;
+  BJMachine replica;
+  replica.Initiate();
+  std::size_t replayed = 0;
+  start = std::chrono::steady_clock::now();
+  if (!reader.Open(prefix) || !reader.Replay(replica, registry, &replayed)) {
+    std::perror("replay");
+    return 1;
+  }
+  const double replay = Seconds(start);
+
+  std::printf("records            %zu x 2 in %u segments\n", records, static_cast<unsigned>(segments));
+  std::printf("append             %8.2f M records/s\n", records / append / 1e6);
+  std::printf("append + process   %8.2f M records/s\n", records / process / 1e6);
+  std::printf("replay             %8.2f M records/s\n", replayed / replay / 1e6);
+  std::printf("replica matches    %s\n", replica.sum == 2 * machine.sum ? "yes" : "no");
+  RemoveSegments(prefix);
+  return replica.sum == 2 * machine.sum ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+// Loads a large runtime-defined machine: opening and checking the table, from memory and from a file (memory-mapped
+// at this size), binding its actions, then dispatching random events through it.
+//
+//   ufsm_bench_runtime_load [states] [table file]
+#include <ufsm/runtime.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr ufsm::RuntimeId kEvents = 32;
+constexpr int kFanout = 8;
+
+template <class F>
+double BestOf(int rounds, F&& f) {
+  double best = 1e300;
+  for (int r = 0; r < rounds; ++r) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    if (elapsed.count() < best) best = elapsed.count();
+  }
+  return best;
+}
+
+// A tree of `states` states with kFanout children per composite, each state reacting to a few events with
+// transitions to random states and one internal action.
+std::vector<std::uint8_t> BuildTable(std::size_t states) {
+  ufsm::RuntimeBuilder builder;
+  for (std::size_t i = 0; i < states; ++i)
+    builder.AddState("S" + std::to_string(i), i == 0 ? ufsm::kRuntimeNone : static_cast<ufsm::RuntimeId>((i - 1) / kFanout));
+  for (ufsm::RuntimeId e = 0; e < kEvents; ++e) builder.AddEvent("E" + std::to_string(e));
+  std::mt19937 rng(42);
+  for (ufsm::RuntimeId s = 0; s < states; ++s) {
+    for (int r = 0; r < 3; ++r) builder.AddTransition(s, rng() % kEvents, rng() % states, r == 0 ? "step" : "");
+    builder.AddInternal(s, rng() % kEvents, "tick");
+  }
+  return builder.Build();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::size_t states = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000;
+  std::string path = argc > 2 ? argv[2] : "ufsm_bench_runtime_load.bin";
+
+  auto bytes = BuildTable(states);
+  std::FILE* file = std::fopen(path.c_str(), "wb");
+  if (!file || std::fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size()) {
+    std::fprintf(stderr, "cannot write %s\n", path.c_str());
+    return 1;
+  }
+  std::fclose(file);
+
+  std::size_t ticks = 0;
+  ufsm::RuntimeActions actions;
+  actions.Register("step", [](ufsm::RuntimeMachine&) {});
+  actions.Register("tick", [&](ufsm::RuntimeMachine&) { ++ticks; });
+
+  std::printf("%zu states, %u events, %zu table bytes\n", states, kEvents, bytes.size());
+  double assign = BestOf(20, [&] {
+    ufsm::RuntimeDefinition definition;
+    if (!definition.Assign(bytes.data(), bytes.size())) std::abort();
+  });
+  std::printf("  %-22s %8.3f ms\n", "Assign", assign);
+  bool mapped = false;
+  double open = BestOf(20, [&] {
+    ufsm::RuntimeDefinition definition;
+    if (!definition.Open(path.c_str()) || !definition.Bind(actions)) std::abort();
+    mapped = definition.Mapped();
+  });
+  std::printf("  %-22s %8.3f ms%s\n", "Open + Bind", open, mapped ? " (mapped)" : "");
+
+  ufsm::RuntimeDefinition definition;
+  if (!definition.Open(path.c_str()) || !definition.Bind(actions)) return 1;
+  ufsm::RuntimeMachine machine(definition);
+  machine.Initiate();
+  constexpr std::size_t kDispatches = 1000000;
+  std::vector<ufsm::RuntimeId> events(kDispatches);
+  std::mt19937 rng(7);
+  for (auto& event : events) event = rng() % kEvents;
+  double dispatch = BestOf(5, [&] {
+    for (auto event : events) machine.ProcessEvent(event);
+  });
+  std::printf("  %-22s %8.2f ms  %7.1f M events/s\n", "ProcessEvent", dispatch, kDispatches / dispatch / 1e3);
+  std::printf("  (leaf %u, %zu ticks)\n", machine.Leaf(), ticks);
+  std::remove(path.c_str());
+  return 0;
+}
@@ -0,0 +1,346 @@
+// Soak load generator: drives many machines from several threads for a long run and reports throughput, per-event
+// latency percentiles and resident memory at every interval, so that slow queue or allocator growth shows up.
+//
+//   ufsm_loadgen [--threads=N] [--machines=N] [--seconds=N] [--interval=N] [--mix=markov|random]
+//                [--machine=both|connector|deep]
+//
+// Every thread owns --machines instances of each selected machine: the connector of examples/connector, and a
+// generated deep hierarchy whose transitions rebuild up to kDepth states and which posts and defers events. Events
+// are drawn uniformly (random) or from a distribution that depends on the machine's current state (markov), and each
+// ProcessEvent() is timed on its own, clock reads included.
+#define UFSM_EXAMPLE_QUIET
+#include "../examples/connector/connector_state_machine.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Deep hierarchy: kBranches chains of kDepth nested states. Switching branches exits and re-enters whole chains,
+// restarting re-enters the lower half of one, work posts a follow-up event, and even branches defer holds until
+// they are left.
+constexpr int kBranches = 4;
+constexpr int kDepth = 8;
+
+FSM_EVENT(EvSwitch){};
+FSM_EVENT(EvRestart){};
+FSM_EVENT(EvWork){};
+FSM_EVENT(EvWorkDone){};
+FSM_EVENT(EvHold){};
+
+template <int B, int L>
+struct Node;
+
+struct Deep : ufsm::StateMachine<Deep, Node<0, 0>> {
+  std::uint64_t work = 0;
+};
+
+template <int B, int L>
+using NodeContext = std::conditional_t<L == 0, Deep, Node<B, L - 1>>;
+template <int B, int L>
+using NodeInitial = std::conditional_t<L + 1 < kDepth, Node<B, L + 1>, void>;
+
+template <int B, int L>
+struct Node : ufsm::State<Node<B, L>, NodeContext<B, L>, NodeInitial<B, L>> {
+  using Leaf = ufsm::List<ufsm::Transition<EvSwitch, Node<(B + 1) % kBranches, 0>>, ufsm::Reaction<EvWork>,
+                          std::conditional_t<B % 2 == 0, ufsm::Deferral<EvHold>, ufsm::Reaction<EvHold>>>;
+  using reactions = std::conditional_t<
+      L + 1 == kDepth, Leaf,
+      std::conditional_t<L == kDepth / 2, ufsm::List<ufsm::Transition<EvRestart, Node<B, L>>>,
+                         std::conditional_t<L == 0, ufsm::List<ufsm::Reaction<EvWorkDone>>, ufsm::List<>>>>;
+
+  ufsm::Result React(const EvWork&) {
+    this->PostEvent(EvWorkDone{});
+    return this->DiscardEvent();
+  }
+  ufsm::Result React(const EvWorkDone&) {
+    ++this->OutermostContext().work;
+    return this->DiscardEvent();
+  }
+  ufsm::Result React(const EvHold&) { return this->DiscardEvent(); }
+};
+
+// Event mixes. Markov weights are indexed by a coarse state of the machine, so that most events drawn are the ones
+// the machine reacts to there, as in a real session.
+enum class Mix { kRandom, kMarkov };
+
+struct ConnectorDriver {
+  static constexpr const char* kName = "connector";
+  static constexpr int kEvents = 6;
+  // Per state (Disconnected, Connecting, Working, Disconnecting), weights of Connect, ConnectSuccess, ConnectFailure,
+  // Disconnect, DisconnectSuccess, Tick.
+  static constexpr int kWeights[4][kEvents] = {
+      {90, 0, 0, 0, 0, 10}, {0, 70, 20, 0, 0, 10}, {0, 0, 0, 5, 0, 95}, {0, 0, 0, 0, 80, 20}};
+
+  static int StateOf(const Connector& m) {
+    return m.IsInState<Disconnected>() ? 0 : m.IsInState<Connecting>() ? 1 : m.IsInState<Connected>() ? 2 : 3;
+  }
+  static void Fire(Connector& m, int event) {
+    switch (event) {
+      case 0: m.ProcessEvent(EvConnect{}); break;
+      case 1: m.ProcessEvent(EvConnectSuccess{}); break;
+      case 2: m.ProcessEvent(EvConnectFailure{}); break;
+      case 3: m.ProcessEvent(EvDisconnect{}); break;
+      case 4: m.ProcessEvent(EvDisconnectSuccess{}); break;
+      default: m.ProcessEvent(EvTick{}); break;
+    }
+  }
+};
+
+struct DeepDriver {
+  static constexpr const char* kName = "deep";
+  static constexpr int kEvents = 4;
+  // Per branch parity (deferring, consuming), weights of Switch, Restart, Work, Hold.
+  static constexpr int kWeights[2][kEvents] = {{10, 10, 70, 10}, {15, 10, 55, 20}};
+
+  static int StateOf(const Deep& m) {
+    return m.IsInState<Node<0, 0>>() || m.IsInState<Node<2, 0>>() ? 0 : 1;
+  }
+  static void Fire(Deep& m, int event) {
+    switch (event) {
+      case 0: m.ProcessEvent(EvSwitch{}); break;
+      case 1: m.ProcessEvent(EvRestart{}); break;
+      case 2: m.ProcessEvent(EvWork{}); break;
+      default: m.ProcessEvent(EvHold{}); break;
+    }
+  }
+};
+
+// Log-linear latency histogram in nanoseconds: exact below 16 ns, then 16 buckets per power of two. Written by one
+// thread and read, racily but atomically, by the reporter.
+class Histogram {
+ public:
+  static constexpr int kSub = 16;
+  static constexpr int kBuckets = kSub * 40;
+
+  void Record(std::uint64_t ns) {
+    auto& bucket = buckets_[Index(ns)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  void AddTo(std::array<std::uint64_t, kBuckets>& counts) const {
+    for (int i = 0; i < kBuckets; ++i) counts[i] += buckets_[i].load(std::memory_order_relaxed);
+  }
+
+  static int Index(std::uint64_t ns) {
+    if (ns < kSub) return static_cast<int>(ns);
+    int log = 63 - __builtin_clzll(ns);  // >= 4
+    int index = (log - 3) * kSub + static_cast<int>((ns >> (log - 4)) & (kSub - 1));
+    return std::min(index, kBuckets - 1);
+  }
+
+  // The smallest value of a bucket.
+  static std::uint64_t Lower(int index) {
+    if (index < kSub) return static_cast<std::uint64_t>(index);
+    int log = index / kSub + 3;
+    return (std::uint64_t{1} << log) | (static_cast<std::uint64_t>(index % kSub) << (log - 4));
+  }
+
+ private:
+  std::array<std::atomic<std::uint64_t>, kBuckets> buckets_{};
+};
+
+using Counts = std::array<std::uint64_t, Histogram::kBuckets>;
+
+std::uint64_t Percentile(const Counts& counts, std::uint64_t total, double p) {
+  if (total == 0) return 0;
+  auto rank = static_cast<std::uint64_t>(p * static_cast<double>(total - 1));
+  std::uint64_t seen = 0;
+  for (int i = 0; i < Histogram::kBuckets; ++i) {
+    seen += counts[i];
+    if (seen > rank) return Histogram::Lower(i);
+  }
+  return Histogram::Lower(Histogram::kBuckets - 1);
+}
+
+double ResidentMiB() {
+#if defined(__linux__)
+  if (std::FILE* statm = std::fopen("/proc/self/statm", "r")) {
+    unsigned long pages = 0, resident = 0;
+    int n = std::fscanf(statm, "%lu %lu", &pages, &resident);
+    std::fclose(statm);
+    if (n == 2) return static_cast<double>(resident) * static_cast<double>(::sysconf(_SC_PAGESIZE)) / (1 << 20);
+  }
+#endif
+  return 0;
+}
+
+struct Options {
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+  std::size_t machines = 1000;
+  double seconds = 10;
+  double interval = 1;
+  Mix mix = Mix::kMarkov;
+  bool connector = true;
+  bool deep = true;
+};
+
+bool Parse(int argc, char** argv, Options& options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto eq = arg.find('=');
+    std::string key = arg.substr(0, eq), value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+    if (key == "--threads") {
+      options.threads = static_cast<unsigned>(std::max(1l, std::strtol(value.c_str(), nullptr, 10)));
+    } else if (key == "--machines") {
+      options.machines = std::max<std::size_t>(1, std::strtoul(value.c_str(), nullptr, 10));
+    } else if (key == "--seconds") {
+      options.seconds = std::strtod(value.c_str(), nullptr);
+    } else if (key == "--interval") {
+      options.interval = std::max(0.01, std::strtod(value.c_str(), nullptr));
+    } else if (key == "--mix" && (value == "markov" || value == "random")) {
+      options.mix = value == "markov" ? Mix::kMarkov : Mix::kRandom;
+    } else if (key == "--machine" && (value == "both" || value == "connector" || value == "deep")) {
+      options.connector = value != "deep";
+      options.deep = value != "connector";
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The machines, generator and histogram of one thread.
+class Worker {
+ public:
+  Worker(const Options& options, unsigned seed)
+      : options_(options),
+        rng_(seed),
+        connectors_(options.connector ? options.machines : 0),
+        deeps_(options.deep ? options.machines : 0) {
+    for (auto& m : connectors_) m.Initiate();
+    for (auto& m : deeps_) m.Initiate();
+  }
+
+  void Run(const std::atomic<bool>& stop) {
+    while (!stop.load(std::memory_order_relaxed)) {
+      for (int i = 0; i < 256; ++i) {
+        if (!deeps_.empty() && (connectors_.empty() || rng_() % 2))
+          Step<DeepDriver>(deeps_);
+        else
+          Step<ConnectorDriver>(connectors_);
+      }
+    }
+  }
+
+  const Histogram& Latency() const { return latency_; }
+
+ private:
+  template <class Driver, class Machine>
+  void Step(std::vector<Machine>& machines) {
+    Machine& machine = machines[rng_() % machines.size()];
+    int event;
+    if (options_.mix == Mix::kRandom) {
+      event = static_cast<int>(rng_() % Driver::kEvents);
+    } else {
+      const int* weights = Driver::kWeights[Driver::StateOf(machine)];
+      int sum = 0;
+      for (int e = 0; e < Driver::kEvents; ++e) sum += weights[e];
+      int pick = static_cast<int>(rng_() % static_cast<unsigned>(sum));
+      for (event = 0; pick >= weights[event]; ++event) pick -= weights[event];
+    }
+    auto start = std::chrono::steady_clock::now();
+    Driver::Fire(machine, event);
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    latency_.Record(static_cast<std::uint64_t>(ns));
+  }
+
+  const Options& options_;
+  std::minstd_rand rng_;
+  std::vector<Connector> connectors_;
+  std::vector<Deep> deeps_;
+  Histogram latency_;
+};
+
+void PrintRow(const char* label, double events_per_s, const Counts& counts, std::uint64_t events, double rss) {
+  std::uint64_t max = 0;
+  for (int i = 0; i < Histogram::kBuckets; ++i)
+    if (counts[i]) max = Histogram::Lower(i);
+  std::printf("%8s %12.0f %8llu %8llu %8llu %10llu %10.1f\n", label, events_per_s,
+              static_cast<unsigned long long>(Percentile(counts, events, 0.5)),
+              static_cast<unsigned long long>(Percentile(counts, events, 0.99)),
+              static_cast<unsigned long long>(Percentile(counts, events, 0.999)), static_cast<unsigned long long>(max),
+              rss);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!Parse(argc, argv, options)) {
+    std::fprintf(stderr,
+                 "usage: %s [--threads=N] [--machines=N] [--seconds=N] [--interval=N] [--mix=markov|random] "
+                 "[--machine=both|connector|deep]\n",
+                 argv[0]);
+    return 2;
+  }
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  for (unsigned t = 0; t < options.threads; ++t) workers.push_back(std::make_unique<Worker>(options, 1234 + t));
+  std::printf("%u threads x %zu machines (%s%s%s), %s mix, %.0f s\n", options.threads, options.machines,
+              options.connector ? ConnectorDriver::kName : "", options.connector && options.deep ? " + " : "",
+              options.deep ? DeepDriver::kName : "", options.mix == Mix::kMarkov ? "markov" : "random",
+              options.seconds);
+  std::printf("%8s %12s %8s %8s %8s %10s %10s\n", "time s", "events/s", "p50 ns", "p99 ns", "p999 ns", "max ns",
+              "rss MiB");
+
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> threads;
+  for (auto& worker : workers) threads.emplace_back([&stop, w = worker.get()] { w->Run(stop); });
+
+  using Clock = std::chrono::steady_clock;
+  const auto begin = Clock::now();
+  auto last_time = begin;
+  Counts last{};
+  double first_rss = 0, rss = 0;
+  for (int tick = 1;; ++tick) {
+    auto deadline = begin + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(
+                                std::min(options.seconds, tick * options.interval)));
+    std::this_thread::sleep_until(deadline);
+    auto now = Clock::now();
+
+    Counts total{};
+    for (const auto& worker : workers) worker->Latency().AddTo(total);
+    Counts delta{};
+    std::uint64_t delta_events = 0;
+    for (int i = 0; i < Histogram::kBuckets; ++i) {
+      delta[i] = total[i] - last[i];
+      delta_events += delta[i];
+    }
+    rss = ResidentMiB();
+    if (tick == 1) first_rss = rss;
+    char label[32];
+    std::snprintf(label, sizeof(label), "%.1f", std::chrono::duration<double>(now - begin).count());
+    PrintRow(label, delta_events / std::chrono::duration<double>(now - last_time).count(), delta, delta_events, rss);
+    std::fflush(stdout);
+    last = total;
+    last_time = now;
+    if (now - begin >= std::chrono::duration<double>(options.seconds)) break;
+  }
+
+  stop = true;
+  for (auto& thread : threads) thread.join();
+  Counts total{};
+  for (const auto& worker : workers) worker->Latency().AddTo(total);
+  std::uint64_t events = 0;
+  for (auto count : total) events += count;
+  PrintRow("total", events / std::chrono::duration<double>(Clock::now() - begin).count(), total, events, rss);
+  std::printf("rss growth after the first interval: %+.1f MiB\n", rss - first_rss);
+  return 0;
+}
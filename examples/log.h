@@ -11,7 +11,12 @@
                              : __FILE__)
 #endif
 
+// Define UFSM_EXAMPLE_QUIET to compile the tracing out, e.g. when an example machine is reused by a benchmark.
+#if defined(UFSM_EXAMPLE_QUIET)
+#define LOG while (false) std::cout
+#else
 #define LOG std::cout << "(" << __FILENAME__ << ":" << __LINE__ << ") "
+#endif
 
 #define MARK_FUNCTION LOG << __FUNCTION__ << std::endl
 
@@ -0,0 +1,157 @@
+#ifndef UFSM_BROADCAST_H_
+#define UFSM_BROADCAST_H_
+
+// Delivering one event to a population of machines, grouped by leaf state.
+//
+// A plain loop of ProcessEvent() calls over many machines jumps between the reaction code of whatever leaf state
+// each machine happens to be in. Broadcast() first buckets the machines by LeafTypeId() and then dispatches bucket
+// after bucket, so consecutive calls run the same reaction code with warm instruction cache and branch predictors.
+// Each machine still receives the event exactly once, through its own ProcessEvent(); machines keep their relative
+// order within a bucket.
+
+#include <ufsm/ufsm.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+namespace ufsm {
+
+namespace detail {
+
+template <typename T, typename = void>
+struct IsMachineLike : std::false_type {};
+
+template <typename T>
+struct IsMachineLike<T, std::void_t<decltype(std::declval<const T&>().LeafTypeId())>> : std::true_type {};
+
+// Reaches into the machine for the leaf state pointer.
+struct BroadcastAccess {
+  // Start fetching every cache line of the machine, without waiting for any of them.
+  template <class Machine>
+  static void PrefetchMachine([[maybe_unused]] const Machine& machine) noexcept {
+#if defined(__GNUC__)
+    const char* bytes = reinterpret_cast<const char*>(&machine);
+    for (std::size_t offset = 0; offset < sizeof(Machine); offset += 64) __builtin_prefetch(bytes + offset);
+#endif
+  }
+
+  // Start fetching the leaf state of a machine whose own lines have arrived.
+  template <class Machine>
+  static void PrefetchLeaf([[maybe_unused]] const Machine& machine) noexcept {
+#if defined(__GNUC__)
+    __builtin_prefetch(machine.core_.CurrentState());
+#endif
+  }
+};
+
+// A pool element is either a machine or something dereferencing to one.
+template <class T>
+auto& Deref(T& element) {
+  if constexpr (IsMachineLike<T>::value)
+    return element;
+  else
+    return *element;
+}
+
+}  // namespace detail
+
+// Machines are grouped within consecutive blocks of this many pool elements. A block stays in cache between the
+// grouping pass and the dispatch, so the pool is still walked front to back.
+// Broadcast() keeps its working set on the stack, about 32 KB with 512 machines per block: the pointers of three
+// blocks in flight and the bucketing tables of the one being dispatched. Mind it on threads with small stacks.
+inline constexpr std::size_t kBroadcastBlock = 512;
+
+namespace detail {
+
+// Dispatch `event` to the n machines of a block, grouped by leaf state.
+template <class Machine, class Ev>
+void BroadcastBlock(Machine* const* block, std::size_t n, const Ev& event) {
+  constexpr std::size_t kSlots = 2 * kBroadcastBlock;  // Open-addressing table from leaf to bucket.
+  static const int terminated = 0;                     // Stands in for the null leaf of terminated machines.
+
+  Machine* grouped[kBroadcastBlock];
+  const void* leaves[kBroadcastBlock];
+  std::uint16_t bucket_of[kBroadcastBlock];
+  std::uint16_t bucket_begin[kBroadcastBlock];
+  const void* slot_leaf[kSlots] = {};
+  std::uint16_t slot_bucket[kSlots];
+
+  for (std::size_t i = 0; i < n; ++i) leaves[i] = block[i]->LeafTypeId();
+
+  // Bucket by leaf state and count.
+  std::size_t bucket_count = 0;
+  for (std::size_t i = 0; i < n; ++i) {
+    const void* leaf = leaves[i] ? leaves[i] : &terminated;
+    std::size_t slot = (reinterpret_cast<std::uintptr_t>(leaf) * 0x9E3779B97F4A7C15ull >> 32) & (kSlots - 1);
+    while (slot_leaf[slot] && slot_leaf[slot] != leaf) slot = (slot + 1) & (kSlots - 1);
+    if (!slot_leaf[slot]) {
+      slot_leaf[slot] = leaf;
+      slot_bucket[slot] = static_cast<std::uint16_t>(bucket_count);
+      bucket_begin[bucket_count++] = 0;
+    }
+    bucket_of[i] = slot_bucket[slot];
+    ++bucket_begin[bucket_of[i]];
+  }
+
+  // Counting sort.
+  std::uint16_t offset = 0;
+  for (std::size_t b = 0; b < bucket_count; ++b) {
+    std::uint16_t count = bucket_begin[b];
+    bucket_begin[b] = offset;
+    offset = static_cast<std::uint16_t>(offset + count);
+  }
+  for (std::size_t i = 0; i < n; ++i) grouped[bucket_begin[bucket_of[i]]++] = block[i];
+
+  // Dispatch.
+  for (std::size_t i = 0; i < n; ++i) grouped[i]->ProcessEvent(event);
+}
+
+}  // namespace detail
+
+// Process `event` on every machine of `pool`: a range of machines or of (smart) pointers to machines, all of one
+// type. Within each block, machines in the same leaf state are dispatched back to back, keeping their pool order.
+// Returns the number of machines visited.
+//
+// Large pools do not fit in cache, so the blocks are pipelined: while one block is dispatched, the machines of the
+// block two ahead and the leaf states of the next one are being fetched. A block's memory has arrived by the time
+// it is grouped, and the misses of a whole block overlap instead of stalling each dispatch.
+template <class Pool, class Ev>
+std::size_t Broadcast(Pool& pool, const Ev& event) {
+  using Machine = std::remove_reference_t<decltype(detail::Deref(*std::begin(pool)))>;
+  struct Block {
+    Machine* machines[kBroadcastBlock];
+    std::size_t size;
+  };
+
+  Block blocks[3];
+  auto it = std::begin(pool);
+  auto end = std::end(pool);
+  auto fetch = [&](Block& b) {
+    for (b.size = 0; it != end && b.size < kBroadcastBlock; ++it) {
+      b.machines[b.size] = &detail::Deref(*it);
+      detail::BroadcastAccess::PrefetchMachine(*b.machines[b.size++]);
+    }
+  };
+  auto fetch_leaves = [](const Block& b) {
+    for (std::size_t i = 0; i < b.size; ++i) detail::BroadcastAccess::PrefetchLeaf(*b.machines[i]);
+  };
+
+  std::size_t visited = 0;
+  fetch(blocks[0]);
+  fetch(blocks[1]);
+  fetch_leaves(blocks[0]);
+  for (std::size_t k = 0; blocks[k % 3].size != 0; ++k) {
+    fetch(blocks[(k + 2) % 3]);
+    fetch_leaves(blocks[(k + 1) % 3]);
+    detail::BroadcastBlock(blocks[k % 3].machines, blocks[k % 3].size, event);
+    visited += blocks[k % 3].size;
+  }
+  return visited;
+}
+
+}  // namespace ufsm
+
+#endif  // UFSM_BROADCAST_H_
@@ -0,0 +1,229 @@
+#ifndef UFSM_COROUTINE_H_
+#define UFSM_COROUTINE_H_
+
+// Asynchronous state activities on C++20 coroutines.
+//
+// A state starts an activity by calling one of its member coroutines returning ufsm::Activity, usually from
+// OnEntry(), and keeps the result as a member. The activity co_awaits timers and I/O completions on an executor.
+// A completion does not resume the coroutine on the spot: it runs the resumption as a step of the owning machine
+// (StateMachine::Run), so the events the activity posts are processed as soon as it suspends again, in order with
+// everything else the machine sees. Exiting the state destroys the member, which cancels the activity: the
+// coroutine frame is destroyed and completions still in flight are ignored.
+//
+// Activities talk to the machine through PostEvent(); they must not Transit() themselves out of their state.
+//
+// An executor is any object with
+//   void Post(std::function<void()> callback);
+//   void PostAfter(std::chrono::nanoseconds delay, std::function<void()> callback);
+// whose callbacks run on the thread driving the machine.
+
+#include <ufsm/ufsm.h>
+
+#if !defined(__cpp_impl_coroutine)
+#error "ufsm/coroutine.h requires C++20 coroutines"
+#endif
+
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <optional>
+
+namespace ufsm {
+
+namespace detail {
+
+// State shared by an activity and the completions it is waiting for. It outlives the coroutine frame, so a late
+// completion can tell that the activity is gone.
+struct ActivityLink {
+  std::coroutine_handle<> handle;  // Null once the activity finished or was cancelled.
+  void* machine = nullptr;
+  void (*resume)(void* machine, ActivityLink& link) = nullptr;
+
+  bool Alive() const noexcept { return static_cast<bool>(handle); }
+  void Resume() {
+    if (handle) resume(machine, *this);
+  }
+};
+
+template <class Machine>
+void ResumeActivity(void* machine, ActivityLink& link) {
+  static_cast<Machine*>(machine)->Run([&link] {
+    if (link.handle) link.handle.resume();
+  });
+}
+
+}  // namespace detail
+
+// Handle of a running activity; destroying it cancels the activity.
+class Activity {
+ public:
+  struct promise_type {
+    // Member coroutines of a state see the state first: that is how the activity finds its machine.
+    template <class StateRef, class... Args>
+    explicit promise_type(StateRef&& state, Args&&...) : link(std::make_shared<detail::ActivityLink>()) {
+      // Spelled through decltype: GCC 12 keeps the reference on StateRef-derived aliases here.
+      using StateType = std::remove_cv_t<std::remove_reference_t<decltype(state)>>;
+      static_assert(std::is_base_of_v<detail::StateBase, StateType>,
+                    "ufsm::Activity must be returned by a member coroutine of a state");
+      using Machine = typename StateType::OutermostContextType;
+      link->machine = &state.OutermostContext();
+      link->resume = &detail::ResumeActivity<Machine>;
+    }
+
+    Activity get_return_object() {
+      link->handle = std::coroutine_handle<promise_type>::from_promise(*this);
+      return Activity(std::coroutine_handle<promise_type>::from_promise(*this), link);
+    }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_void() noexcept { link->handle = nullptr; }
+    void unhandled_exception() noexcept { std::terminate(); }
+
+    std::shared_ptr<detail::ActivityLink> link;
+  };
+
+  Activity() = default;
+  Activity(Activity&& other) noexcept
+      : handle_(std::exchange(other.handle_, nullptr)), link_(std::move(other.link_)) {}
+  Activity& operator=(Activity&& other) noexcept {
+    if (this != &other) {
+      Cancel();
+      handle_ = std::exchange(other.handle_, nullptr);
+      link_ = std::move(other.link_);
+    }
+    return *this;
+  }
+  Activity(const Activity&) = delete;
+  Activity& operator=(const Activity&) = delete;
+  ~Activity() { Cancel(); }
+
+  // Stop the activity where it is suspended. Pending completions become no-ops.
+  void Cancel() noexcept {
+    if (!handle_) return;
+    link_->handle = nullptr;
+    handle_.destroy();
+    handle_ = nullptr;
+  }
+
+  // True once the coroutine ran to its end, or if there is no activity.
+  bool Done() const noexcept { return !link_ || !link_->Alive(); }
+
+ private:
+  Activity(std::coroutine_handle<promise_type> handle, std::shared_ptr<detail::ActivityLink> link)
+      : handle_(handle), link_(std::move(link)) {}
+
+  std::coroutine_handle<promise_type> handle_;
+  std::shared_ptr<detail::ActivityLink> link_;
+};
+
+// Suspend the activity for a while.
+template <class Executor>
+auto Delay(Executor& executor, std::chrono::nanoseconds delay) {
+  struct Awaiter {
+    Executor& executor;
+    std::chrono::nanoseconds delay;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<Activity::promise_type> handle) {
+      executor.PostAfter(delay, [link = handle.promise().link] { link->Resume(); });
+    }
+    void await_resume() const noexcept {}
+  };
+  return Awaiter{executor, delay};
+}
+
+// Yield to the executor: the activity continues in a later step of the machine.
+template <class Executor>
+auto Yield(Executor& executor) {
+  struct Awaiter {
+    Executor& executor;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<Activity::promise_type> handle) {
+      executor.Post([link = handle.promise().link] { link->Resume(); });
+    }
+    void await_resume() const noexcept {}
+  };
+  return Awaiter{executor};
+}
+
+namespace detail {
+
+template <class T>
+struct CallbackResult {
+  std::optional<T> value;
+  template <class... Args>
+  void Set(Args&&... args) {
+    value.emplace(std::forward<Args>(args)...);
+  }
+  bool Ready() const noexcept { return value.has_value(); }
+  T Take() { return std::move(*value); }
+};
+
+template <>
+struct CallbackResult<void> {
+  bool ready = false;
+  void Set() noexcept { ready = true; }
+  bool Ready() const noexcept { return ready; }
+  void Take() const noexcept {}
+};
+
+}  // namespace detail
+
+// Completion handler given to the operation started by AwaitCallback(). Call it once, with the result.
+template <class T>
+class Completion {
+ public:
+  template <class... Args>
+  void operator()(Args&&... args) const {
+    if (!link_->Alive()) return;  // The activity was cancelled; its result slot is gone.
+    result_->Set(std::forward<Args>(args)...);
+    if (!*starting_) link_->Resume();
+  }
+
+ private:
+  template <class, class>
+  friend class CallbackAwaiter;
+
+  Completion(std::shared_ptr<detail::ActivityLink> link, detail::CallbackResult<T>* result, const bool* starting)
+      : link_(std::move(link)), result_(result), starting_(starting) {}
+
+  std::shared_ptr<detail::ActivityLink> link_;
+  detail::CallbackResult<T>* result_;
+  const bool* starting_;
+};
+
+template <class T, class Starter>
+class CallbackAwaiter {
+ public:
+  explicit CallbackAwaiter(Starter starter) : starter_(std::move(starter)) {}
+
+  bool await_ready() const noexcept { return false; }
+  bool await_suspend(std::coroutine_handle<Activity::promise_type> handle) {
+    starting_ = true;
+    starter_(Completion<T>(handle.promise().link, &result_, &starting_));
+    starting_ = false;
+    // Completed inline: carry on without suspending.
+    return !result_.Ready();
+  }
+  T await_resume() { return result_.Take(); }
+
+ private:
+  Starter starter_;
+  detail::CallbackResult<T> result_;
+  bool starting_ = false;
+};
+
+// Bridge a callback-based asynchronous operation: `starter` is called with a Completion<T> to pass on to the
+// operation, and co_await yields the value the completion is called with.
+//
+//   int n = co_await ufsm::AwaitCallback<int>([&](auto done) { socket.AsyncRead(buffer, std::move(done)); });
+template <class T = void, class Starter>
+CallbackAwaiter<T, Starter> AwaitCallback(Starter starter) {
+  return CallbackAwaiter<T, Starter>(std::move(starter));
+}
+
+}  // namespace ufsm
+
+#endif  // UFSM_COROUTINE_H_
@@ -0,0 +1,511 @@
+#ifndef UFSM_FLAT_H_
+#define UFSM_FLAT_H_
+
+// Flat engine: large populations of table-driven machines.
+//
+// FlatPool<Machine> runs the State/reactions declarations of an ordinary machine without building states. Each
+// instance is just the index of its leaf state (one byte for up to 253 leaves), stored in a contiguous array next to
+// an optional per-instance context, and an event is applied by looking up (leaf, event) -> leaf in a table computed
+// at compile time from the declarative Transition<> reactions, including those inherited from enclosing states.
+//
+// This fits machines that are mostly declarative: states react through Transition<Ev, Dest[, Action]>, where Action,
+// if any, is callable without arguments, and have no OnEntry()/OnExit(). States are never constructed, so their data
+// members (if any) are not used. A (leaf, event) pair resolved to a Reaction<> or Deferral<> is a custom reaction the
+// flat engine cannot run: it is reported back (Result::kNoReaction, or the `custom` list of ApplyBatch()) so that the
+// caller can run that instance on a full StateMachine.
+//
+// ApplyBatch() applies one event per instance to the whole pool with a branch-free table kernel: AVX-512 or AVX2
+// gathers where the CPU has them (checked at run time on x86-64 with GCC or Clang), scalar code otherwise.
+
+#include <ufsm/ufsm.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define UFSM_FLAT_X86_KERNELS 1
+#include <immintrin.h>
+
+#include <cstring>
+#endif
+
+namespace ufsm {
+
+namespace detail {
+
+template <typename T>
+using IsEventType = std::is_base_of<EventBase, T>;
+
+template <typename StateType>
+struct IsLeafState : std::is_void<typename StateType::InnerInitialType> {};
+
+// The leaf entered when entering StateType.
+template <typename StateType, typename = void>
+struct InitialLeaf {
+  using type = StateType;
+};
+
+template <typename StateType>
+struct InitialLeaf<StateType, std::enable_if_t<!std::is_void_v<typename StateType::InnerInitialType>>> {
+  using type = typename InitialLeaf<typename StateType::InnerInitialType>::type;
+};
+
+// How a single reaction entry treats Ev.
+enum class FlatMatchKind { kNone, kTransition, kCustom };
+
+template <typename Ev, typename ReactionType>
+struct FlatMatch {
+  static constexpr FlatMatchKind kind = FlatMatchKind::kNone;
+};
+
+template <typename Ev, typename DestState, typename Action>
+struct FlatMatch<Ev, Transition<Ev, DestState, Action>> {
+  static constexpr FlatMatchKind kind = FlatMatchKind::kTransition;
+  static constexpr bool kHasAction = !std::is_same_v<Action, std::nullptr_t>;
+  using Dest = DestState;
+
+  static void Run() {
+    if constexpr (!std::is_same_v<Action, std::nullptr_t>) {
+      static_assert(std::is_invocable_v<Action&&>,
+                    "FlatPool runs transition actions without a context: Action must be callable with no arguments");
+      Action{}();
+    }
+  }
+};
+
+template <typename Ev>
+struct FlatMatch<Ev, Reaction<Ev>> {
+  static constexpr FlatMatchKind kind = FlatMatchKind::kCustom;
+};
+
+template <typename Ev>
+struct FlatMatch<Ev, Deferral<Ev>> {
+  static constexpr FlatMatchKind kind = FlatMatchKind::kCustom;
+};
+
+template <typename Ev>
+struct FlatMatch<Ev, Deferral<EventBase>> {
+  static constexpr FlatMatchKind kind = FlatMatchKind::kCustom;
+};
+
+// The reaction that handles Ev when the active leaf is the first state of Path (leaf first, then its ancestors):
+// the first matching entry of the innermost state that has one, like StateMachine dispatch.
+template <typename Ev, typename Path>
+struct FlatResolve {
+  static constexpr FlatMatchKind kind = FlatMatchKind::kNone;
+  using Match = void;
+};
+
+template <typename Ev, typename Head, typename... Tail>
+struct FlatResolve<Ev, mp::List<Head, Tail...>> {
+  template <typename ReactionType>
+  using Matches = std::bool_constant<FlatMatch<Ev, ReactionType>::kind != FlatMatchKind::kNone>;
+  using Local = typename mp::FindIf<typename Head::reactions, Matches>::type;
+  using Resolved = std::conditional_t<std::is_void_v<Local>, FlatResolve<Ev, mp::List<Tail...>>, FlatResolve<Ev, void>>;
+
+  static constexpr FlatMatchKind kind = std::is_void_v<Local> ? Resolved::kind : FlatMatch<Ev, Local>::kind;
+  using Match = std::conditional_t<std::is_void_v<Local>, typename Resolved::Match, FlatMatch<Ev, Local>>;
+};
+
+template <typename Ev>
+struct FlatResolve<Ev, void> {
+  static constexpr FlatMatchKind kind = FlatMatchKind::kNone;
+  using Match = void;
+};
+
+// Flags of batch kernel entries.
+inline constexpr std::int32_t kFlatBatchAction = 1 << 16;  // Run the transition action.
+inline constexpr std::int32_t kFlatBatchCustom = 1 << 17;  // Report the instance for a custom reaction.
+
+template <typename Machine>
+struct FlatModel {
+  using Reachable = typename mp::Closure<mp::List<typename Machine::InnerInitialType>, ReachableFrom>::type;
+  using States = typename mp::Filter<Reachable, IsState>::type;
+  using Leaves = typename mp::Filter<States, IsLeafState>::type;
+  using Events = typename mp::Filter<Reachable, IsEventType>::type;
+
+  static constexpr std::size_t kLeafCount = mp::Size<Leaves>::value;
+  static constexpr std::size_t kEventCount = mp::Size<Events>::value;
+
+  using Index = std::conditional_t<(kLeafCount < 0xfe), std::uint8_t, std::uint16_t>;
+  static constexpr Index kUnhandled = std::numeric_limits<Index>::max();
+  static constexpr Index kCustom = kUnhandled - 1;
+
+  template <typename Leaf>
+  using PathOf = typename mp::PushFront<typename mp::Filter<typename Leaf::ContextTypeList, IsState>::type, Leaf>::type;
+
+  template <typename StateType>
+  static constexpr bool kPlain = !HasOnEntryMethod<StateType>::value && !HasOnExitMethod<StateType>::value;
+
+  template <typename... StateTypes>
+  static constexpr bool AllPlain(mp::List<StateTypes...>) {
+    return (kPlain<StateTypes> && ...);
+  }
+  static_assert(AllPlain(States{}), "FlatPool cannot run OnEntry()/OnExit(); use StateMachine for this machine");
+
+  template <typename Leaf, typename Ev>
+  static constexpr Index Next() {
+    using Resolved = FlatResolve<Ev, PathOf<Leaf>>;
+    if constexpr (Resolved::kind == FlatMatchKind::kTransition)
+      return static_cast<Index>(
+          mp::IndexOf<Leaves, typename InitialLeaf<typename Resolved::Match::Dest>::type>::value);
+    else if constexpr (Resolved::kind == FlatMatchKind::kCustom)
+      return kCustom;
+    else
+      return kUnhandled;
+  }
+
+  template <typename Leaf, typename Ev>
+  static constexpr bool HasAction() {
+    using Resolved = FlatResolve<Ev, PathOf<Leaf>>;
+    if constexpr (Resolved::kind == FlatMatchKind::kTransition)
+      return Resolved::Match::kHasAction;
+    else
+      return false;
+  }
+
+  template <typename Leaf, typename Ev>
+  static constexpr auto Action() -> void (*)() {
+    using Resolved = FlatResolve<Ev, PathOf<Leaf>>;
+    if constexpr (Resolved::kind == FlatMatchKind::kTransition) {
+      if constexpr (Resolved::Match::kHasAction) return &Resolved::Match::Run;
+    }
+    return nullptr;
+  }
+
+  // Row-major (leaf, event) tables.
+  struct Tables {
+    std::array<Index, kLeafCount * kEventCount> next{};
+    std::array<void (*)(), kLeafCount * kEventCount> actions{};
+    // Whether `actions` holds an action. Some compilers (GCC with -fno-delete-null-pointer-checks, implied by
+    // -fsanitize=null) do not let constant expressions compare a function pointer with null.
+    std::array<bool, kLeafCount * kEventCount> has_action{};
+  };
+
+  template <typename Leaf, typename... EventTypes>
+  static constexpr void FillRow(Tables& tables, std::size_t row, mp::List<EventTypes...>) {
+    std::size_t column = 0;
+    ((tables.next[row * kEventCount + column] = Next<Leaf, EventTypes>(),
+      tables.actions[row * kEventCount + column] = Action<Leaf, EventTypes>(),
+      tables.has_action[row * kEventCount + column++] = HasAction<Leaf, EventTypes>()),
+     ...);
+  }
+
+  template <typename... LeafTypes>
+  static constexpr Tables MakeTables(mp::List<LeafTypes...>) {
+    Tables tables{};
+    std::size_t row = 0;
+    (FillRow<LeafTypes>(tables, row++, Events{}), ...);
+    return tables;
+  }
+
+  template <typename StateType, typename... LeafTypes>
+  static constexpr std::array<bool, kLeafCount> MakeMembership(mp::List<LeafTypes...>) {
+    return {{mp::Contains<PathOf<LeafTypes>, StateType>::value...}};
+  }
+
+  // Batch kernel table: (leaf, event) row-major with one more column for "no event". The low 16 bits of an entry are
+  // the leaf to store: the next leaf, or the current one if the event is unhandled or needs a custom reaction. The
+  // kFlatBatch* flags mark entries that need more than the store.
+  static constexpr std::size_t kBatchColumns = kEventCount + 1;
+
+  static constexpr std::array<std::int32_t, kLeafCount * kBatchColumns> MakeBatchTable(const Tables& tables) {
+    std::array<std::int32_t, kLeafCount * kBatchColumns> batch{};
+    for (std::size_t leaf = 0; leaf < kLeafCount; ++leaf) {
+      for (std::size_t event = 0; event < kBatchColumns; ++event) {
+        std::int32_t entry = static_cast<std::int32_t>(leaf);
+        if (event < kEventCount) {
+          Index next = tables.next[leaf * kEventCount + event];
+          if (next == kCustom)
+            entry |= kFlatBatchCustom;
+          else if (next != kUnhandled)
+            entry = next | (tables.has_action[leaf * kEventCount + event] ? kFlatBatchAction : 0);
+        }
+        batch[leaf * kBatchColumns + event] = entry;
+      }
+    }
+    return batch;
+  }
+
+  static constexpr Tables kTables = MakeTables(Leaves{});
+  static constexpr std::array<std::int32_t, kLeafCount * kBatchColumns> kBatchTable = MakeBatchTable(kTables);
+  template <typename StateType>
+  static constexpr std::array<bool, kLeafCount> kInState = MakeMembership<StateType>(Leaves{});
+
+  static constexpr Index kInitial =
+      static_cast<Index>(mp::IndexOf<Leaves, typename InitialLeaf<typename Machine::InnerInitialType>::type>::value);
+};
+
+struct FlatNoContext {};
+
+// What the batch kernels see of a FlatModel.
+struct FlatBatchTable {
+  const std::int32_t* entries;  // FlatModel::kBatchTable.
+  void (*const* actions)();     // FlatModel::kTables.actions.
+  std::uint32_t columns;        // FlatModel::kBatchColumns.
+};
+
+// The part of a flagged entry that is not a plain store.
+inline void FlatBatchSlow(const FlatBatchTable& table, std::uint32_t leaf, std::uint32_t event, std::size_t id,
+                          std::vector<std::size_t>& custom) {
+  if (table.entries[leaf * table.columns + event] & kFlatBatchCustom)
+    custom.push_back(id);
+  else
+    table.actions[leaf * (table.columns - 1) + event]();
+}
+
+// The kernels apply `events[i]`, or `event` for every instance if `events` is null, to leaves[begin, count) and
+// return where they stopped; the SIMD ones stop before an incomplete vector.
+template <typename Index>
+std::size_t FlatBatchScalar(const FlatBatchTable& table, Index* leaves, std::size_t begin, std::size_t count,
+                            const std::uint8_t* events, std::uint8_t event, std::vector<std::size_t>& custom) {
+  for (std::size_t i = begin; i < count; ++i) {
+    const std::uint32_t e = events ? events[i] : event;
+    const Index leaf = leaves[i];
+    const std::int32_t entry = table.entries[leaf * table.columns + e];
+    leaves[i] = static_cast<Index>(entry & 0xffff);
+    if (entry > 0xffff) FlatBatchSlow(table, leaf, e, i, custom);
+  }
+  return count;
+}
+
+#if defined(UFSM_FLAT_X86_KERNELS)
+
+// Eight instances per step: widen the leaves and events, gather the entries, narrow the low halves back to bytes.
+__attribute__((target("avx2"))) inline std::size_t FlatBatchAvx2(const FlatBatchTable& table, std::uint8_t* leaves,
+                                                                  std::size_t count, const std::uint8_t* events,
+                                                                  std::uint8_t event,
+                                                                  std::vector<std::size_t>& custom) {
+  const __m256i columns = _mm256_set1_epi32(static_cast<int>(table.columns));
+  const __m256i low = _mm256_set1_epi32(0xffff);
+  const __m256i uniform = _mm256_set1_epi32(event);
+  const int* entries = reinterpret_cast<const int*>(table.entries);
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    std::uint8_t old[8];
+    std::memcpy(old, leaves + i, sizeof(old));
+    const __m256i leaf = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(old)));
+    const __m256i ev =
+        events ? _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(events + i))) : uniform;
+    const __m256i entry =
+        _mm256_i32gather_epi32(entries, _mm256_add_epi32(_mm256_mullo_epi32(leaf, columns), ev), sizeof(int));
+    const __m256i next = _mm256_and_si256(entry, low);
+    __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(next), _mm256_extracti128_si256(next, 1));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(leaves + i), _mm_packus_epi16(packed, packed));
+    for (unsigned slow = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(entry, low))));
+         slow; slow &= slow - 1) {
+      const unsigned lane = static_cast<unsigned>(__builtin_ctz(slow));
+      FlatBatchSlow(table, old[lane], events ? events[i + lane] : event, i + lane, custom);
+    }
+  }
+  return i;
+}
+
+// Sixteen instances per step.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"  // GCC's AVX-512 intrinsics start from undefined vectors.
+#endif
+__attribute__((target("avx512f"))) inline std::size_t FlatBatchAvx512(const FlatBatchTable& table,
+                                                                      std::uint8_t* leaves, std::size_t count,
+                                                                      const std::uint8_t* events, std::uint8_t event,
+                                                                      std::vector<std::size_t>& custom) {
+  const __m512i columns = _mm512_set1_epi32(static_cast<int>(table.columns));
+  const __m512i low = _mm512_set1_epi32(0xffff);
+  const __m512i uniform = _mm512_set1_epi32(event);
+  const int* entries = reinterpret_cast<const int*>(table.entries);
+  std::size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    std::uint8_t old[16];
+    std::memcpy(old, leaves + i, sizeof(old));
+    const __m512i leaf = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(old)));
+    const __m512i ev =
+        events ? _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(events + i))) : uniform;
+    const __m512i entry =
+        _mm512_i32gather_epi32(_mm512_add_epi32(_mm512_mullo_epi32(leaf, columns), ev), entries, sizeof(int));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(leaves + i), _mm512_cvtepi32_epi8(_mm512_and_si512(entry, low)));
+    for (unsigned slow = _mm512_cmpgt_epi32_mask(entry, low); slow; slow &= slow - 1) {
+      const unsigned lane = static_cast<unsigned>(__builtin_ctz(slow));
+      FlatBatchSlow(table, old[lane], events ? events[i + lane] : event, i + lane, custom);
+    }
+  }
+  return i;
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif  // UFSM_FLAT_X86_KERNELS
+
+}  // namespace detail
+
+// Instruction set used by FlatPool::ApplyBatch().
+enum class BatchIsa { kAuto, kScalar, kAvx2, kAvx512 };
+
+// A population of instances of Machine run by the flat engine, with an optional Context per instance.
+template <class Machine, class Context = void>
+class FlatPool {
+  using Model = detail::FlatModel<Machine>;
+  using ContextColumn = std::conditional_t<std::is_void_v<Context>, detail::FlatNoContext, std::vector<Context>>;
+
+ public:
+  using StateIndex = typename Model::Index;
+  using Id = std::size_t;
+
+  // Leaf states and event types known to the table, in a stable order; StateIndex values index the former.
+  using LeafStates = typename Model::Leaves;
+  using EventTypes = typename Model::Events;
+  static constexpr std::size_t kLeafCount = Model::kLeafCount;
+  static constexpr std::size_t kEventCount = Model::kEventCount;
+
+  // Event of a batch, as its index in EventTypes; kNoEvent leaves the instance alone.
+  using EventIndex = std::uint8_t;
+  static constexpr EventIndex kNoEvent = static_cast<EventIndex>(kEventCount);
+
+  // Add an instance in the machine's initial leaf state.
+  template <typename... Args>
+  Id Add(Args&&... context_args) {
+    leaves_.push_back(Model::kInitial);
+    if constexpr (!std::is_void_v<Context>) contexts_.emplace_back(std::forward<Args>(context_args)...);
+    return leaves_.size() - 1;
+  }
+
+  void Reserve(std::size_t count) {
+    leaves_.reserve(count);
+    if constexpr (!std::is_void_v<Context>) contexts_.reserve(count);
+  }
+
+  std::size_t Size() const noexcept { return leaves_.size(); }
+
+  // Remove every instance.
+  void Clear() noexcept {
+    leaves_.clear();
+    if constexpr (!std::is_void_v<Context>) contexts_.clear();
+  }
+
+  // Apply an event to one instance. Returns kConsumed if it took a transition, kForwardEvent if no state of its
+  // active path reacts to the event, kNoReaction (leaving the instance alone) if the reaction is a custom one.
+  template <class Ev>
+  Result ProcessEvent(Id id, const Ev&) {
+    constexpr std::size_t event = mp::IndexOf<EventTypes, Ev>::value;
+    if constexpr (event == kEventCount) {
+      return Result::kForwardEvent;
+    } else {
+      StateIndex& leaf = leaves_[id];
+      StateIndex next = Model::kTables.next[leaf * kEventCount + event];
+      if (next == Model::kUnhandled) return Result::kForwardEvent;
+      if (next == Model::kCustom) return Result::kNoReaction;
+      if (auto action = Model::kTables.actions[leaf * kEventCount + event]) action();
+      leaf = next;
+      return Result::kConsumed;
+    }
+  }
+
+  template <class Ev>
+  static constexpr EventIndex EventIndexOf() {
+    static_assert(mp::Contains<EventTypes, Ev>::value, "Ev is not an event of this machine");
+    return static_cast<EventIndex>(mp::IndexOf<EventTypes, Ev>::value);
+  }
+
+  // Apply events[id] to every instance `id` (events holds Size() entries), as ProcessEvent() would, instance after
+  // instance. Instances whose event needs a custom reaction are left alone and their ids appended to `custom`, in
+  // increasing order.
+  void ApplyBatch(const EventIndex* events, std::vector<Id>& custom, BatchIsa isa = BatchIsa::kAuto) {
+    RunBatch(events, kNoEvent, custom, isa);
+  }
+
+  // Apply one event to every instance.
+  template <class Ev, typename = std::enable_if_t<detail::IsEventType<Ev>::value>>
+  void ApplyBatch(const Ev&, std::vector<Id>& custom, BatchIsa isa = BatchIsa::kAuto) {
+    RunBatch(nullptr, EventIndexOf<Ev>(), custom, isa);
+  }
+
+  // Whether ApplyBatch() can use `isa` on this CPU and for this pool: the SIMD kernels need one-byte leaf indices.
+  static bool Supports(BatchIsa isa) {
+    switch (isa) {
+      case BatchIsa::kAuto:
+      case BatchIsa::kScalar:
+        return true;
+#if defined(UFSM_FLAT_X86_KERNELS)
+      case BatchIsa::kAvx2:
+        return sizeof(StateIndex) == 1 && __builtin_cpu_supports("avx2");
+      case BatchIsa::kAvx512:
+        return sizeof(StateIndex) == 1 && __builtin_cpu_supports("avx512f");
+#endif
+      default:
+        return false;
+    }
+  }
+
+  // Apply an event to every instance.
+  template <class Ev>
+  void Broadcast(const Ev& event) {
+    for (Id id = 0; id < leaves_.size(); ++id) ProcessEvent(id, event);
+  }
+
+  // Check if an instance is in a state, leaf or composite.
+  template <class StateT>
+  bool IsInState(Id id) const {
+    static_assert(std::is_base_of_v<detail::StateBase, StateT>, "StateT must be a state");
+    return Model::template kInState<StateT>[leaves_[id]];
+  }
+
+  // Index of an instance's leaf state in LeafStates.
+  StateIndex Leaf(Id id) const noexcept { return leaves_[id]; }
+
+  // Index of a leaf state type in LeafStates.
+  template <class StateT>
+  static constexpr StateIndex IndexOf() {
+    static_assert(mp::Contains<LeafStates, StateT>::value, "StateT is not a reachable leaf state");
+    return static_cast<StateIndex>(mp::IndexOf<LeafStates, StateT>::value);
+  }
+
+  template <typename C = Context, typename = std::enable_if_t<!std::is_void_v<C>>>
+  C& ContextOf(Id id) {
+    return contexts_[id];
+  }
+  template <typename C = Context, typename = std::enable_if_t<!std::is_void_v<C>>>
+  const C& ContextOf(Id id) const {
+    return contexts_[id];
+  }
+
+  // Raw leaf indices, one per instance.
+  StateIndex* Leaves() noexcept { return leaves_.data(); }
+  const StateIndex* Leaves() const noexcept { return leaves_.data(); }
+
+ private:
+  static_assert(kEventCount < 0xff, "Too many event types for FlatPool");
+
+  void RunBatch(const EventIndex* events, EventIndex event, std::vector<Id>& custom, BatchIsa isa) {
+    static const detail::FlatBatchTable table{Model::kBatchTable.data(), Model::kTables.actions.data(),
+                                              static_cast<std::uint32_t>(Model::kBatchColumns)};
+    if (isa == BatchIsa::kAuto) {
+      static const BatchIsa best = Supports(BatchIsa::kAvx512) ? BatchIsa::kAvx512
+                                   : Supports(BatchIsa::kAvx2) ? BatchIsa::kAvx2
+                                                               : BatchIsa::kScalar;
+      isa = best;
+    }
+    UFSM_ASSERT(Supports(isa));
+    std::size_t done = 0;
+#if defined(UFSM_FLAT_X86_KERNELS)
+    if constexpr (sizeof(StateIndex) == 1) {
+      if (isa == BatchIsa::kAvx512)
+        done = detail::FlatBatchAvx512(table, leaves_.data(), leaves_.size(), events, event, custom);
+      else if (isa == BatchIsa::kAvx2)
+        done = detail::FlatBatchAvx2(table, leaves_.data(), leaves_.size(), events, event, custom);
+    }
+#endif
+    detail::FlatBatchScalar(table, leaves_.data(), done, leaves_.size(), events, event, custom);
+  }
+
+  std::vector<StateIndex> leaves_;
+  ContextColumn contexts_;
+};
+
+}  // namespace ufsm
+
+#endif  // UFSM_FLAT_H_
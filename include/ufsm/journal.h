@@ -0,0 +1,428 @@
+#ifndef UFSM_JOURNAL_H_
+#define UFSM_JOURNAL_H_
+
+// Event journal: an append-only record of the events a machine processed, written to memory-mapped segment files
+// and replayed to rebuild the machine after a crash or for an audit (POSIX only).
+//
+// JournalWriter::Process() appends an event, then processes it: the journal is written ahead of the machine. Records
+// are copied into a shared mapping of the current segment, so appending makes no system call; the kernel writes the
+// pages back on its own schedule and Sync() forces them to disk. A full segment is trimmed to its records and the
+// next one is created. With JournalOptions::transitions, every processed event that changed the leaf state is
+// followed by a transition record naming both leaves by JournalStateId(), for audits; replay does not need them.
+//
+// Events are identified by their wire ID (see ufsm/wire.h) and encoded by their own serializer,
+//   std::size_t Encode(unsigned char* out, std::size_t capacity) const;
+// which returns the size of the encoding and writes it to `out` only if it fits in `capacity`, like snprintf().
+// Events without data members need none. JournalReader::Replay() decodes the records through a WireRegistry and
+// hands them to StateMachine::ReplayEvent(), which skips the machine's observer hooks.
+//
+// Files are `<prefix>.<sequence>`, with a six-digit sequence number, in native byte order:
+//   segment header | records, each: kind | wire ID | length | encoding, padded to 4 bytes
+// The kind of a record is written last, so a record cut short by a crash reads as the end of its segment.
+// A writer or reader is not thread safe. Failures are reported as false with errno set, EINVAL for a malformed file.
+
+#include <ufsm/ufsm.h>
+#include <ufsm/wire.h>
+
+#if !defined(__unix__) && !defined(__APPLE__)
+#error "ufsm/journal.h requires POSIX (mmap)"
+#endif
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ufsm {
+
+enum class JournalRecordKind : std::uint32_t {
+  kEvent = 1,       // An event processed by the machine.
+  kTransition = 2,  // The leaf state change caused by the event before it.
+};
+
+// Identity of a state type in transition records, 0 standing for a terminated machine. A state that declares
+// `static constexpr ufsm::WireId journal_id` (nonzero) is named by it, stable like a wire ID. Otherwise the wire hash
+// of its type name is used, which depends on the compiler, namespace and build: records written by another build
+// only match it if the names came out the same.
+template <class StateT>
+WireId JournalStateId() {
+  if constexpr (detail::kStateJournalId<StateT> != 0) {
+    return detail::kStateJournalId<StateT>;
+  } else {
+    return HashWireName(detail::PrettyTypeName<StateT>());
+  }
+}
+
+struct JournalRecord {
+  JournalRecordKind kind;
+  WireId id;                // Wire ID of the event, or of the event that caused the transition.
+  std::string_view bytes;   // Encoding of the event (kEvent).
+  WireId from = 0;          // Leaf states before and after (kTransition).
+  WireId to = 0;
+  std::uint32_t segment = 0;
+};
+
+namespace detail {
+
+inline constexpr std::uint32_t kJournalMagic = 0x4c4e4a55u;  // "UJNL"
+inline constexpr std::uint32_t kJournalVersion = 1;
+
+struct JournalSegmentHeader {
+  std::uint32_t magic;
+  std::uint32_t version;
+  std::uint64_t sequence;
+};
+
+struct JournalRecordHeader {
+  std::uint32_t kind;  // Zero past the last record.
+  std::uint32_t id;
+  std::uint32_t length;
+};
+
+template <typename Ev, typename = void>
+inline constexpr bool kHasJournalEncode = false;
+
+template <typename Ev>
+inline constexpr bool kHasJournalEncode<
+    Ev, std::enable_if_t<std::is_convertible_v<
+            decltype(std::declval<const Ev&>().Encode(std::declval<unsigned char*>(), std::size_t{})), std::size_t>>> =
+    true;
+
+inline std::size_t JournalPadded(std::size_t size) noexcept { return (size + 3) & ~std::size_t{3}; }
+
+inline std::string JournalSegmentPath(const std::string& prefix, std::uint32_t sequence) {
+  char suffix[16];
+  std::snprintf(suffix, sizeof(suffix), ".%06lu", static_cast<unsigned long>(sequence));
+  return prefix + suffix;
+}
+
+// Sequence numbers of the segments of a journal, in order.
+inline bool ListJournalSegments(const std::string& prefix, std::vector<std::uint32_t>& sequences) {
+  sequences.clear();
+  const auto slash = prefix.rfind('/');
+  const std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : prefix.substr(0, slash);
+  const std::string base = slash == std::string::npos ? prefix : prefix.substr(slash + 1);
+  DIR* handle = ::opendir(dir.c_str());
+  if (!handle) return false;
+  while (const dirent* entry = ::readdir(handle)) {
+    const std::string_view name(entry->d_name);
+    if (name.size() < base.size() + 2 || name.compare(0, base.size(), base) != 0 || name[base.size()] != '.')
+      continue;
+    const std::string_view digits = name.substr(base.size() + 1);
+    if (digits.size() > 9 || !std::all_of(digits.begin(), digits.end(), [](char c) { return c >= '0' && c <= '9'; }))
+      continue;
+    sequences.push_back(static_cast<std::uint32_t>(std::strtoul(std::string(digits).c_str(), nullptr, 10)));
+  }
+  ::closedir(handle);
+  std::sort(sequences.begin(), sequences.end());
+  return true;
+}
+
+inline bool JournalCloseFailing(int fd) {
+  const int error = errno;
+  ::close(fd);
+  errno = error;
+  return false;
+}
+
+}  // namespace detail
+
+struct JournalOptions {
+  std::size_t segment_bytes = std::size_t{64} << 20;  // Size of a segment file while it is written.
+  bool transitions = false;                            // Also record leaf state changes.
+};
+
+class JournalWriter {
+ public:
+  JournalWriter() = default;
+  JournalWriter(const JournalWriter&) = delete;
+  JournalWriter& operator=(const JournalWriter&) = delete;
+  ~JournalWriter() { Close(); }
+
+  // Start a new segment after the existing ones of the journal `prefix`, if any.
+  bool Open(std::string prefix, JournalOptions options = {}) {
+    Close();
+    if (options.segment_bytes < sizeof(detail::JournalSegmentHeader) + sizeof(detail::JournalRecordHeader)) {
+      errno = EINVAL;
+      return false;
+    }
+    std::vector<std::uint32_t> sequences;
+    if (!detail::ListJournalSegments(prefix, sequences)) return false;
+    prefix_ = std::move(prefix);
+    options_ = options;
+    next_ = sequences.empty() ? 0 : sequences.back() + 1;
+    return OpenSegment();
+  }
+
+  // Trim the current segment to its records and unmap it. The records stay in the page cache until written back.
+  void Close() noexcept {
+    if (!base_) return;
+    const auto used = static_cast<off_t>(cursor_ - base_);
+    ::munmap(base_, static_cast<std::size_t>(end_ - base_));
+    [[maybe_unused]] int trimmed = ::ftruncate(fd_, used);
+    ::close(fd_);
+    base_ = cursor_ = end_ = nullptr;
+    fd_ = -1;
+  }
+
+  bool is_open() const noexcept { return base_ != nullptr; }
+  std::uint64_t records() const noexcept { return records_; }
+  std::uint64_t lost_transitions() const noexcept { return lost_transitions_; }  // See Process().
+  std::uint32_t segment() const noexcept { return next_ - 1; }  // Sequence number of the current segment.
+
+  // Append the event, then process it with `machine`, storing the outcome in `result` if given. Returns false, with
+  // errno set, when the event could not be appended; it is then not processed. A transition record that cannot be
+  // written once the event has been processed does not fail the call and is counted in lost_transitions() instead.
+  // Call it from outside the machine's reactions.
+  template <class Machine, class Ev>
+  bool Process(Machine& machine, const Ev& event, Result* result = nullptr) {
+    if (!Append(event)) return false;
+    const void* from = machine.LeafTypeId();
+    const Result r = machine.ProcessEvent(event);
+    if (result) *result = r;
+    const void* to = machine.LeafTypeId();
+    if (options_.transitions && to != from && !AppendTransition(Ev::wire_id, LeafId(from), LeafId(to)))
+      ++lost_transitions_;
+    return true;
+  }
+
+  // Append an event record without processing the event.
+  template <class Ev>
+  bool Append(const Ev& event) {
+    static_assert(detail::kHasWireId<Ev>, "A journaled event needs `static constexpr ufsm::WireId wire_id`");
+    static_assert(detail::kHasJournalEncode<Ev> || sizeof(Ev) == sizeof(Event<Ev>),
+                  "A journaled event with data needs `std::size_t Encode(unsigned char*, std::size_t) const`");
+    return Write(JournalRecordKind::kEvent, Ev::wire_id, [&](unsigned char* out, std::size_t capacity) {
+      if constexpr (detail::kHasJournalEncode<Ev>)
+        return static_cast<std::size_t>(event.Encode(out, capacity));
+      else
+        return std::size_t{0};
+    });
+  }
+
+  // Append a transition record: the event `id` moved the machine from leaf state `from` to `to` (JournalStateId()).
+  bool AppendTransition(WireId id, WireId from, WireId to) {
+    return Write(JournalRecordKind::kTransition, id, [&](unsigned char* out, std::size_t capacity) {
+      if (capacity >= 2 * sizeof(WireId)) {
+        std::memcpy(out, &from, sizeof(from));
+        std::memcpy(out + sizeof(from), &to, sizeof(to));
+      }
+      return 2 * sizeof(WireId);
+    });
+  }
+
+  // Write the current segment's records to disk and wait for it.
+  bool Sync() {
+    if (!base_) {
+      errno = EBADF;
+      return false;
+    }
+    return ::msync(base_, static_cast<std::size_t>(cursor_ - base_), MS_SYNC) == 0;
+  }
+
+ private:
+  // Encode a record at the cursor with `encode(out, capacity)`, moving to a new segment if it does not fit.
+  // Fails with EMSGSIZE for a record larger than an empty segment.
+  template <class Encoder>
+  bool Write(JournalRecordKind kind, WireId id, Encoder&& encode) {
+    if (!base_) {
+      errno = EBADF;
+      return false;
+    }
+    for (bool fresh = cursor_ == base_ + sizeof(detail::JournalSegmentHeader);; fresh = true) {
+      const auto room = static_cast<std::size_t>(end_ - cursor_);
+      if (room >= sizeof(detail::JournalRecordHeader)) {
+        unsigned char* out = cursor_ + sizeof(detail::JournalRecordHeader);
+        const std::size_t capacity = std::min<std::size_t>(room - sizeof(detail::JournalRecordHeader), UINT32_MAX);
+        const std::size_t length = encode(out, capacity);
+        if (length <= capacity) {
+          Commit(kind, id, static_cast<std::uint32_t>(length));
+          return true;
+        }
+      }
+      if (fresh) {
+        errno = EMSGSIZE;
+        return false;
+      }
+      Close();
+      if (!OpenSegment()) return false;
+    }
+  }
+
+  void Commit(JournalRecordKind kind, WireId id, std::uint32_t length) noexcept {
+    std::memcpy(cursor_ + offsetof(detail::JournalRecordHeader, id), &id, sizeof(id));
+    std::memcpy(cursor_ + offsetof(detail::JournalRecordHeader, length), &length, sizeof(length));
+    // The kind publishes the record: a reader of a crashed writer's segment never sees it before the rest.
+    std::atomic_signal_fence(std::memory_order_release);
+    const auto value = static_cast<std::uint32_t>(kind);
+    std::memcpy(cursor_ + offsetof(detail::JournalRecordHeader, kind), &value, sizeof(value));
+    cursor_ += std::min(detail::JournalPadded(sizeof(detail::JournalRecordHeader) + length),
+                        static_cast<std::size_t>(end_ - cursor_));
+    ++records_;
+  }
+
+  bool OpenSegment() {
+    const std::string path = detail::JournalSegmentPath(prefix_, next_);
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    const std::size_t size = options_.segment_bytes;
+    void* map = MAP_FAILED;
+    if (::ftruncate(fd, static_cast<off_t>(size)) == 0)
+      map = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+      ::unlink(path.c_str());
+      return detail::JournalCloseFailing(fd);
+    }
+    fd_ = fd;
+    base_ = static_cast<unsigned char*>(map);
+    end_ = base_ + size;
+    const detail::JournalSegmentHeader header{detail::kJournalMagic, detail::kJournalVersion, next_++};
+    std::memcpy(base_, &header, sizeof(header));
+    cursor_ = base_ + sizeof(header);
+    return true;
+  }
+
+  // JournalStateId() of a leaf state type, remembered for the next transition, which starts from it.
+  WireId LeafId(const void* leaf_type_id) {
+    if (!leaf_type_id) return 0;
+    if (leaf_type_id != last_leaf_) {
+      last_leaf_ = leaf_type_id;
+      const auto* descriptor = static_cast<const detail::StateDescriptor*>(leaf_type_id);
+      last_leaf_id_ = descriptor->journal_id ? descriptor->journal_id : HashWireName(descriptor->name());
+    }
+    return last_leaf_id_;
+  }
+
+  std::string prefix_;
+  JournalOptions options_;
+  int fd_ = -1;
+  unsigned char* base_ = nullptr;
+  unsigned char* cursor_ = nullptr;
+  unsigned char* end_ = nullptr;
+  std::uint32_t next_ = 0;  // Sequence number of the next segment.
+  std::uint64_t records_ = 0;
+  std::uint64_t lost_transitions_ = 0;
+  const void* last_leaf_ = nullptr;
+  WireId last_leaf_id_ = 0;
+};
+
+class JournalReader {
+ public:
+  // Find the segments of the journal `prefix`. Fails with ENOENT if it has none.
+  bool Open(std::string prefix) {
+    if (!detail::ListJournalSegments(prefix, sequences_)) return false;
+    prefix_ = std::move(prefix);
+    if (sequences_.empty()) {
+      errno = ENOENT;
+      return false;
+    }
+    return true;
+  }
+
+  const std::vector<std::uint32_t>& segments() const noexcept { return sequences_; }
+
+  // Pass every record, in order, to `fn(const ufsm::JournalRecord&)`, which returns false to stop; ForEach() then
+  // returns false as well, with the errno left by `fn`. Each segment is mapped while its records are read.
+  template <class Fn>
+  bool ForEach(Fn&& fn) {
+    for (std::uint32_t sequence : sequences_) {
+      const std::string path = detail::JournalSegmentPath(prefix_, sequence);
+      int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0) return false;
+      struct stat st {};
+      if (::fstat(fd, &st) != 0) return detail::JournalCloseFailing(fd);
+      const auto size = static_cast<std::size_t>(st.st_size);
+      // A segment created by a writer that crashed before writing its header holds no records.
+      if (size < sizeof(detail::JournalSegmentHeader)) {
+        ::close(fd);
+        continue;
+      }
+      void* map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map == MAP_FAILED) return detail::JournalCloseFailing(fd);
+      ::close(fd);
+#if defined(MADV_SEQUENTIAL)
+      ::madvise(map, size, MADV_SEQUENTIAL);
+#endif
+      struct Unmap {
+        void* map;
+        std::size_t size;
+        ~Unmap() { ::munmap(map, size); }
+      } unmap{map, size};
+      if (!ReadSegment(static_cast<const unsigned char*>(map), size, sequence, fn)) return false;
+    }
+    return true;
+  }
+
+  // Rebuild `machine` by replaying every event record through `registry` into StateMachine::ReplayEvent(), counting
+  // the events replayed in `replayed` if given. Transition records are skipped. Fails like WireRegistry::Decode().
+  template <class Machine>
+  bool Replay(Machine& machine, WireRegistry& registry, std::size_t* replayed = nullptr) {
+    std::size_t count = 0;
+    const bool ok = ForEach([&](const JournalRecord& record) {
+      if (record.kind != JournalRecordKind::kEvent) return true;
+      if (!registry.Decode(record.id, record.bytes,
+                           [&](const detail::EventBase& event) { machine.ReplayEvent(event); }))
+        return false;
+      ++count;
+      return true;
+    });
+    if (replayed) *replayed = count;
+    return ok;
+  }
+
+ private:
+  template <class Fn>
+  static bool ReadSegment(const unsigned char* data, std::size_t size, std::uint32_t sequence, Fn& fn) {
+    detail::JournalSegmentHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    if (header.magic == 0) return true;
+    if (header.magic != detail::kJournalMagic || header.version != detail::kJournalVersion ||
+        header.sequence != sequence) {
+      errno = EINVAL;
+      return false;
+    }
+    std::size_t at = sizeof(header);
+    while (size - at >= sizeof(detail::JournalRecordHeader)) {
+      detail::JournalRecordHeader h;
+      std::memcpy(&h, data + at, sizeof(h));
+      if (h.kind == 0) break;
+      const std::size_t body = at + sizeof(h);
+      const auto kind = static_cast<JournalRecordKind>(h.kind);
+      if ((kind != JournalRecordKind::kEvent && kind != JournalRecordKind::kTransition) || h.length > size - body ||
+          (kind == JournalRecordKind::kTransition && h.length != 2 * sizeof(WireId))) {
+        errno = EINVAL;
+        return false;
+      }
+      JournalRecord record{kind, h.id, {}, 0, 0, sequence};
+      if (kind == JournalRecordKind::kEvent) {
+        record.bytes = std::string_view(reinterpret_cast<const char*>(data + body), h.length);
+      } else {
+        std::memcpy(&record.from, data + body, sizeof(WireId));
+        std::memcpy(&record.to, data + body + sizeof(WireId), sizeof(WireId));
+      }
+      if (!fn(static_cast<const JournalRecord&>(record))) return false;
+      at = std::min(size, at + detail::JournalPadded(sizeof(h) + h.length));
+    }
+    return true;
+  }
+
+  std::string prefix_;
+  std::vector<std::uint32_t> sequences_;
+};
+
+}  // namespace ufsm
+
+#endif  // UFSM_JOURNAL_H_
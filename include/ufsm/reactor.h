@@ -0,0 +1,282 @@
+#ifndef UFSM_REACTOR_H_
+#define UFSM_REACTOR_H_
+
+// epoll reactor driving state machines from file descriptors (Linux only).
+//
+// Machines register descriptors, timers and notifiers with a Reactor; readiness comes back as ufsm events
+// (IoReady, TimerExpired, Notified). RunOnce() waits once, posts every ready event of the wakeup into its machine's
+// posted queue, then drains each touched machine once through StateMachine::Run(). A machine with several ready
+// descriptors therefore sees them in one run-to-completion loop instead of one ProcessEvent() entry each.
+//
+// The reactor is single threaded: all calls except Notify() must come from the thread running RunOnce(). Failures
+// of the underlying system calls are reported as false or -1, with errno set.
+
+#include <ufsm/ufsm.h>
+
+#if !defined(__linux__)
+#error "ufsm/reactor.h requires Linux (epoll, timerfd, eventfd)"
+#endif
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace ufsm {
+
+// A watched descriptor is ready; `events` holds the EPOLL* flags reported for it.
+struct IoReady : Event<IoReady> {
+  IoReady(int fd, std::uint32_t events) : fd(fd), events(events) {}
+  int fd;
+  std::uint32_t events;
+};
+
+// A timer fired `expirations` times since it was last delivered.
+struct TimerExpired : Event<TimerExpired> {
+  TimerExpired(int fd, std::uint64_t expirations) : fd(fd), expirations(expirations) {}
+  int fd;
+  std::uint64_t expirations;
+};
+
+// A notifier was signalled; `count` sums the values passed to Reactor::Notify() since the last delivery.
+struct Notified : Event<Notified> {
+  Notified(int fd, std::uint64_t count) : fd(fd), count(count) {}
+  int fd;
+  std::uint64_t count;
+};
+
+class Reactor {
+ public:
+  // Maximum number of ready descriptors collected by one epoll_wait().
+  static constexpr int kMaxEventsPerWakeup = 256;
+
+  Reactor() : epoll_fd_(::epoll_create1(EPOLL_CLOEXEC)) {}
+  Reactor(const Reactor&) = delete;
+  Reactor& operator=(const Reactor&) = delete;
+  ~Reactor() {
+    for (auto& entry : registrations_)
+      if (entry.second->owned) ::close(entry.first);
+    if (epoll_fd_ >= 0) ::close(epoll_fd_);
+  }
+
+  // False if the epoll instance could not be created.
+  bool Valid() const noexcept { return epoll_fd_ >= 0; }
+
+  // Deliver readiness of `fd` (EPOLLIN, EPOLLOUT, ...) to `machine` as IoReady. The descriptor stays owned by the
+  // caller and is level triggered unless EPOLLET is given.
+  template <class Machine>
+  bool Watch(Machine& machine, int fd, std::uint32_t events) {
+    return Register(TargetFor(machine), fd, events, Kind::kIo, false);
+  }
+
+  // Change the readiness flags of a watched descriptor.
+  bool Modify(int fd, std::uint32_t events) {
+    auto it = registrations_.find(fd);
+    if (it == registrations_.end()) return Fail(ENOENT);
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.ptr = it->second.get();
+    return ::epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev) == 0;
+  }
+
+  // Start a timer delivering TimerExpired to `machine` after `initial`, then every `interval` if non-zero.
+  // Returns the timer's descriptor, owned by the reactor, or -1.
+  template <class Machine>
+  int AddTimer(Machine& machine, std::chrono::nanoseconds initial,
+               std::chrono::nanoseconds interval = std::chrono::nanoseconds::zero()) {
+    int fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) return -1;
+    itimerspec spec{ToTimespec(interval), ToTimespec(initial)};
+    // A zero it_value disarms the timer: fire as soon as possible instead.
+    if (initial <= std::chrono::nanoseconds::zero()) spec.it_value.tv_nsec = 1;
+    if (::timerfd_settime(fd, 0, &spec, nullptr) != 0 ||
+        !Register(TargetFor(machine), fd, EPOLLIN, Kind::kTimer, true)) {
+      CloseKeepingErrno(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  // Create a notifier delivering Notified to `machine`. Other threads wake it with Notify(). Returns its
+  // descriptor, owned by the reactor, or -1.
+  template <class Machine>
+  int AddNotifier(Machine& machine) {
+    int fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) return -1;
+    if (!Register(TargetFor(machine), fd, EPOLLIN, Kind::kNotifier, true)) {
+      CloseKeepingErrno(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  // Signal a notifier. Safe to call from any thread.
+  static bool Notify(int notifier_fd, std::uint64_t count = 1) {
+    return ::write(notifier_fd, &count, sizeof(count)) == static_cast<ssize_t>(sizeof(count));
+  }
+
+  // Stop delivering events for `fd`, closing it if the reactor created it.
+  bool Remove(int fd) {
+    auto it = registrations_.find(fd);
+    if (it == registrations_.end()) return Fail(ENOENT);
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    if (it->second->owned) ::close(fd);
+    it->second->target = nullptr;  // Events of the current wakeup still point at it.
+    retired_registrations_.push_back(std::move(it->second));
+    registrations_.erase(it);
+    return true;
+  }
+
+  // Remove every registration of `machine`, e.g. before destroying it.
+  template <class Machine>
+  void Forget(Machine& machine) {
+    auto it = targets_.find(static_cast<void*>(&machine));
+    if (it == targets_.end()) return;
+    std::vector<int> fds;
+    for (auto& entry : registrations_)
+      if (entry.second->target == it->second.get()) fds.push_back(entry.first);
+    for (int fd : fds) Remove(fd);
+    it->second->machine = nullptr;  // It may be waiting to be drained in the current wakeup.
+    retired_targets_.push_back(std::move(it->second));
+    targets_.erase(it);
+  }
+
+  // Wait up to `timeout_ms` (-1: forever) for readiness, deliver it and drain the machines that received events.
+  // Returns the number of events delivered, or -1 if epoll_wait() failed.
+  int RunOnce(int timeout_ms = -1) {
+    epoll_event ready[kMaxEventsPerWakeup];
+    int n = ::epoll_wait(epoll_fd_, ready, kMaxEventsPerWakeup, timeout_ms);
+    if (n < 0) return errno == EINTR ? 0 : -1;
+
+    int delivered = 0;
+    for (int i = 0; i < n; ++i) {
+      auto* registration = static_cast<Registration*>(ready[i].data.ptr);
+      Target* target = registration->target;
+      if (!target || !target->machine) continue;
+      if (Deliver(*registration, ready[i].events)) ++delivered;
+      if (!target->dirty) {
+        target->dirty = true;
+        dirty_.push_back(target);
+      }
+    }
+
+    // One run-to-completion loop per machine for the whole batch.
+    for (std::size_t i = 0; i < dirty_.size(); ++i) {
+      Target* target = dirty_[i];
+      target->dirty = false;
+      if (target->machine) target->drain(target->machine);
+    }
+    dirty_.clear();
+    retired_registrations_.clear();
+    retired_targets_.clear();
+    return delivered;
+  }
+
+ private:
+  enum class Kind : std::uint8_t { kIo, kTimer, kNotifier };
+
+  // Type-erased machine, shared by all of its registrations.
+  struct Target {
+    void* machine;
+    void (*post)(void* machine, Kind kind, int fd, std::uint64_t value);
+    void (*drain)(void* machine);
+    bool dirty = false;
+  };
+
+  struct Registration {
+    Target* target;
+    int fd;
+    Kind kind;
+    bool owned;
+  };
+
+  template <class Machine>
+  static void PostTo(void* machine, Kind kind, int fd, std::uint64_t value) {
+    auto& target = *static_cast<Machine*>(machine);
+    switch (kind) {
+      case Kind::kIo:
+        target.PostEvent(IoReady(fd, static_cast<std::uint32_t>(value)));
+        break;
+      case Kind::kTimer:
+        target.PostEvent(TimerExpired(fd, value));
+        break;
+      case Kind::kNotifier:
+        target.PostEvent(Notified(fd, value));
+        break;
+    }
+  }
+
+  template <class Machine>
+  static void DrainMachine(void* machine) {
+    static_cast<Machine*>(machine)->Run([] {});
+  }
+
+  template <class Machine>
+  Target* TargetFor(Machine& machine) {
+    auto& target = targets_[static_cast<void*>(&machine)];
+    if (!target) {
+      target.reset(new Target{&machine, &PostTo<Machine>, &DrainMachine<Machine>});
+      dirty_.reserve(targets_.size());
+    }
+    return target.get();
+  }
+
+  bool Register(Target* target, int fd, std::uint32_t events, Kind kind, bool owned) {
+    if (registrations_.count(fd)) return Fail(EEXIST);
+    std::unique_ptr<Registration> registration(new Registration{target, fd, kind, owned});
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.ptr = registration.get();
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) != 0) return false;
+    registrations_.emplace(fd, std::move(registration));
+    return true;
+  }
+
+  // Post the event for one ready registration. Returns false if there was nothing to deliver.
+  static bool Deliver(const Registration& registration, std::uint32_t events) {
+    const Target& target = *registration.target;
+    std::uint64_t value = events;
+    // Timers and notifiers are consumed here, so that they do not stay ready.
+    if (registration.kind != Kind::kIo &&
+        ::read(registration.fd, &value, sizeof(value)) != static_cast<ssize_t>(sizeof(value)))
+      return false;
+    target.post(target.machine, registration.kind, registration.fd, value);
+    return true;
+  }
+
+  static timespec ToTimespec(std::chrono::nanoseconds duration) {
+    if (duration < std::chrono::nanoseconds::zero()) duration = std::chrono::nanoseconds::zero();
+    auto seconds = std::chrono::duration_cast<std::chrono::seconds>(duration);
+    return timespec{static_cast<time_t>(seconds.count()), static_cast<long>((duration - seconds).count())};
+  }
+
+  static bool Fail(int error) {
+    errno = error;
+    return false;
+  }
+
+  static void CloseKeepingErrno(int fd) {
+    int error = errno;
+    ::close(fd);
+    errno = error;
+  }
+
+  int epoll_fd_;
+  std::unordered_map<void*, std::unique_ptr<Target>> targets_;
+  std::unordered_map<int, std::unique_ptr<Registration>> registrations_;
+  std::vector<Target*> dirty_;
+  // Removed while a wakeup is in progress; freed when it ends.
+  std::vector<std::unique_ptr<Registration>> retired_registrations_;
+  std::vector<std::unique_ptr<Target>> retired_targets_;
+};
+
+}  // namespace ufsm
+
+#endif  // UFSM_REACTOR_H_
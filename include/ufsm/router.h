@@ -0,0 +1,321 @@
+#ifndef UFSM_ROUTER_H_
+#define UFSM_ROUTER_H_
+
+// Keyed session router: events are routed by key to one of N shards, each owning its machines outright.
+//
+// Every shard is served by one thread and keeps its own key -> machine map, so machines are processed without
+// locks and without a shared hash map. Producers (I/O threads) hand events over through one single-producer,
+// single-consumer ring per (producer, shard) pair. A machine is created on the first event for its key, constructed
+// from the key if it can be and initiated, and evicted as soon as it is Terminated() (see State::TerminateMachine()).
+// A key always lands on the same shard, so the events one producer routes for a key are processed in order.
+// Events are copied straight into their ring slot, which has room for InlineEventSize bytes; only larger events are
+// cloned to the heap. A full ring is detected before anything is copied.
+// A shard thread that finds its rings empty for a while parks until an event is routed to it, so idle shards do not
+// keep a core busy.
+
+#include <ufsm/ufsm.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace ufsm {
+
+inline constexpr std::size_t kCacheLineSize = 64;
+
+// Bounded lock-free ring between exactly one producer thread and one consumer thread. The indices live on separate
+// cache lines, and each side caches the other's index so that it only reads the shared one when the ring looks
+// full (producer) or empty (consumer).
+template <class T>
+class SpscRing {
+ public:
+  // The capacity is rounded up to a power of two.
+  explicit SpscRing(std::size_t capacity) {
+    std::size_t rounded = 1;
+    while (rounded < capacity) rounded <<= 1;
+    slots_.reset(new T[rounded]);
+    mask_ = rounded - 1;
+  }
+  SpscRing(const SpscRing&) = delete;
+  SpscRing& operator=(const SpscRing&) = delete;
+
+  std::size_t Capacity() const noexcept { return mask_ + 1; }
+
+  // Producer side. Returns false (leaving `value` untouched) if the ring is full.
+  bool TryPush(T& value) {
+    return TryEmplace([&](T& slot) { slot = std::move(value); });
+  }
+
+  // Producer side, filling the next slot in place with fill(T&). Returns false without calling it if the ring is
+  // full.
+  template <class Fill>
+  bool TryEmplace(Fill&& fill) {
+    const std::size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cached_head_ > mask_) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail - cached_head_ > mask_) return false;
+    }
+    std::forward<Fill>(fill)(slots_[tail & mask_]);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Returns false if the ring is empty.
+  bool TryPop(T& out) {
+    return TryConsume([&](T& slot) { out = std::move(slot); });
+  }
+
+  // Consumer side. Whether the ring holds no element, reading the producer's index.
+  bool Empty() const noexcept { return head_.load(std::memory_order_relaxed) == tail_.load(std::memory_order_acquire); }
+
+  // Consumer side, handing the oldest slot to consume(T&) in place before it is given back to the producer.
+  // Returns false if the ring is empty.
+  template <class Consume>
+  bool TryConsume(Consume&& consume) {
+    const std::size_t head = head_.load(std::memory_order_relaxed);
+    if (head == cached_tail_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head == cached_tail_) return false;
+    }
+    std::forward<Consume>(consume)(slots_[head & mask_]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+ private:
+  alignas(kCacheLineSize) std::atomic<std::size_t> head_{0};  // Written by the consumer.
+  std::size_t cached_tail_ = 0;
+  alignas(kCacheLineSize) std::atomic<std::size_t> tail_{0};  // Written by the producer.
+  std::size_t cached_head_ = 0;
+  alignas(kCacheLineSize) std::unique_ptr<T[]> slots_;
+  std::size_t mask_ = 0;
+};
+
+template <class Machine, class Key, class Hash = std::hash<Key>, std::size_t InlineEventSize = 64>
+class SessionRouter {
+ public:
+  struct Options {
+    std::size_t shards = 1;
+    std::size_t producers = 1;
+    std::size_t ring_capacity = 1024;  // Per (producer, shard) pair.
+    bool pin_threads = false;          // Pin shard i's thread to CPU i (Linux only).
+  };
+
+  explicit SessionRouter(const Options& options)
+      : options_(options), shards_(new Shard[options.shards]) {
+    UFSM_ASSERT(options.shards > 0 && options.producers > 0);
+    for (std::size_t i = 0; i < options.shards; ++i) {
+      shards_[i].inboxes.reserve(options.producers);
+      for (std::size_t p = 0; p < options.producers; ++p)
+        shards_[i].inboxes.emplace_back(new SpscRing<Message>(options.ring_capacity));
+    }
+  }
+  SessionRouter(const SessionRouter&) = delete;
+  SessionRouter& operator=(const SessionRouter&) = delete;
+  ~SessionRouter() { Stop(); }
+
+  std::size_t ShardCount() const noexcept { return options_.shards; }
+
+  std::size_t ShardOf(const Key& key) const {
+    // Fibonacci mixing: std::hash is the identity for integers on common standard libraries.
+    std::uint64_t h = static_cast<std::uint64_t>(Hash{}(key)) * 0x9E3779B97F4A7C15ull;
+    return static_cast<std::size_t>((h ^ (h >> 32)) % options_.shards);
+  }
+
+  // Hand an event for `key` to its shard. Each producer index must only be used by one thread at a time.
+  // Returns false, without copying the event, if that shard's ring for this producer is full.
+  template <class Ev>
+  bool Route(std::size_t producer, const Key& key, const Ev& event) {
+    UFSM_ASSERT(producer < options_.producers);
+    Shard& shard = shards_[ShardOf(key)];
+    const bool pushed = shard.inboxes[producer]->TryEmplace([&](Message& message) {
+      const detail::EventBase& base = event;
+      message.key = key;
+      message.event = base.CloneInto(message.storage, sizeof(message.storage), alignof(std::max_align_t));
+      if (!message.event) {
+        message.spilled = base.Clone();
+        message.event = message.spilled.get();
+      }
+    });
+    if (!pushed) return false;
+    // Pairs with the fence in ServeShard(): either the shard thread sees the event before parking, or this sees it
+    // parked.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (shard.parked.load(std::memory_order_relaxed)) Wake(shard);
+    return true;
+  }
+
+  // Start one thread per shard. Without Start(), shards are driven by calling Poll(). A shard thread polls its rings
+  // and, after kIdlePasses empty passes, parks until Route() or Stop() wakes it.
+  void Start() {
+    if (running_.exchange(true)) return;
+    for (std::size_t i = 0; i < options_.shards; ++i) {
+      shards_[i].thread = std::thread([this, i] { ServeShard(i); });
+      if (options_.pin_threads) Pin(shards_[i].thread, i);
+    }
+  }
+
+  // Stop the shard threads once they have drained the events routed so far.
+  void Stop() {
+    if (!running_.exchange(false)) return;
+    for (std::size_t i = 0; i < options_.shards; ++i) {
+      Wake(shards_[i]);
+      shards_[i].thread.join();
+    }
+  }
+
+  // Process up to `max_events` events waiting for `shard`, on the calling thread, which then owns that shard's
+  // machines. Returns the number of events processed.
+  std::size_t Poll(std::size_t shard, std::size_t max_events = std::numeric_limits<std::size_t>::max()) {
+    Shard& s = shards_[shard];
+    std::size_t processed = 0;
+    bool progress = true;
+    // Round-robin over the producers so that a busy one cannot starve the others.
+    while (progress && processed < max_events) {
+      progress = false;
+      for (auto& inbox : s.inboxes) {
+        if (processed == max_events || !inbox->TryConsume([&](Message& message) { Dispatch(s, message); })) continue;
+        ++processed;
+        progress = true;
+      }
+    }
+    return processed;
+  }
+
+  // Number of live machines of a shard. Can be read from any thread.
+  std::size_t Sessions(std::size_t shard) const noexcept {
+    return shards_[shard].session_count.load(std::memory_order_relaxed);
+  }
+
+  // The machine serving `key`, or nullptr. Only valid on the thread owning the key's shard, or while stopped.
+  Machine* Find(const Key& key) {
+    auto& sessions = shards_[ShardOf(key)].sessions;
+    auto it = sessions.find(key);
+    return it == sessions.end() ? nullptr : it->second.get();
+  }
+
+ private:
+  // A ring slot. The event lives in `storage`, or in `spilled` if it did not fit there.
+  struct Message {
+    Message() = default;
+    Message(const Message&) = delete;
+    Message& operator=(const Message&) = delete;
+    ~Message() { Release(); }
+
+    void Release() noexcept {
+      if (spilled) {
+        spilled.reset();
+      } else if (event) {
+        event->~EventBase();
+      }
+      event = nullptr;
+    }
+
+    Key key{};
+    detail::EventBase* event = nullptr;
+    detail::EventBase::Ptr spilled;
+    alignas(std::max_align_t) unsigned char storage[InlineEventSize];
+  };
+
+  // Shards are cache-line aligned so that threads serving neighbouring shards do not share lines.
+  struct alignas(kCacheLineSize) Shard {
+    std::vector<std::unique_ptr<SpscRing<Message>>> inboxes;  // One per producer.
+    std::unordered_map<Key, std::unique_ptr<Machine>, Hash> sessions;
+    std::atomic<std::size_t> session_count{0};
+    std::thread thread;
+    std::atomic<bool> parked{false};  // The thread waits on `wake`, or is about to.
+    std::mutex park_mutex;
+    std::condition_variable wake;
+  };
+
+  // Empty passes over its rings after which a shard thread parks.
+  static constexpr unsigned kIdlePasses = 1024;
+
+  void Dispatch(Shard& shard, Message& message) {
+    auto it = shard.sessions.find(message.key);
+    if (it == shard.sessions.end()) {
+      std::unique_ptr<Machine> machine;
+      if constexpr (std::is_constructible_v<Machine, const Key&>)
+        machine.reset(new Machine(message.key));
+      else
+        machine.reset(new Machine());
+      machine->Initiate();
+      it = shard.sessions.emplace(message.key, std::move(machine)).first;
+      shard.session_count.store(shard.sessions.size(), std::memory_order_relaxed);
+    }
+    it->second->ProcessEvent(*message.event);
+    message.Release();
+    if (it->second->Terminated()) {
+      shard.sessions.erase(it);
+      shard.session_count.store(shard.sessions.size(), std::memory_order_relaxed);
+    }
+  }
+
+  void ServeShard(std::size_t shard) {
+    Shard& s = shards_[shard];
+    unsigned idle = 0;
+    for (;;) {
+      if (Poll(shard) != 0) {
+        idle = 0;
+        continue;
+      }
+      // Exit only after an empty pass that started once Stop() was requested.
+      if (!running_.load(std::memory_order_acquire) && Poll(shard) == 0) return;
+      if (++idle < kIdlePasses) {
+        if (idle > 64) std::this_thread::yield();
+        continue;
+      }
+      // Announce parking before the last look at the rings, so that Route() either sees the flag or its event is
+      // seen here.
+      std::unique_lock<std::mutex> lock(s.park_mutex);
+      s.parked.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      const bool empty =
+          std::all_of(s.inboxes.begin(), s.inboxes.end(), [](const auto& inbox) { return inbox->Empty(); });
+      if (empty && running_.load(std::memory_order_acquire))
+        s.wake.wait(lock, [&] { return !s.parked.load(std::memory_order_relaxed); });
+      s.parked.store(false, std::memory_order_relaxed);
+      idle = 0;
+    }
+  }
+
+  static void Wake(Shard& shard) {
+    {
+      std::lock_guard<std::mutex> lock(shard.park_mutex);
+      shard.parked.store(false, std::memory_order_relaxed);
+    }
+    shard.wake.notify_one();
+  }
+
+  static void Pin([[maybe_unused]] std::thread& thread, [[maybe_unused]] std::size_t cpu) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % CPU_SETSIZE, &set);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#endif
+  }
+
+  Options options_;
+  std::unique_ptr<Shard[]> shards_;
+  std::atomic<bool> running_{false};
+};
+
+}  // namespace ufsm
+
+#endif  // UFSM_ROUTER_H_
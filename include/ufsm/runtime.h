@@ -0,0 +1,672 @@
+#ifndef UFSM_RUNTIME_H_
+#define UFSM_RUNTIME_H_
+
+// Runtime-defined machines: a state hierarchy, its reactions and its event names loaded from a compact binary table
+// instead of being compiled in.
+//
+// RuntimeBuilder writes the table. RuntimeDefinition loads it, memory-mapping large files, and checks it in one
+// linear pass without copying it. RuntimeMachine runs it with StateMachine's semantics: entering a state drills down
+// through initial substates; a transition exits up to the least common ancestor of the reacting state and the target
+// and enters down from there; events deferred by a state go back to the front of the posted queue when it exits; and
+// events posted during a step are processed after it, in order. Entry, exit and transition actions are named in the
+// table and bound to C++ callbacks with RuntimeDefinition::Bind().
+//
+// Table layout, in native byte order (see detail::RuntimeHeader and the entries after it):
+//   header | states | reactions | event names | action names | strings
+// States come parents first, each with its reactions contiguous, in state order and sorted by event. The writer
+// precomputes every state's depth and, per transition, the number of active states it keeps (the depth of the least
+// common ancestor), so dispatch only reads the tables. The loader checks every index, depth and bound that dispatch
+// relies on. Failures of Open() and Assign() are reported as false with errno set, EINVAL for a malformed table.
+
+#include <ufsm/ufsm.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define UFSM_RUNTIME_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ufsm {
+
+// Index of a state, event or action of a runtime definition.
+using RuntimeId = std::uint32_t;
+inline constexpr RuntimeId kRuntimeNone = ~RuntimeId{0};
+
+class RuntimeMachine;
+
+namespace detail {
+
+inline constexpr std::uint32_t kRuntimeMagic = 0x4d534655;  // "UFSM" when read in little-endian order.
+inline constexpr std::uint32_t kRuntimeVersion = 1;
+inline constexpr std::uint32_t kRuntimeMaxDepth = 1024;
+
+struct RuntimeHeader {
+  std::uint32_t magic;
+  std::uint32_t version;
+  std::uint32_t state_count;
+  std::uint32_t event_count;
+  std::uint32_t reaction_count;
+  std::uint32_t action_count;
+  std::uint32_t string_size;  // Bytes of NUL-terminated names, padded with NULs to a multiple of four.
+  std::uint32_t initial;      // Top-level state entered by Initiate().
+  std::uint32_t max_depth;    // Depth of the deepest state; top-level states have depth 1.
+  std::uint32_t reserved;
+};
+
+struct RuntimeStateEntry {
+  std::uint32_t parent;  // kRuntimeNone for top-level states.
+  std::uint32_t initial;  // kRuntimeNone for leaves.
+  std::uint32_t depth;
+  std::uint32_t name;  // Offset into the strings.
+  std::uint32_t first_reaction;
+  std::uint32_t reaction_count;
+  std::uint32_t entry_action;  // kRuntimeNone if none.
+  std::uint32_t exit_action;
+};
+
+enum RuntimeReactionKind : std::uint16_t {
+  kRuntimeTransition,  // Transit to `target`, running `action` between exit and entry.
+  kRuntimeInternal,    // Consume the event, running `action` if any.
+  kRuntimeDefer        // Defer the event.
+};
+
+struct RuntimeReactionEntry {
+  std::uint32_t event;
+  std::uint16_t kind;
+  std::uint16_t keep;  // Transitions: active states kept, the depth of the least common ancestor.
+  std::uint32_t target;
+  std::uint32_t action;
+};
+
+// Number of active states a transition from `source` (the reacting state) to `target` keeps: the depth of the
+// deepest state that is both `source` or one of its ancestors and a proper ancestor of `target`, as in Transit().
+inline std::uint32_t RuntimeKeep(const RuntimeStateEntry* states, std::uint32_t source, std::uint32_t target) {
+  std::uint32_t a = source, b = states[target].parent;
+  if (b == kRuntimeNone) return 0;
+  while (states[a].depth > states[b].depth) a = states[a].parent;
+  while (states[b].depth > states[a].depth) b = states[b].parent;
+  while (a != b) {
+    a = states[a].parent;
+    b = states[b].parent;
+    if (a == kRuntimeNone) return 0;
+  }
+  return states[a].depth;
+}
+
+}  // namespace detail
+
+// Writes runtime tables. States are added parents first; the first child added to a state, or the first top-level
+// state for the machine, is the initial one unless SetInitial() picks another. Empty action names mean no action.
+class RuntimeBuilder {
+ public:
+  RuntimeId AddState(std::string name, RuntimeId parent = kRuntimeNone) {
+    UFSM_ASSERT(parent == kRuntimeNone || parent < states_.size());
+    const auto id = static_cast<RuntimeId>(states_.size());
+    states_.push_back(StateSpec{std::move(name), parent, kRuntimeNone, {}, {}, {}});
+    RuntimeId& initial = parent == kRuntimeNone ? initial_ : states_[parent].initial;
+    if (initial == kRuntimeNone) initial = id;
+    return id;
+  }
+
+  // Make `child` the initial substate of `parent`, or the machine's initial state for kRuntimeNone.
+  void SetInitial(RuntimeId parent, RuntimeId child) {
+    UFSM_ASSERT(child < states_.size() && states_[child].parent == parent);
+    (parent == kRuntimeNone ? initial_ : states_[parent].initial) = child;
+  }
+
+  RuntimeId AddEvent(std::string name) {
+    events_.push_back(std::move(name));
+    return static_cast<RuntimeId>(events_.size() - 1);
+  }
+
+  void SetEntryAction(RuntimeId state, std::string action) { states_[state].entry = std::move(action); }
+  void SetExitAction(RuntimeId state, std::string action) { states_[state].exit = std::move(action); }
+
+  // Reactions of a state. As with a state's reaction list, the first one added for an event wins.
+  void AddTransition(RuntimeId state, RuntimeId event, RuntimeId target, std::string action = {}) {
+    UFSM_ASSERT(target < states_.size());
+    AddReaction(state, event, detail::kRuntimeTransition, target, std::move(action));
+  }
+  void AddInternal(RuntimeId state, RuntimeId event, std::string action = {}) {
+    AddReaction(state, event, detail::kRuntimeInternal, kRuntimeNone, std::move(action));
+  }
+  void AddDeferral(RuntimeId state, RuntimeId event) {
+    AddReaction(state, event, detail::kRuntimeDefer, kRuntimeNone, {});
+  }
+
+  std::vector<std::uint8_t> Build() const {
+    UFSM_ASSERT(!states_.empty());
+    std::string strings;
+    auto intern = [&](const std::string& s) {
+      auto offset = static_cast<std::uint32_t>(strings.size());
+      strings.append(s).push_back('\0');
+      return offset;
+    };
+    std::vector<const std::string*> actions;
+    std::unordered_map<std::string, std::uint32_t> action_ids;
+    auto action = [&](const std::string& name) {
+      if (name.empty()) return kRuntimeNone;
+      auto [it, added] = action_ids.emplace(name, static_cast<std::uint32_t>(actions.size()));
+      if (added) actions.push_back(&it->first);
+      return it->second;
+    };
+
+    std::vector<detail::RuntimeStateEntry> states(states_.size());
+    std::vector<detail::RuntimeReactionEntry> reactions;
+    std::uint32_t max_depth = 0;
+    for (std::size_t i = 0; i < states_.size(); ++i) {
+      const auto& spec = states_[i];
+      auto& state = states[i];
+      state.parent = spec.parent;
+      state.initial = spec.initial;
+      state.depth = spec.parent == kRuntimeNone ? 1 : states[spec.parent].depth + 1;
+      state.name = intern(spec.name);
+      state.first_reaction = static_cast<std::uint32_t>(reactions.size());
+      state.entry_action = action(spec.entry);
+      state.exit_action = action(spec.exit);
+      max_depth = std::max(max_depth, state.depth);
+
+      auto sorted = spec.reactions;
+      std::stable_sort(sorted.begin(), sorted.end(),
+                       [](const ReactionSpec& a, const ReactionSpec& b) { return a.event < b.event; });
+      for (const auto& r : sorted) {
+        if (reactions.size() > state.first_reaction && reactions.back().event == r.event) continue;
+        reactions.push_back({r.event, r.kind, 0, r.target, action(r.action)});
+      }
+      state.reaction_count = static_cast<std::uint32_t>(reactions.size()) - state.first_reaction;
+    }
+    for (std::uint32_t i = 0; i < states.size(); ++i) {
+      for (auto r = states[i].first_reaction; r < states[i].first_reaction + states[i].reaction_count; ++r) {
+        if (reactions[r].kind == detail::kRuntimeTransition)
+          reactions[r].keep = static_cast<std::uint16_t>(detail::RuntimeKeep(states.data(), i, reactions[r].target));
+      }
+    }
+
+    std::vector<std::uint32_t> names;
+    for (const auto& event : events_) names.push_back(intern(event));
+    for (const auto* name : actions) names.push_back(intern(*name));
+    strings.resize((strings.size() + 3) / 4 * 4, '\0');
+
+    detail::RuntimeHeader header{};
+    header.magic = detail::kRuntimeMagic;
+    header.version = detail::kRuntimeVersion;
+    header.state_count = static_cast<std::uint32_t>(states.size());
+    header.event_count = static_cast<std::uint32_t>(events_.size());
+    header.reaction_count = static_cast<std::uint32_t>(reactions.size());
+    header.action_count = static_cast<std::uint32_t>(actions.size());
+    header.string_size = static_cast<std::uint32_t>(strings.size());
+    header.initial = initial_;
+    header.max_depth = max_depth;
+
+    std::vector<std::uint8_t> bytes(sizeof(header) + states.size() * sizeof(states[0]) +
+                                    reactions.size() * sizeof(reactions[0]) + names.size() * sizeof(names[0]) +
+                                    strings.size());
+    std::size_t written = 0;
+    auto append = [&](const void* data, std::size_t size) {
+      if (size) std::memcpy(bytes.data() + written, data, size);
+      written += size;
+    };
+    append(&header, sizeof(header));
+    append(states.data(), states.size() * sizeof(states[0]));
+    append(reactions.data(), reactions.size() * sizeof(reactions[0]));
+    append(names.data(), names.size() * sizeof(names[0]));
+    append(strings.data(), strings.size());
+    return bytes;
+  }
+
+ private:
+  struct ReactionSpec {
+    RuntimeId event;
+    std::uint16_t kind;
+    RuntimeId target;
+    std::string action;
+  };
+  struct StateSpec {
+    std::string name;
+    RuntimeId parent;
+    RuntimeId initial = kRuntimeNone;
+    std::string entry, exit;
+    std::vector<ReactionSpec> reactions;
+  };
+
+  void AddReaction(RuntimeId state, RuntimeId event, std::uint16_t kind, RuntimeId target, std::string action) {
+    UFSM_ASSERT(state < states_.size() && event < events_.size());
+    states_[state].reactions.push_back(ReactionSpec{event, kind, target, std::move(action)});
+  }
+
+  std::vector<StateSpec> states_;
+  std::vector<std::string> events_;
+  RuntimeId initial_ = kRuntimeNone;
+};
+
+// Callbacks that runtime definitions bind their action names to.
+class RuntimeActions {
+ public:
+  using Callback = std::function<void(RuntimeMachine&)>;
+
+  void Register(std::string name, Callback callback) { callbacks_[std::move(name)] = std::move(callback); }
+
+  const Callback* Find(std::string_view name) const {
+    auto it = callbacks_.find(std::string(name));
+    return it == callbacks_.end() ? nullptr : &it->second;
+  }
+
+ private:
+  std::unordered_map<std::string, Callback> callbacks_;
+};
+
+// A loaded table. It must outlive the machines running it and must not be reloaded while they exist.
+class RuntimeDefinition {
+ public:
+  // Files at least this large are memory-mapped rather than read.
+  static constexpr std::size_t kMapThreshold = 64 * 1024;
+
+  RuntimeDefinition() = default;
+  RuntimeDefinition(const RuntimeDefinition&) = delete;
+  RuntimeDefinition& operator=(const RuntimeDefinition&) = delete;
+  ~RuntimeDefinition() { Release(); }
+
+  // Load a table file.
+  bool Open(const char* path, std::size_t map_threshold = kMapThreshold) {
+    Release();
+#if defined(UFSM_RUNTIME_MMAP)
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) return CloseFailing(fd);
+    const auto size = static_cast<std::size_t>(st.st_size);
+    if (size >= map_threshold && size > 0) {
+      void* map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map == MAP_FAILED) return CloseFailing(fd);
+      ::close(fd);
+      map_ = map;
+      map_size_ = size;
+    } else {
+      buffer_.reset(new std::uint32_t[(size + 3) / 4]);
+      for (std::size_t done = 0; done < size;) {
+        auto n = ::read(fd, reinterpret_cast<char*>(buffer_.get()) + done, size - done);
+        if (n <= 0) {
+          if (n == 0) errno = EIO;
+          if (n == 0 || errno != EINTR) return CloseFailing(fd);
+          continue;
+        }
+        done += static_cast<std::size_t>(n);
+      }
+      ::close(fd);
+    }
+    if (Parse(map_ ? map_ : buffer_.get(), size)) return true;
+#else
+    (void)map_threshold;
+    std::FILE* file = std::fopen(path, "rb");
+    if (!file) return false;
+    std::vector<char> bytes;
+    char chunk[4096];
+    for (std::size_t n; (n = std::fread(chunk, 1, sizeof(chunk), file)) > 0;) bytes.insert(bytes.end(), chunk, chunk + n);
+    const bool failed = std::ferror(file);
+    std::fclose(file);
+    if (failed) {
+      errno = EIO;
+      return false;
+    }
+    buffer_.reset(new std::uint32_t[(bytes.size() + 3) / 4]);
+    if (!bytes.empty()) std::memcpy(buffer_.get(), bytes.data(), bytes.size());
+    if (Parse(buffer_.get(), bytes.size())) return true;
+#endif
+    const int error = errno;
+    Release();
+    errno = error;
+    return false;
+  }
+
+  // Use a table in memory, which must stay alive and unchanged while this definition uses it and be aligned to four
+  // bytes. Nothing is copied.
+  bool Assign(const void* data, std::size_t size) {
+    Release();
+    if (Parse(data, size)) return true;
+    Release();
+    errno = EINVAL;
+    return false;
+  }
+
+  // Bind every action name of the table to its callback. Returns false, binding nothing, if one has none.
+  bool Bind(const RuntimeActions& actions) {
+    std::vector<RuntimeActions::Callback> callbacks;
+    callbacks.reserve(header_ ? header_->action_count : 0);
+    for (std::uint32_t i = 0; header_ && i < header_->action_count; ++i) {
+      auto* callback = actions.Find(String(action_names_[i]));
+      if (!callback) return false;
+      callbacks.push_back(*callback);
+    }
+    callbacks_ = std::move(callbacks);
+    bound_ = true;
+    return true;
+  }
+
+  bool Loaded() const noexcept { return header_ != nullptr; }
+  bool Mapped() const noexcept { return map_ != nullptr; }
+  bool Bound() const noexcept { return bound_; }
+
+  std::size_t StateCount() const noexcept { return header_ ? header_->state_count : 0; }
+  std::size_t EventCount() const noexcept { return header_ ? header_->event_count : 0; }
+
+  // Lookups by name, for setting up; kRuntimeNone if absent.
+  RuntimeId FindState(std::string_view name) const {
+    for (RuntimeId i = 0; i < StateCount(); ++i)
+      if (String(states_[i].name) == name) return i;
+    return kRuntimeNone;
+  }
+  RuntimeId FindEvent(std::string_view name) const {
+    for (RuntimeId i = 0; i < EventCount(); ++i)
+      if (String(event_names_[i]) == name) return i;
+    return kRuntimeNone;
+  }
+
+  const char* StateName(RuntimeId state) const noexcept { return String(states_[state].name); }
+  const char* EventName(RuntimeId event) const noexcept { return String(event_names_[event]); }
+  RuntimeId Parent(RuntimeId state) const noexcept { return states_[state].parent; }
+
+ private:
+  friend class RuntimeMachine;
+
+  const char* String(std::uint32_t offset) const noexcept { return strings_ + offset; }
+
+  bool Parse(const void* data, std::size_t size) {
+    using detail::RuntimeHeader, detail::RuntimeReactionEntry, detail::RuntimeStateEntry;
+    errno = EINVAL;
+    if (!data || reinterpret_cast<std::uintptr_t>(data) % alignof(RuntimeHeader) != 0) return false;
+    if (size < sizeof(RuntimeHeader)) return false;
+    auto* header = static_cast<const RuntimeHeader*>(data);
+    if (header->magic != detail::kRuntimeMagic || header->version != detail::kRuntimeVersion) return false;
+    const std::uint64_t states_at = sizeof(RuntimeHeader);
+    const std::uint64_t reactions_at = states_at + std::uint64_t{header->state_count} * sizeof(RuntimeStateEntry);
+    const std::uint64_t events_at =
+        reactions_at + std::uint64_t{header->reaction_count} * sizeof(RuntimeReactionEntry);
+    const std::uint64_t actions_at = events_at + std::uint64_t{header->event_count} * sizeof(std::uint32_t);
+    const std::uint64_t strings_at = actions_at + std::uint64_t{header->action_count} * sizeof(std::uint32_t);
+    if (strings_at + header->string_size > size || header->string_size % 4 != 0) return false;
+
+    auto* bytes = static_cast<const char*>(data);
+    auto* states = reinterpret_cast<const RuntimeStateEntry*>(bytes + states_at);
+    auto* reactions = reinterpret_cast<const RuntimeReactionEntry*>(bytes + reactions_at);
+    auto* event_names = reinterpret_cast<const std::uint32_t*>(bytes + events_at);
+    auto* action_names = reinterpret_cast<const std::uint32_t*>(bytes + actions_at);
+    const std::uint32_t strings = header->string_size;
+    if (strings == 0 || bytes[strings_at + strings - 1] != '\0') return false;
+    if (header->max_depth == 0 || header->max_depth > detail::kRuntimeMaxDepth) return false;
+
+    const std::uint32_t state_count = header->state_count, event_count = header->event_count;
+    const std::uint32_t action_count = header->action_count;
+    auto valid_action = [&](std::uint32_t action) { return action == kRuntimeNone || action < action_count; };
+    if (header->initial >= state_count || states[header->initial].parent != kRuntimeNone) return false;
+    for (std::uint32_t i = 0; i < event_count; ++i)
+      if (event_names[i] >= strings) return false;
+    for (std::uint32_t i = 0; i < action_count; ++i)
+      if (action_names[i] >= strings) return false;
+
+    std::uint32_t next_reaction = 0;
+    for (std::uint32_t i = 0; i < state_count; ++i) {
+      const auto& state = states[i];
+      if (state.parent != kRuntimeNone && state.parent >= i) return false;
+      if (state.depth != (state.parent == kRuntimeNone ? 1 : states[state.parent].depth + 1)) return false;
+      if (state.depth > header->max_depth || state.name >= strings) return false;
+      if (state.initial != kRuntimeNone && (state.initial >= state_count || states[state.initial].parent != i))
+        return false;
+      if (!valid_action(state.entry_action) || !valid_action(state.exit_action)) return false;
+      if (state.first_reaction != next_reaction || state.reaction_count > header->reaction_count - next_reaction)
+        return false;
+      next_reaction += state.reaction_count;
+    }
+    if (next_reaction != header->reaction_count) return false;
+
+    // Reactions, with the depth of their state known.
+    for (std::uint32_t i = 0; i < state_count; ++i) {
+      for (std::uint32_t r = states[i].first_reaction; r < states[i].first_reaction + states[i].reaction_count; ++r) {
+        const auto& reaction = reactions[r];
+        if (reaction.event >= event_count || !valid_action(reaction.action)) return false;
+        if (r > states[i].first_reaction && reactions[r - 1].event >= reaction.event) return false;
+        if (reaction.kind == detail::kRuntimeTransition) {
+          // Within bounds, so that exits and entries stay on the path; that it is the least common ancestor's depth
+          // is up to the writer, as computing it here would cost more than the rest of the checks together.
+          if (reaction.target >= state_count || reaction.keep >= states[reaction.target].depth ||
+              reaction.keep > states[i].depth)
+            return false;
+        } else if (reaction.kind != detail::kRuntimeInternal && reaction.kind != detail::kRuntimeDefer) {
+          return false;
+        }
+      }
+    }
+
+    header_ = header;
+    states_ = states;
+    reactions_ = reactions;
+    event_names_ = event_names;
+    action_names_ = action_names;
+    strings_ = bytes + strings_at;
+    bound_ = action_count == 0;
+    errno = 0;
+    return true;
+  }
+
+#if defined(UFSM_RUNTIME_MMAP)
+  static bool CloseFailing(int fd) {
+    const int error = errno;
+    ::close(fd);
+    errno = error;
+    return false;
+  }
+#endif
+
+  void Release() noexcept {
+#if defined(UFSM_RUNTIME_MMAP)
+    if (map_) ::munmap(map_, map_size_);
+#endif
+    map_ = nullptr;
+    map_size_ = 0;
+    buffer_.reset();
+    header_ = nullptr;
+    callbacks_.clear();
+    bound_ = false;
+  }
+
+  const detail::RuntimeHeader* header_ = nullptr;
+  const detail::RuntimeStateEntry* states_ = nullptr;
+  const detail::RuntimeReactionEntry* reactions_ = nullptr;
+  const std::uint32_t* event_names_ = nullptr;
+  const std::uint32_t* action_names_ = nullptr;
+  const char* strings_ = nullptr;
+  std::vector<RuntimeActions::Callback> callbacks_;
+  bool bound_ = false;
+  void* map_ = nullptr;
+  std::size_t map_size_ = 0;
+  std::unique_ptr<std::uint32_t[]> buffer_;
+};
+
+// One instance of a runtime definition, with its own active path and event queues.
+class RuntimeMachine {
+ public:
+  // `context` is handed back to actions through Context().
+  explicit RuntimeMachine(const RuntimeDefinition& definition, void* context = nullptr)
+      : definition_(definition), context_(context), path_(definition.header_ ? definition.header_->max_depth : 0) {
+    UFSM_ASSERT(definition.Loaded() && definition.Bound());
+  }
+  RuntimeMachine(const RuntimeMachine&) = delete;
+  RuntimeMachine& operator=(const RuntimeMachine&) = delete;
+  ~RuntimeMachine() { TerminateImpl(); }
+
+  // Start the machine in the definition's initial state and its initial substates.
+  void Initiate() {
+    TerminateImpl();
+    RunToCompletion([&] {
+      Enter(definition_.header_->initial, 0);
+      return Result::kConsumed;
+    });
+  }
+
+  void Terminate() {
+#if !defined(NDEBUG)
+    UFSM_ASSERT(!in_transition_);
+#endif
+    TerminateImpl();
+  }
+
+  bool Terminated() const noexcept { return depth_ == 0; }
+
+  // Process an event and then the events posted meanwhile. Returns, like StateMachine, the result of the last one.
+  Result ProcessEvent(RuntimeId event) {
+#if !defined(NDEBUG)
+    UFSM_ASSERT(!in_transition_);
+#endif
+    UFSM_ASSERT(event < definition_.EventCount());
+    return RunToCompletion([&] { return Dispatch(event); });
+  }
+
+  // Post an event to be processed after the current one.
+  void PostEvent(RuntimeId event) {
+    UFSM_ASSERT(event < definition_.EventCount());
+    posted_.push_back(event);
+  }
+
+  // Check if the machine is in a state, leaf or composite.
+  bool IsInState(RuntimeId state) const noexcept {
+    const auto depth = state < definition_.StateCount() ? definition_.states_[state].depth : 0;
+    return depth && depth <= depth_ && path_[depth - 1].state == state;
+  }
+
+  // The innermost active state, or kRuntimeNone when terminated.
+  RuntimeId Leaf() const noexcept { return depth_ ? path_[depth_ - 1].state : kRuntimeNone; }
+
+  // The event being dispatched, for actions; kRuntimeNone while entering initial states.
+  RuntimeId CurrentEvent() const noexcept { return current_event_; }
+
+  void* Context() const noexcept { return context_; }
+  const RuntimeDefinition& Definition() const noexcept { return definition_; }
+
+ private:
+  struct Slot {
+    RuntimeId state;
+    bool deferred;
+  };
+
+  template <class Step>
+  Result RunToCompletion(Step&& step) {
+    if (in_event_loop_) return step();
+    detail::RestoreOnExit<bool> guard(in_event_loop_, true);
+    Result last = step();
+    while (!posted_.empty()) {
+      RuntimeId event = posted_.front();
+      posted_.pop_front();
+      last = Dispatch(event);
+    }
+    return last;
+  }
+
+  Result Dispatch(RuntimeId event) {
+    detail::RestoreOnExit<RuntimeId> guard(current_event_, event);
+    // The innermost active state with a reaction to the event handles it.
+    for (std::uint32_t depth = depth_; depth > 0; --depth) {
+      const auto& state = definition_.states_[path_[depth - 1].state];
+      const auto* first = definition_.reactions_ + state.first_reaction;
+      const auto* last = first + state.reaction_count;
+      const auto* reaction = std::lower_bound(
+          first, last, event, [](const detail::RuntimeReactionEntry& r, RuntimeId e) { return r.event < e; });
+      if (reaction == last || reaction->event != event) continue;
+
+      switch (reaction->kind) {
+        case detail::kRuntimeTransition:
+          Transit(*reaction);
+          return Result::kConsumed;
+        case detail::kRuntimeDefer:
+          path_[depth - 1].deferred = true;
+          deferred_.push_back(event);
+          return Result::kConsumed;
+        default:
+          Run(reaction->action);
+          return Result::kConsumed;
+      }
+    }
+    return Result::kForwardEvent;
+  }
+
+  void Transit(const detail::RuntimeReactionEntry& reaction) {
+#if !defined(NDEBUG)
+    UFSM_ASSERT(!in_transition_);
+    detail::RestoreOnExit<bool> guard(in_transition_, true);
+#endif
+    ExitToDepth(reaction.keep);
+    Run(reaction.action);
+    Enter(reaction.target, reaction.keep);
+  }
+
+  // Enter `target` and its ancestors deeper than the active depth `from`, outermost first, then drill down through
+  // initial substates to a leaf.
+  void Enter(RuntimeId target, std::uint32_t from) {
+    const auto* states = definition_.states_;
+    for (RuntimeId state = target;; state = states[state].parent) {
+      path_[states[state].depth - 1] = Slot{state, false};
+      if (states[state].depth == from + 1) break;
+    }
+    while (depth_ < states[target].depth) {
+      ++depth_;
+      Run(states[path_[depth_ - 1].state].entry_action);
+    }
+    for (RuntimeId state = states[target].initial; state != kRuntimeNone; state = states[state].initial) {
+      path_[depth_++] = Slot{state, false};
+      Run(states[state].entry_action);
+    }
+  }
+
+  // Exit the states deeper than `depth`, innermost first; events deferred by any of them go back to the front of the
+  // posted queue, in order.
+  void ExitToDepth(std::uint32_t depth) {
+    bool deferred = false;
+    while (depth_ > depth) {
+      Run(definition_.states_[path_[depth_ - 1].state].exit_action);
+      deferred |= path_[depth_ - 1].deferred;
+      --depth_;
+    }
+    if (deferred)
+      for (; !deferred_.empty(); deferred_.pop_back()) posted_.push_front(deferred_.back());
+  }
+
+  void Run(RuntimeId action) {
+    if (action != kRuntimeNone) definition_.callbacks_[action](*this);
+  }
+
+  void TerminateImpl() {
+    ExitToDepth(0);
+    posted_.clear();
+    deferred_.clear();
+  }
+
+  const RuntimeDefinition& definition_;
+  void* context_;
+  std::vector<Slot> path_;
+  std::uint32_t depth_ = 0;
+  RuntimeId current_event_ = kRuntimeNone;
+  std::deque<RuntimeId> posted_;
+  std::deque<RuntimeId> deferred_;
+  bool in_event_loop_ = false;
+#if !defined(NDEBUG)
+  bool in_transition_ = false;
+#endif
+};
+
+}  // namespace ufsm
+
+#endif  // UFSM_RUNTIME_H_
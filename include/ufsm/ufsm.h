@@ -3,16 +3,21 @@
 
 #define UFSM_VERSION "0.4.0"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cstddef>
-#include <deque>
+#include <cstdint>
+#include <cstring>
 #include <memory>
+#include <new>
 #include <string>
 #include <string_view>
 #include <tuple>
 #include <type_traits>
 #include <utility>
-#include <vector>
 
 #ifndef UFSM_ASSERT
 #if !defined(NDEBUG)
@@ -22,9 +27,31 @@
 #endif
 #endif
 
+// Keeps a function out of line, so that the one copy the linker keeps is shared by all its callers.
+#if defined(__GNUC__) || defined(__clang__)
+#define UFSM_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define UFSM_NOINLINE __declspec(noinline)
+#else
+#define UFSM_NOINLINE
+#endif
+
 namespace ufsm {
 
+// std::is_same_v instantiates a variable per pair of types; the builtin behind it does not.
+#if defined(__has_builtin)
+#if __has_builtin(__is_same)
+#define UFSM_IS_SAME(a, b) __is_same(a, b)
+#endif
+#endif
+#if !defined(UFSM_IS_SAME)
+#define UFSM_IS_SAME(a, b) std::is_same_v<a, b>
+#endif
+
 // Metaprogramming utilities
+// Everything here works by pack expansion and index lookup rather than by recursing over list elements, so that the
+// instantiation depth stays bounded for machines with hundreds of states. Only Concat (over the number of lists, in
+// steps of eight) and Closure (over the breadth-first levels of the relation, eight levels per step) recurse.
 namespace mp {
 
 // A type list container.
@@ -58,18 +85,89 @@ template <typename ListType, typename Type>
 struct Contains : std::false_type {};
 
 template <typename... Types, typename Type>
-struct Contains<List<Types...>, Type> : std::bool_constant<(std::is_same_v<Types, Type> || ...)> {};
+struct Contains<List<Types...>, Type> : std::bool_constant<(UFSM_IS_SAME(Types, Type) || ...)> {};
+
+// Number of types in a list.
+// Example: Size<List<A, B>>::value -> 2
+template <typename ListType>
+struct Size;
+
+template <typename... Types>
+struct Size<List<Types...>> : std::integral_constant<std::size_t, sizeof...(Types)> {};
+
+// Position of the first true value, or the number of values if there is none.
+template <bool... Values>
+inline constexpr std::size_t kFirstTrue = [] {
+  constexpr bool values[] = {Values..., true};
+  std::size_t i = 0;
+  while (!values[i]) ++i;
+  return i;
+}();
+
+// Position of the first occurrence of a type in a list, or the list's size if it is absent.
+// Example: IndexOf<List<A, B>, B>::value -> 1
+template <typename ListType, typename Type>
+struct IndexOf;
+
+template <typename... Types, typename Type>
+struct IndexOf<List<Types...>, Type> : std::integral_constant<std::size_t, kFirstTrue<UFSM_IS_SAME(Types, Type)...>> {};
+
+template <std::size_t I, typename T>
+struct Indexed {
+  using type = T;
+};
+
+template <typename Indices, typename... Types>
+struct IndexedTypes;
+
+template <std::size_t... Is, typename... Types>
+struct IndexedTypes<std::index_sequence<Is...>, Types...> : Indexed<Is, Types>... {};
+
+template <std::size_t I, typename T>
+Indexed<I, T> SelectIndexed(const Indexed<I, T>&);
+
+// The type at a position of a list, found by overload resolution among the list's indexed bases.
+// Example: At<List<A, B>, 1>::type -> B
+template <typename ListType, std::size_t I>
+struct At;
 
-// Find the first type in a list satisfying a predicate.
+template <typename... Types, std::size_t I>
+struct At<List<Types...>, I> {
+  static_assert(I < sizeof...(Types), "Index out of range");
+  using type = typename decltype(SelectIndexed<I>(
+      std::declval<const IndexedTypes<std::index_sequence_for<Types...>, Types...>&>()))::type;
+};
+
+// The types of a list at the positions where Keep is true.
+// Example: Select<List<A, B, C>, std::integer_sequence<bool, true, false, true>>::type -> List<A, C>
+template <typename ListType, typename Keep>
+struct Select;
+
+template <typename... Types, bool... Keep>
+struct Select<List<Types...>, std::integer_sequence<bool, Keep...>> {
+  static constexpr std::size_t kCount = (std::size_t{Keep} + ... + 0);
+  static constexpr std::array<std::size_t, kCount> kPositions = [] {
+    constexpr bool keep[] = {Keep..., false};
+    std::array<std::size_t, kCount> positions{};
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < sizeof...(Types); ++i)
+      if (keep[i]) positions[n++] = i;
+    return positions;
+  }();
+
+  template <std::size_t... Is>
+  static List<typename At<List<Types...>, kPositions[Is]>::type...> Make(std::index_sequence<Is...>);
+  using type = decltype(Make(std::make_index_sequence<kCount>{}));
+};
+
+// Find the first type in a list satisfying a predicate, or void.
 // Pred is a template class where Pred<T>::value is a boolean.
 template <typename ListType, template <typename> class Pred>
-struct FindIf {
-  using type = void;
-};
+struct FindIf;
 
-template <typename Head, typename... Tail, template <typename> class Pred>
-struct FindIf<List<Head, Tail...>, Pred> {
-  using type = std::conditional_t<Pred<Head>::value, Head, typename FindIf<List<Tail...>, Pred>::type>;
+template <typename... Types, template <typename> class Pred>
+struct FindIf<List<Types...>, Pred> {
+  using type = typename At<List<Types..., void>, kFirstTrue<Pred<Types>::value...>>::type;
 };
 
 // Find the first type in List1 that is also present in List2.
@@ -88,17 +186,109 @@ struct FindChildOf {
   using type = typename FindIf<ListType, Pred>::type;
 };
 
-// Build a path of states from the head of ListType up to (but not including) StopType.
+// Build a path of states from the head of ListType up to (but not including) StopType, in reverse order.
 // Used to determine the sequence of states to construct during a transition.
+// Example: BuildPath<List<C, B, A, Root>, Root>::type -> List<A, B, C>
 template <typename ListType, typename StopType>
-struct BuildPath {
+struct BuildPath;
+
+template <typename... Types, typename StopType>
+struct BuildPath<List<Types...>, StopType> {
+  static constexpr std::size_t kLength = IndexOf<List<Types...>, StopType>::value;
+
+  template <std::size_t... Is>
+  static List<typename At<List<Types...>, kLength - 1 - Is>::type...> Make(std::index_sequence<Is...>);
+  using type = decltype(Make(std::make_index_sequence<kLength>{}));
+};
+
+// Concatenate lists.
+// Example: Concat<List<A>, List<B, C>>::type -> List<A, B, C>
+template <typename... Lists>
+struct Concat {
   using type = List<>;
 };
 
-template <typename Head, typename... Tail, typename StopType>
-struct BuildPath<List<Head, Tail...>, StopType> {
-  using type = std::conditional_t<std::is_same_v<Head, StopType>, List<>,
-                                  typename PushBack<typename BuildPath<List<Tail...>, StopType>::type, Head>::type>;
+template <typename... Types>
+struct Concat<List<Types...>> {
+  using type = List<Types...>;
+};
+
+template <typename... Types1, typename... Types2, typename... Rest>
+struct Concat<List<Types1...>, List<Types2...>, Rest...> {
+  using type = typename Concat<List<Types1..., Types2...>, Rest...>::type;
+};
+
+template <typename... T1, typename... T2, typename... T3, typename... T4, typename... T5, typename... T6,
+          typename... T7, typename... T8, typename... Rest>
+struct Concat<List<T1...>, List<T2...>, List<T3...>, List<T4...>, List<T5...>, List<T6...>, List<T7...>,
+              List<T8...>, Rest...> {
+  using type = typename Concat<List<T1..., T2..., T3..., T4..., T5..., T6..., T7..., T8...>, Rest...>::type;
+};
+
+// Keep the types of a list satisfying a predicate.
+template <typename ListType, template <typename> class Pred>
+struct Filter;
+
+template <typename... Types, template <typename> class Pred>
+struct Filter<List<Types...>, Pred> {
+  using type = typename Select<List<Types...>, std::integer_sequence<bool, Pred<Types>::value...>>::type;
+};
+
+template <typename T>
+struct SetEntry {};
+
+// Constant-time membership test for a list without duplicates.
+template <typename... Types>
+struct TypeSet : SetEntry<Types>... {
+  template <typename T>
+  static constexpr bool kContains = std::is_base_of_v<SetEntry<T>, TypeSet>;
+};
+
+// One breadth-first level of Closure: the first occurrences in Pending of the types not visited yet join Visited,
+// and the types related to them that are still unknown become the next Pending list. Dropping known types early
+// keeps Pending short, which matters because removing duplicates from it is quadratic.
+template <typename Pending, typename Visited, template <typename> class Next,
+          typename = std::make_index_sequence<Size<Pending>::value>>
+struct ClosureLevel;
+
+template <typename... Pending, typename... Visited, template <typename> class Next, std::size_t... Is>
+struct ClosureLevel<List<Pending...>, List<Visited...>, Next, std::index_sequence<Is...>> {
+  template <typename FreshList>
+  struct Expand;
+  template <typename... Fresh>
+  struct Expand<List<Fresh...>> {
+    using visited = List<Visited..., Fresh...>;
+    using pending = typename Concat<typename Next<Fresh>::type...>::type;
+  };
+
+  using Fresh = typename Select<List<Pending...>,
+                                std::integer_sequence<bool, (IndexOf<List<Pending...>, Pending>::value == Is &&
+                                                             !TypeSet<Visited...>::template kContains<Pending>)...>>::type;
+  using visited = typename Expand<Fresh>::visited;
+  using pending = typename Expand<Fresh>::pending;
+};
+
+template <typename Visited>
+struct Identity {
+  using type = Visited;
+};
+
+// Transitive closure of a relation, starting from the types in Pending.
+// Next<T>::type is the list of types directly related to T. The result lists each type once, in discovery order.
+template <typename Pending, template <typename> class Next, typename Visited = List<>>
+struct Closure {
+  // Eight levels per instantiation, as siblings rather than nested, so a long chain of states needs few nested
+  // Closure instantiations.
+  using L1 = ClosureLevel<Pending, Visited, Next>;
+  using L2 = ClosureLevel<typename L1::pending, typename L1::visited, Next>;
+  using L3 = ClosureLevel<typename L2::pending, typename L2::visited, Next>;
+  using L4 = ClosureLevel<typename L3::pending, typename L3::visited, Next>;
+  using L5 = ClosureLevel<typename L4::pending, typename L4::visited, Next>;
+  using L6 = ClosureLevel<typename L5::pending, typename L5::visited, Next>;
+  using L7 = ClosureLevel<typename L6::pending, typename L6::visited, Next>;
+  using L8 = ClosureLevel<typename L7::pending, typename L7::visited, Next>;
+  using type = typename std::conditional_t<Size<typename L8::pending>::value == 0, Identity<typename L8::visited>,
+                                           Closure<typename L8::pending, Next, typename L8::visited>>::type;
 };
 
 }  // namespace mp
@@ -121,7 +311,36 @@ enum class Result {
 struct with_args_t { explicit with_args_t() = default; };
 inline constexpr with_args_t with_args{};
 
+// What a bounded event queue does with an event that does not fit.
+enum class OverflowPolicy {
+  kAssert,      // Assert in debug builds, drop the new event otherwise.
+  kDropOldest,  // Drop the event that would be dispatched next to make room.
+  kDropNewest,  // Drop the new event.
+  kCallHook     // Hand the new event to the machine's OnQueueOverflow() and drop it.
+};
+
+// What PostEvent() does with an event whose type already has one pending in the posted queue, chosen per event type:
+//   FSM_EVENT(EvLevel) { static constexpr auto conflation = ufsm::Conflation::kKeepLatest; int level; };
+enum class Conflation {
+  kNone,        // Queue it as well.
+  kKeepLatest,  // Copy-assign it over the pending one, which keeps its place in the queue.
+  kMerge        // Merge it into the pending one with the pending event's `void Merge(const Ev& newer)`.
+};
+
+// A machine's event queues, as reported to its OnQueueHigh() and OnQueueLow() hooks.
+enum class QueueKind { kPosted, kDeferred };
+
+// Backpressure thresholds of a machine queue (see DefaultPolicy::kPostedWatermarks). When the queue grows to `high`
+// events the machine's OnQueueHigh() is called, and OnQueueLow() once it has drained back to `low`. A zero `high`
+// disables both.
+struct Watermarks {
+  std::size_t high = 0;
+  std::size_t low = 0;
+};
+
 // Forward declarations
+struct DefaultPolicy;
+
 template <class EventType>
 class Reaction;
 
@@ -131,12 +350,156 @@ class Transition;
 template <class EventType>
 class Deferral;
 
-template <typename Derived, typename InnerInitial>
+template <typename Derived, typename InnerInitial, typename Policy = DefaultPolicy>
 class StateMachine;
 
 template <typename Derived, typename ContextState, typename InnerInitial>
 class State;
 
+struct SojournRecord;
+
+namespace detail {
+struct AllocationTracker;
+struct BroadcastAccess;
+template <typename Ev>
+SojournRecord& SojournRecordOf() noexcept;
+}  // namespace detail
+
+// Allocation accounting.
+// Every heap allocation made by ufsm is reported: states on entry, event clones for the posted and deferred queues,
+// growth of DynamicEventQueue and hibernation images. NoAllocScope observes them in debug builds; per-type counters
+// (AllocationStats) are kept when UFSM_ALLOC_STATS is defined, and both work in any build with it.
+enum class AllocationKind { kState, kEvent, kQueue, kHibernation };
+
+// Allocations made for one type, linked into the list returned by AllocationStats::Records().
+struct AllocationRecord {
+  std::string_view name;
+  AllocationKind kind;
+  std::atomic<std::size_t> count{0};
+  std::atomic<std::size_t> bytes{0};
+  const AllocationRecord* next = nullptr;
+};
+
+class AllocationStats {
+ public:
+  // Records of every type that allocated at least once, most recent first.
+  static const AllocationRecord* Records() noexcept { return head_.load(std::memory_order_acquire); }
+
+  static std::size_t TotalCount() noexcept {
+    std::size_t total = 0;
+    for (auto* r = Records(); r; r = r->next) total += r->count.load(std::memory_order_relaxed);
+    return total;
+  }
+
+  static void Reset() noexcept {
+    for (auto* r = Records(); r; r = r->next) {
+      const_cast<AllocationRecord*>(r)->count.store(0, std::memory_order_relaxed);
+      const_cast<AllocationRecord*>(r)->bytes.store(0, std::memory_order_relaxed);
+    }
+  }
+
+ private:
+  friend struct detail::AllocationTracker;
+  static inline std::atomic<AllocationRecord*> head_{nullptr};
+};
+
+// Counts the allocations ufsm makes on this thread while alive, asserting on the first one unless constructed with
+// assert_on_allocation = false. Scopes nest; an allocation is reported to every enclosing scope.
+class NoAllocScope {
+ public:
+  explicit NoAllocScope(bool assert_on_allocation = true) noexcept
+      : outer_(innermost_), assert_on_allocation_(assert_on_allocation) {
+    innermost_ = this;
+  }
+  ~NoAllocScope() { innermost_ = outer_; }
+  NoAllocScope(const NoAllocScope&) = delete;
+  NoAllocScope& operator=(const NoAllocScope&) = delete;
+
+  std::size_t Allocations() const noexcept { return allocations_; }
+
+ private:
+  friend struct detail::AllocationTracker;
+  static inline thread_local NoAllocScope* innermost_ = nullptr;
+
+  NoAllocScope* outer_;
+  bool assert_on_allocation_;
+  std::size_t allocations_ = 0;
+};
+
+// Queue sojourn times.
+// With DefaultPolicy::kQueueSojourn, a machine stamps each event it queues and records how long it waited: in the
+// posted queue until dispatch, and in the deferred queue until released. Waits are kept per event type, summed over
+// all machines, in the list returned by SojournStats::Records().
+
+// Distribution of waits in power-of-two buckets: bucket i counts waits of less than 2^i ns (and at least 2^(i-1)).
+class SojournHistogram {
+ public:
+  static constexpr std::size_t kBuckets = 48;  // The last one takes everything from 2^46 ns (about 20 hours) on.
+
+  void Add(std::chrono::nanoseconds wait) noexcept {
+    std::uint64_t ns = wait.count() > 0 ? static_cast<std::uint64_t>(wait.count()) : 0;
+    std::size_t bucket = 0;
+    while (ns != 0 && bucket < kBuckets - 1) {
+      ns >>= 1;
+      ++bucket;
+    }
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  std::uint64_t Count() const noexcept {
+    std::uint64_t count = 0;
+    for (const auto& bucket : buckets_) count += bucket.load(std::memory_order_relaxed);
+    return count;
+  }
+
+  std::uint64_t Bucket(std::size_t i) const noexcept { return buckets_[i].load(std::memory_order_relaxed); }
+
+  // Upper bound of the wait of the sample at rank q (0..1), within a factor of two; zero without samples.
+  std::chrono::nanoseconds Quantile(double q) const noexcept {
+    const std::uint64_t count = Count();
+    if (count == 0) return std::chrono::nanoseconds(0);
+    const auto rank = static_cast<std::uint64_t>(q * static_cast<double>(count - 1));
+    std::uint64_t seen = 0;
+    std::size_t i = 0;
+    for (; i < kBuckets - 1; ++i)
+      if ((seen += Bucket(i)) > rank) break;
+    return std::chrono::nanoseconds(std::int64_t{1} << i);
+  }
+
+  void Reset() noexcept {
+    for (auto& bucket : buckets_) bucket.store(0, std::memory_order_relaxed);
+  }
+
+ private:
+  std::array<std::atomic<std::uint64_t>, kBuckets> buckets_{};
+};
+
+// Waits of one event type, linked into the list returned by SojournStats::Records().
+struct SojournRecord {
+  std::string_view name;
+  SojournHistogram posted;    // Posting (or release from the deferred queue) to dispatch.
+  SojournHistogram deferred;  // Deferral to release.
+  const SojournRecord* next = nullptr;
+};
+
+class SojournStats {
+ public:
+  // Records of every event type that waited in a queue at least once, most recent first.
+  static const SojournRecord* Records() noexcept { return head_.load(std::memory_order_acquire); }
+
+  static void Reset() noexcept {
+    for (auto* r = Records(); r; r = r->next) {
+      const_cast<SojournRecord*>(r)->posted.Reset();
+      const_cast<SojournRecord*>(r)->deferred.Reset();
+    }
+  }
+
+ private:
+  template <typename>
+  friend SojournRecord& detail::SojournRecordOf() noexcept;
+  static inline std::atomic<SojournRecord*> head_{nullptr};
+};
+
 namespace detail {
 
 // Helper to get a pretty type name for debugging.
@@ -162,6 +525,117 @@ constexpr std::string_view PrettyTypeName() {
 #endif
 }
 
+// Receives every allocation made by ufsm, see NoAllocScope and AllocationStats.
+struct AllocationTracker {
+  template <AllocationKind Kind, typename T>
+  static void Note([[maybe_unused]] std::size_t bytes) noexcept {
+#if !defined(NDEBUG) || defined(UFSM_ALLOC_STATS)
+    for (auto* scope = NoAllocScope::innermost_; scope; scope = scope->outer_) {
+      ++scope->allocations_;
+      UFSM_ASSERT(!scope->assert_on_allocation_ && "ufsm: allocation inside NoAllocScope");
+    }
+#endif
+#if defined(UFSM_ALLOC_STATS)
+    static AllocationRecord record{PrettyTypeName<T>(), Kind};
+    static const bool registered = Register(record);
+    (void)registered;
+    record.count.fetch_add(1, std::memory_order_relaxed);
+    record.bytes.fetch_add(bytes, std::memory_order_relaxed);
+#endif
+  }
+
+ private:
+  static bool Register(AllocationRecord& record) noexcept {
+    auto* head = AllocationStats::head_.load(std::memory_order_relaxed);
+    do {
+      record.next = head;
+    } while (!AllocationStats::head_.compare_exchange_weak(head, &record, std::memory_order_release,
+                                                           std::memory_order_relaxed));
+    return true;
+  }
+};
+
+// The SojournRecord of an event type, registered on first use.
+template <typename Ev>
+SojournRecord& SojournRecordOf() noexcept {
+  static SojournRecord record{PrettyTypeName<Ev>(), {}, {}};
+  static const bool registered = [] {
+    auto* head = SojournStats::head_.load(std::memory_order_relaxed);
+    do {
+      record.next = head;
+    } while (!SojournStats::head_.compare_exchange_weak(head, &record, std::memory_order_release,
+                                                        std::memory_order_relaxed));
+    return true;
+  }();
+  (void)registered;
+  return record;
+}
+
+// Per-thread free list of up to Capacity blocks for one state type.
+// Exiting a state parks its block here and entering the state again takes it back, so that steady-state transitions
+// do not allocate. The blocks are released when the thread exits.
+template <typename StateType, std::size_t Capacity>
+class StatePool {
+ public:
+  static void* Allocate() {
+    if constexpr (Capacity > 0) {
+      auto& blocks = Blocks();
+      if (blocks.count) return blocks.slots[--blocks.count];
+    }
+    AllocationTracker::Note<AllocationKind::kState, StateType>(sizeof(StateType));
+    return ::operator new(sizeof(StateType));
+  }
+
+  static void Free(void* block) noexcept {
+    if constexpr (Capacity > 0) {
+      auto& blocks = Blocks();
+      if (blocks.count < Capacity && !blocks.closed) {
+        blocks.slots[blocks.count++] = block;
+        return;
+      }
+    }
+    ::operator delete(block);
+  }
+
+  // Fill the pool of this thread.
+  static void Reserve() {
+    if constexpr (Capacity > 0) {
+      auto& blocks = Blocks();
+      while (blocks.count < Capacity) {
+        AllocationTracker::Note<AllocationKind::kState, StateType>(sizeof(StateType));
+        blocks.slots[blocks.count++] = ::operator new(sizeof(StateType));
+      }
+    }
+  }
+
+ private:
+  // Trivially destructible so that it stays usable while other thread_local and static objects are destroyed.
+  struct FreeList {
+    void* slots[Capacity > 0 ? Capacity : 1];
+    std::size_t count;
+    bool closed;
+  };
+
+  struct Drain {
+    ~Drain() {
+      auto& blocks = List();
+      blocks.closed = true;
+      while (blocks.count) ::operator delete(blocks.slots[--blocks.count]);
+    }
+  };
+
+  static FreeList& List() noexcept {
+    static thread_local FreeList list{};
+    return list;
+  }
+
+  static FreeList& Blocks() noexcept {
+    static thread_local Drain drain;
+    (void)drain;
+    return List();
+  }
+};
+
 // RAII helper to restore a variable's value on scope exit.
 template <class T>
 struct RestoreOnExit {
@@ -171,14 +645,25 @@ struct RestoreOnExit {
   ~RestoreOnExit() { slot = prev; }
 };
 
+// Constant per-type data of an event, one per event type; its address identifies the type.
+struct EventTypeInfo {
+  std::size_t size;
+  std::size_t align;
+  std::chrono::steady_clock::duration ttl;  // Longest wait in the deferred queue; zero for no limit.
+  SojournRecord& (*sojourn)() noexcept;     // Queue waits of the type.
+};
+
 // Base class for all events.
 class EventBase {
  public:
   using Ptr = std::unique_ptr<EventBase>;
   virtual ~EventBase() = default;
   const void* TypeId() const noexcept { return type_id_; }
+  const EventTypeInfo& TypeInfo() const noexcept { return *static_cast<const EventTypeInfo*>(type_id_); }
   virtual const char* Name() const noexcept { return "<ufsm::event>"; }
   virtual Ptr Clone() const = 0;
+  // Copy-construct the event into caller-provided storage. Returns nullptr if it does not fit.
+  virtual EventBase* CloneInto(void* storage, std::size_t size, std::size_t align) const = 0;
 
  protected:
   constexpr explicit EventBase(const void* type_id) noexcept : type_id_(type_id) {}
@@ -187,18 +672,39 @@ class EventBase {
   const void* type_id_;
 };
 
+class StateBase;
+
+// Constant per-type data of a state, one table per state type; its address identifies the type.
+struct StateDescriptor {
+  const char* (*name)() noexcept;
+  void (*exit)(StateBase& state);  // nullptr for states without OnExit()
+  std::uint32_t journal_id;        // The state's `journal_id` member, 0 without one (see ufsm/journal.h)
+};
+
+// A state's stable `static constexpr ufsm::WireId journal_id`, or 0 if it declares none.
+template <typename StateType, typename = void>
+inline constexpr std::uint32_t kStateJournalId = 0;
+
+template <typename StateType>
+inline constexpr std::uint32_t kStateJournalId<StateType, std::void_t<decltype(StateType::journal_id)>> =
+    StateType::journal_id;
+
 // Base class for all states.
+// Name, identity and exit go through the descriptor, so a state type adds only ReactImpl() and its destructor to the
+// code shared by all states.
 class StateBase {
  public:
-  virtual const char* Name() const noexcept { return "<ufsm::state>"; }
-  virtual void Exit() {}
+  const char* Name() const noexcept { return descriptor_->name(); }
+  const void* TypeId() const noexcept { return descriptor_; }
+  void Exit() {
+    if (descriptor_->exit) descriptor_->exit(*this);
+  }
   virtual ~StateBase() = default;
 
  protected:
-  StateBase() = default;
+  explicit StateBase(const StateDescriptor* descriptor) noexcept : descriptor_(descriptor) {}
 
   virtual Result ReactImpl(const EventBase& event) = 0;
-  virtual const void* TypeId() const noexcept = 0;
 
  private:
   std::size_t ActiveIndex() const noexcept { return active_index_; }
@@ -206,10 +712,164 @@ class StateBase {
 
   template <typename, typename, typename>
   friend class ::ufsm::State;
-  template <typename, typename>
+  template <typename, typename, typename>
   friend class ::ufsm::StateMachine;
+  friend class MachineCore;
 
+  const StateDescriptor* descriptor_;
   std::size_t active_index_ = 0;
+  bool deferred_flag_ = false;
+};
+
+// FIFO of owned events (a ring buffer, growing by doubling).
+// Storage is allocated on the first push, so machines that never queue events never allocate for it.
+class EventQueue {
+ public:
+  static constexpr OverflowPolicy kOverflow = OverflowPolicy::kAssert;
+  template <class Ev>
+  static constexpr bool kFits = true;
+
+  EventQueue() = default;
+  EventQueue(const EventQueue&) = delete;
+  EventQueue& operator=(const EventQueue&) = delete;
+
+  bool empty() const noexcept { return size_ == 0; }
+  bool full() const noexcept { return false; }  // Grows instead.
+  std::size_t size() const noexcept { return size_; }
+  EventBase& front() const noexcept { return *slots_[head_]; }
+  EventBase& back() const noexcept { return *slots_[Index(size_ - 1)]; }
+
+  bool push_back(const EventBase& event) { return push_back(event.Clone()); }
+  bool push_front(const EventBase& event) { return push_front(event.Clone()); }
+
+  bool push_back(EventBase::Ptr event) {
+    if (size_ == capacity_) Grow();
+    slots_[Index(size_++)] = std::move(event);
+    return true;
+  }
+
+  bool push_front(EventBase::Ptr event) {
+    if (size_ == capacity_) Grow();
+    head_ = (head_ + capacity_ - 1) & (capacity_ - 1);
+    slots_[head_] = std::move(event);
+    ++size_;
+    return true;
+  }
+
+  // Remove the next event, handing over its ownership.
+  EventBase::Ptr take_front() noexcept {
+    auto event = std::move(slots_[head_]);
+    head_ = (head_ + 1) & (capacity_ - 1);
+    --size_;
+    return event;
+  }
+
+  EventBase::Ptr take_back() noexcept { return std::move(slots_[Index(--size_)]); }
+
+  // The last queued event of a type, or nullptr.
+  EventBase* find_last(const void* type_id) const noexcept {
+    for (std::uint32_t i = size_; i-- > 0;)
+      if (slots_[Index(i)]->TypeId() == type_id) return slots_[Index(i)].get();
+    return nullptr;
+  }
+
+  void pop_front() noexcept { take_front(); }
+  void pop_back() noexcept { take_back(); }
+
+  void clear() noexcept {
+    while (!empty()) pop_back();
+    head_ = 0;
+  }
+
+  void reserve(std::size_t capacity) {
+    while (capacity_ < capacity) Grow();
+  }
+
+  // Release the storage of an empty queue.
+  void shrink_to_fit() noexcept {
+    if (!empty()) return;
+    slots_.reset();
+    head_ = capacity_ = 0;
+  }
+
+ private:
+  std::uint32_t Index(std::uint32_t offset) const noexcept { return (head_ + offset) & (capacity_ - 1); }
+
+  void Grow() {
+    std::uint32_t capacity = capacity_ ? capacity_ * 2 : 4;
+    AllocationTracker::Note<AllocationKind::kQueue, EventQueue>(capacity * sizeof(EventBase::Ptr));
+    auto slots = std::make_unique<EventBase::Ptr[]>(capacity);
+    for (std::uint32_t i = 0; i < size_; ++i) slots[i] = std::move(slots_[Index(i)]);
+    slots_ = std::move(slots);
+    head_ = 0;
+    capacity_ = capacity;
+  }
+
+  std::unique_ptr<EventBase::Ptr[]> slots_;
+  std::uint32_t head_ = 0;
+  std::uint32_t size_ = 0;
+  std::uint32_t capacity_ = 0;
+};
+
+// Type-independent part of StateMachine, shared by all machine types: the active path, outermost state first, and the
+// dispatch of events to the current state. The path's slots belong to the machine, which sizes them by its policy
+// and passes them in. Everything beyond the accessors is kept out of line, so one copy serves every machine type
+// instead of being inlined into each StateMachine<> instantiation.
+class MachineCore {
+ public:
+  using Path = std::unique_ptr<StateBase>*;
+
+  StateBase* CurrentState() const noexcept { return current_state_; }
+  const EventBase* CurrentEvent() const noexcept { return current_event_; }
+  std::size_t Depth() const noexcept { return depth_; }
+
+  // Append an entered state to the path. A leaf becomes the current state.
+  UFSM_NOINLINE void Push(Path path, std::unique_ptr<StateBase> state, bool leaf) noexcept {
+    state->SetActiveIndex(depth_);
+    if (leaf) current_state_ = state.get();
+    path[depth_++] = std::move(state);
+  }
+
+  // Exit and destroy the states deeper than n, innermost first.
+  // Returns whether one of them deferred events, which the machine then releases.
+  UFSM_NOINLINE bool ResetToDepth(Path path, std::size_t n) {
+    bool deferred = false;
+    while (depth_ > n) {
+      auto& state = path[depth_ - 1];
+      state->Exit();
+      deferred |= state->deferred_flag_;
+      path[--depth_].reset();
+    }
+    current_state_ = depth_ ? path[depth_ - 1].get() : nullptr;
+    return deferred;
+  }
+
+  // Depth to reset to for exiting `state` and the states below it, or only the states below it with `keep`.
+  UFSM_NOINLINE std::size_t DepthOf(Path path, const StateBase& state, bool keep) const noexcept {
+    auto idx = state.ActiveIndex();
+    UFSM_ASSERT(depth_ == 0 || (idx < depth_ && path[idx].get() == &state));
+    return idx < depth_ && path[idx].get() == &state ? idx + keep : 0;
+  }
+
+  // Destroy the states without exiting them, for hibernation.
+  UFSM_NOINLINE void Discard(Path path) noexcept {
+    while (depth_) {
+      path[depth_ - 1]->deferred_flag_ = false;
+      path[--depth_].reset();
+    }
+    current_state_ = nullptr;
+  }
+
+  // Let the current state react to an event.
+  UFSM_NOINLINE Result Dispatch(const EventBase& event) {
+    RestoreOnExit<const EventBase*> guard(current_event_, &event);
+    return current_state_ ? current_state_->ReactImpl(event) : Result::kForwardEvent;
+  }
+
+ private:
+  StateBase* current_state_ = nullptr;
+  const EventBase* current_event_ = nullptr;
+  std::size_t depth_ = 0;
 };
 
 // SFINAE check for OnUnhandledEvent method.
@@ -226,6 +886,46 @@ inline void InvokeOnUnhandledEventIfPresent(MachineType& machine, const EventBas
   if constexpr (HasOnUnhandledEventMethod<MachineType>::value) machine.OnUnhandledEvent(event);
 }
 
+// SFINAE check for OnQueueOverflow method.
+template <typename MachineType, typename = void>
+struct HasOnQueueOverflowMethod : std::false_type {};
+
+template <typename MachineType>
+struct HasOnQueueOverflowMethod<
+    MachineType, std::void_t<decltype(std::declval<MachineType&>().OnQueueOverflow(std::declval<const EventBase&>()))>>
+    : std::true_type {};
+
+// SFINAE check for OnDeferredEventDropped method.
+template <typename MachineType, typename = void>
+struct HasOnDeferredEventDroppedMethod : std::false_type {};
+
+template <typename MachineType>
+struct HasOnDeferredEventDroppedMethod<
+    MachineType,
+    std::void_t<decltype(std::declval<MachineType&>().OnDeferredEventDropped(std::declval<const EventBase&>()))>>
+    : std::true_type {};
+
+// SFINAE check for OnEventSojourn method.
+template <typename MachineType, typename = void>
+struct HasOnEventSojournMethod : std::false_type {};
+
+template <typename MachineType>
+struct HasOnEventSojournMethod<
+    MachineType, std::void_t<decltype(std::declval<MachineType&>().OnEventSojourn(
+                     QueueKind::kPosted, std::declval<const EventBase&>(), std::chrono::nanoseconds{}))>>
+    : std::true_type {};
+
+// SFINAE check for the OnQueueHigh and OnQueueLow methods, both required.
+template <typename MachineType, typename = void>
+struct HasQueueWatermarkHooks : std::false_type {};
+
+template <typename MachineType>
+struct HasQueueWatermarkHooks<
+    MachineType,
+    std::void_t<decltype(std::declval<MachineType&>().OnQueueHigh(QueueKind::kPosted, std::size_t{})),
+                decltype(std::declval<MachineType&>().OnQueueLow(QueueKind::kPosted, std::size_t{}))>>
+    : std::true_type {};
+
 // SFINAE check for OnEventProcessed method.
 template <typename MachineType, typename = void>
 struct HasOnEventProcessedMethod : std::false_type {};
@@ -236,50 +936,712 @@ struct HasOnEventProcessedMethod<
                      std::declval<const StateBase*>(), std::declval<const EventBase&>(), std::declval<Result>()))>>
     : std::true_type {};
 
-template <typename MachineType>
-inline void InvokeOnEventProcessedIfPresent(MachineType& machine, const StateBase* leaf_state, const EventBase& event,
-                                            Result result) {
-  if constexpr (HasOnEventProcessedMethod<MachineType>::value) machine.OnEventProcessed(leaf_state, event, result);
-}
+template <typename MachineType>
+inline void InvokeOnEventProcessedIfPresent(MachineType& machine, const StateBase* leaf_state, const EventBase& event,
+                                            Result result) {
+  if constexpr (HasOnEventProcessedMethod<MachineType>::value) machine.OnEventProcessed(leaf_state, event, result);
+}
+
+// SFINAE check for OnEntry method.
+template <typename StateType, typename = void>
+struct HasOnEntryMethod : std::false_type {};
+
+template <typename StateType>
+struct HasOnEntryMethod<StateType, std::void_t<decltype(std::declval<StateType&>().OnEntry())>> : std::true_type {};
+
+// SFINAE check for OnExit method.
+template <typename StateType, typename = void>
+struct HasOnExitMethod : std::false_type {};
+
+template <typename StateType>
+struct HasOnExitMethod<StateType, std::void_t<decltype(std::declval<StateType&>().OnExit())>> : std::true_type {};
+
+// SFINAE check for Persist method, used by hibernation to keep state data.
+template <typename StateType, typename = void>
+struct HasPersistMethod : std::false_type {};
+
+template <typename StateType>
+struct HasPersistMethod<StateType, std::void_t<decltype(std::declval<const StateType&>().Persist())>>
+    : std::true_type {};
+
+// Type of the data kept for a state while its machine is hibernated.
+struct NoPersistedData {};
+
+template <typename StateType, typename = void>
+struct PersistedType {
+  using type = NoPersistedData;
+};
+
+template <typename StateType>
+struct PersistedType<StateType, std::enable_if_t<HasPersistMethod<StateType>::value>> {
+  using type = std::decay_t<decltype(std::declval<const StateType&>().Persist())>;
+};
+
+// Check whether a state can be rebuilt from its persisted data alone (i.e. without Transit arguments).
+template <typename StateType, typename... Args>
+inline constexpr bool kConstructibleInContext =
+    std::is_constructible_v<StateType, typename StateType::ContextPtrType, Args...> ||
+    std::is_constructible_v<StateType, Args...>;
+
+template <typename StateType>
+inline constexpr bool kRestorable = HasPersistMethod<StateType>::value
+                                        ? kConstructibleInContext<StateType, typename PersistedType<StateType>::type&&>
+                                        : kConstructibleInContext<StateType>;
+
+template <typename PathList>
+inline constexpr bool kRestorablePath = false;
+
+template <typename... States>
+inline constexpr bool kRestorablePath<mp::List<States...>> = (kRestorable<States> && ...);
+
+// Types the declarative reactions of a state refer to: events and destination states.
+template <typename ReactionType>
+struct ReactionTypes {
+  using type = mp::List<>;
+};
+
+template <typename EventType>
+struct ReactionTypes<Reaction<EventType>> {
+  using type = mp::List<EventType>;
+};
+
+template <typename EventType, typename DestState, typename Action>
+struct ReactionTypes<Transition<EventType, DestState, Action>> {
+  using type = mp::List<EventType, DestState>;
+};
+
+template <typename EventType>
+struct ReactionTypes<Deferral<EventType>> {
+  using type = mp::List<EventType>;
+};
+
+template <>
+struct ReactionTypes<Deferral<EventBase>> {
+  using type = mp::List<>;
+};
+
+template <typename ReactionList>
+struct ReactionListTypes;
+
+template <typename... Reactions>
+struct ReactionListTypes<mp::List<Reactions...>> {
+  using type = typename mp::Concat<typename ReactionTypes<Reactions>::type...>::type;
+};
+
+template <typename T>
+using IsState = std::is_base_of<StateBase, T>;
+
+// States and events directly reachable from a type: for a state, its initial substate, its ancestors and the types
+// its reactions refer to. Events lead nowhere.
+template <typename T, typename = void>
+struct ReachableFrom {
+  using type = mp::List<>;
+};
+
+template <typename StateType>
+struct ReachableFrom<StateType, std::enable_if_t<IsState<StateType>::value>> {
+  using InnerInitialList =
+      std::conditional_t<std::is_void_v<typename StateType::InnerInitialType>, mp::List<>,
+                         mp::List<typename StateType::InnerInitialType>>;
+  using type = typename mp::Concat<InnerInitialList,
+                                   typename mp::Filter<typename StateType::ContextTypeList, IsState>::type,
+                                   typename ReactionListTypes<typename StateType::reactions>::type>::type;
+};
+
+// Helper to construct a chain of states.
+// Constructs the states in list order, each inside the previous one (the first inside `context_ptr`), in a single
+// fold rather than one instantiation per level. Only the last state gets the factory and drills down to its initial
+// substates.
+template <typename ContextList, typename OutermostContext>
+struct Constructor;
+
+template <typename... States, typename OutermostContext>
+struct Constructor<mp::List<States...>, OutermostContext> {
+  using Last = typename mp::At<mp::List<States...>, sizeof...(States) - 1>::type;
+
+  template <typename ContextPtr, typename Factory = std::nullptr_t>
+  static void Construct(const ContextPtr& context_ptr, OutermostContext& state_machine, Factory&& factory = nullptr) {
+    // The states of a path are distinct, each is the context of the next, so the pointer can travel untyped.
+    void* context = context_ptr;
+    (..., (context = Step<States>(context, state_machine, factory)));
+  }
+
+ private:
+  template <typename StateType, typename Factory>
+  static void* Step(void* context, OutermostContext& state_machine, Factory& factory) {
+    auto* parent = static_cast<typename StateType::ContextPtrType>(context);
+    if constexpr (std::is_same_v<StateType, Last> && !std::is_same_v<std::decay_t<Factory>, std::nullptr_t>) {
+      StateType::DeepConstruct(parent, state_machine, std::forward<Factory>(factory));
+      return nullptr;
+    } else {
+      static_assert(kConstructibleInContext<StateType>, "State requires constructor arguments. Use TransitWithArgs().");
+      if constexpr (std::is_same_v<StateType, Last>) {
+        StateType::DeepConstruct(parent, state_machine);
+        return nullptr;
+      } else {
+        return StateType::ShallowConstruct(parent, state_machine);
+      }
+    }
+  }
+};
+
+// Helper to build the context list for a transition.
+// Constructs the list of states that need to be entered to reach DestState from CurrentContext.
+template <class CurrentContext, class DestState>
+struct MakeContextList {
+  using type = typename mp::PushBack<typename mp::BuildPath<typename DestState::ContextTypeList, CurrentContext>::type,
+                                     DestState>::type;
+};
+
+}  // namespace detail
+
+// Unbounded event queue, allocated on first use.
+using DynamicEventQueue = detail::EventQueue;
+
+// Bounded event queue with inline storage and no heap allocation.
+// Each of the Capacity slots is sized for the largest of Events; posting an event type that does not fit is a
+// compile-time error. Overflow decides what happens to an event pushed into a full queue.
+template <std::size_t Capacity, OverflowPolicy Overflow, typename... Events>
+class FixedEventQueue {
+  static_assert(Capacity > 0, "FixedEventQueue needs at least one slot");
+  static_assert(sizeof...(Events) > 0, "FixedEventQueue needs the event types it stores to size its slots");
+
+  struct Entry {
+    detail::EventBase* event;
+    std::uint32_t slot;
+  };
+
+ public:
+  static constexpr OverflowPolicy kOverflow = Overflow;
+  static constexpr std::size_t kCapacity = Capacity;
+  static constexpr std::size_t kSlotSize = std::max({sizeof(Events)...});
+  static constexpr std::size_t kSlotAlign = std::max({alignof(Events)...});
+  template <class Ev>
+  static constexpr bool kFits = sizeof(Ev) <= kSlotSize && alignof(Ev) <= kSlotAlign;
+
+  // An event removed from the queue; its slot is recycled when this goes out of scope.
+  class Taken {
+   public:
+    Taken(FixedEventQueue& queue, Entry entry) noexcept : queue_(queue), entry_(entry) {}
+    Taken(const Taken&) = delete;
+    Taken& operator=(const Taken&) = delete;
+    ~Taken() { queue_.Release(entry_); }
+    detail::EventBase& operator*() const noexcept { return *entry_.event; }
+
+   private:
+    FixedEventQueue& queue_;
+    Entry entry_;
+  };
+
+  FixedEventQueue() noexcept {
+    for (std::uint32_t i = 0; i < kSlots; ++i) free_[i] = i;
+  }
+  FixedEventQueue(const FixedEventQueue&) = delete;
+  FixedEventQueue& operator=(const FixedEventQueue&) = delete;
+  ~FixedEventQueue() { clear(); }
+
+  bool empty() const noexcept { return size_ == 0; }
+  bool full() const noexcept { return size_ == Capacity; }
+  std::size_t size() const noexcept { return size_; }
+  detail::EventBase& front() const noexcept { return *ring_[head_].event; }
+  detail::EventBase& back() const noexcept { return *ring_[Index(size_ - 1)].event; }
+
+  // Copy an event into the queue. Returns false if it was dropped.
+  bool push_back(const detail::EventBase& event) {
+    Entry entry;
+    if (!Store(event, entry)) return false;
+    ring_[Index(size_++)] = entry;
+    return true;
+  }
+
+  bool push_front(const detail::EventBase& event) {
+    Entry entry;
+    if (!Store(event, entry)) return false;
+    head_ = (head_ + Capacity - 1) % Capacity;
+    ring_[head_] = entry;
+    ++size_;
+    return true;
+  }
+
+  Taken take_front() noexcept {
+    Entry entry = ring_[head_];
+    head_ = (head_ + 1) % Capacity;
+    --size_;
+    return Taken(*this, entry);
+  }
+
+  void pop_front() noexcept { take_front(); }
+  void pop_back() noexcept { Release(ring_[Index(--size_)]); }
+
+  // The last queued event of a type, or nullptr.
+  detail::EventBase* find_last(const void* type_id) const noexcept {
+    for (std::uint32_t i = size_; i-- > 0;)
+      if (ring_[Index(i)].event->TypeId() == type_id) return ring_[Index(i)].event;
+    return nullptr;
+  }
+
+  void clear() noexcept {
+    while (!empty()) pop_back();
+    head_ = 0;
+  }
+
+  void reserve(std::size_t) noexcept {}
+  void shrink_to_fit() noexcept {}
+
+ private:
+  // One slot more than the ring holds, for the event being dispatched after take_front().
+  static constexpr std::uint32_t kSlots = Capacity + 1;
+
+  struct alignas(kSlotAlign) Slot {
+    unsigned char bytes[kSlotSize];
+  };
+
+  std::uint32_t Index(std::size_t offset) const noexcept { return (head_ + offset) % Capacity; }
+
+  bool Store(const detail::EventBase& event, Entry& entry) {
+    if (size_ == Capacity) {
+      if constexpr (Overflow == OverflowPolicy::kDropOldest) {
+        pop_front();
+      } else {
+        if constexpr (Overflow == OverflowPolicy::kAssert) UFSM_ASSERT(false && "ufsm: event queue overflow");
+        return false;
+      }
+    }
+    entry.slot = free_[--free_count_];
+    entry.event = event.CloneInto(&slots_[entry.slot], kSlotSize, kSlotAlign);
+    if (!entry.event) {
+      free_[free_count_++] = entry.slot;
+      UFSM_ASSERT(false && "ufsm: event does not fit the queue slot");
+      return false;
+    }
+    return true;
+  }
+
+  void Release(const Entry& entry) noexcept {
+    entry.event->~EventBase();
+    free_[free_count_++] = entry.slot;
+  }
+
+  std::array<Slot, kSlots> slots_;
+  std::array<Entry, Capacity> ring_;
+  std::array<std::uint32_t, kSlots> free_;
+  std::uint32_t free_count_ = kSlots;
+  std::uint32_t head_ = 0;
+  std::uint32_t size_ = 0;
+};
+
+// Bounded posted-event queue with Lanes priority lanes, each a FixedEventQueue<Capacity, Overflow, Events...>.
+// take_front() serves the highest non-empty lane, in push order within a lane. Pushes without a lane, including the
+// deferred events a machine releases, use lane 0, the lowest. Overflow applies to the lane pushed to.
+template <std::size_t Lanes, std::size_t Capacity, OverflowPolicy Overflow, typename... Events>
+class PriorityEventQueue {
+  static_assert(Lanes > 0, "PriorityEventQueue needs at least one lane");
+  using Lane = FixedEventQueue<Capacity, Overflow, Events...>;
+
+ public:
+  static constexpr std::size_t kLanes = Lanes;
+  static constexpr OverflowPolicy kOverflow = Overflow;
+  static constexpr std::size_t kCapacity = Capacity;  // Per lane.
+  template <class Ev>
+  static constexpr bool kFits = Lane::template kFits<Ev>;
+  using Taken = typename Lane::Taken;
+
+  bool empty() const noexcept {
+    for (const auto& lane : lanes_)
+      if (!lane.empty()) return false;
+    return true;
+  }
+  std::size_t size() const noexcept {
+    std::size_t size = 0;
+    for (const auto& lane : lanes_) size += lane.size();
+    return size;
+  }
+  std::size_t size(std::size_t lane) const noexcept { return lanes_[lane].size(); }
+  std::size_t front_lane() const noexcept { return Highest(); }
+  bool full(std::size_t lane = 0) const noexcept { return lanes_[lane].full(); }
+  detail::EventBase& front() const noexcept { return lanes_[Highest()].front(); }
+  detail::EventBase& back() const noexcept { return lanes_[Lowest()].back(); }
+
+  // Copy an event into a lane. Returns false if it was dropped.
+  bool push_back(const detail::EventBase& event, std::size_t lane = 0) {
+    UFSM_ASSERT(lane < Lanes);
+    return lanes_[lane].push_back(event);
+  }
+  bool push_front(const detail::EventBase& event, std::size_t lane = 0) {
+    UFSM_ASSERT(lane < Lanes);
+    return lanes_[lane].push_front(event);
+  }
+
+  Taken take_front() noexcept { return lanes_[Highest()].take_front(); }
+
+  // The last event of a type queued in a lane, or nullptr.
+  detail::EventBase* find_last(const void* type_id, std::size_t lane = 0) const noexcept {
+    return lanes_[lane].find_last(type_id);
+  }
+  void pop_front() noexcept { lanes_[Highest()].pop_front(); }
+  void pop_back() noexcept { lanes_[Lowest()].pop_back(); }
+
+  void clear() noexcept {
+    for (auto& lane : lanes_) lane.clear();
+  }
+
+  void reserve(std::size_t) noexcept {}
+  void shrink_to_fit() noexcept {}
+
+ private:
+  std::size_t Highest() const noexcept {
+    std::size_t lane = Lanes - 1;
+    while (lane > 0 && lanes_[lane].empty()) --lane;
+    return lane;
+  }
+  std::size_t Lowest() const noexcept {
+    std::size_t lane = 0;
+    while (lane < Lanes - 1 && lanes_[lane].empty()) ++lane;
+    return lane;
+  }
+
+  std::array<Lane, Lanes> lanes_;
+};
+
+// Unbounded posted-event queue that copies events into a scratch arena of ArenaBytes instead of the heap.
+// The arena is bump-allocated and starts over in O(1) once every event in it has been dispatched, which the event
+// loop guarantees when it returns: events posted and consumed within one run-to-completion step cost no allocation.
+// A deferred event is copied into the deferred queue, so none outlives its step. Events that do not fit what is left
+// of the arena are cloned to the heap. The entry ring and the arena are allocated on the first push and kept.
+template <std::size_t ArenaBytes>
+class ScratchEventQueue {
+  static_assert(ArenaBytes > 0, "ScratchEventQueue needs an arena");
+
+  struct Entry {
+    detail::EventBase* event;
+    bool scratch;  // In the arena: destroyed in place, not deleted.
+  };
+
+ public:
+  static constexpr OverflowPolicy kOverflow = OverflowPolicy::kAssert;
+  template <class Ev>
+  static constexpr bool kFits = true;
+
+  // An event removed from the queue; it is destroyed when this goes out of scope.
+  class Taken {
+   public:
+    Taken(ScratchEventQueue& queue, Entry entry) noexcept : queue_(queue), entry_(entry) {}
+    Taken(const Taken&) = delete;
+    Taken& operator=(const Taken&) = delete;
+    ~Taken() { queue_.Release(entry_); }
+    detail::EventBase& operator*() const noexcept { return *entry_.event; }
+
+   private:
+    ScratchEventQueue& queue_;
+    Entry entry_;
+  };
+
+  ScratchEventQueue() = default;
+  ScratchEventQueue(const ScratchEventQueue&) = delete;
+  ScratchEventQueue& operator=(const ScratchEventQueue&) = delete;
+  ~ScratchEventQueue() { clear(); }
+
+  bool empty() const noexcept { return size_ == 0; }
+  bool full() const noexcept { return false; }  // Grows instead.
+  std::size_t size() const noexcept { return size_; }
+  detail::EventBase& front() const noexcept { return *ring_[head_].event; }
+  detail::EventBase& back() const noexcept { return *ring_[Index(size_ - 1)].event; }
+  // Bytes of the arena in use by queued (or dispatching) events.
+  std::size_t arena_used() const noexcept { return used_; }
+
+  bool push_back(const detail::EventBase& event) {
+    if (size_ == capacity_) Grow();
+    ring_[Index(size_++)] = Store(event);
+    return true;
+  }
+
+  bool push_front(const detail::EventBase& event) {
+    if (size_ == capacity_) Grow();
+    head_ = Index(capacity_ - 1);
+    ring_[head_] = Store(event);
+    ++size_;
+    return true;
+  }
+
+  Taken take_front() noexcept {
+    Entry entry = ring_[head_];
+    head_ = Index(1);
+    --size_;
+    return Taken(*this, entry);
+  }
+
+  // The last queued event of a type, or nullptr.
+  detail::EventBase* find_last(const void* type_id) const noexcept {
+    for (std::size_t i = size_; i-- > 0;)
+      if (ring_[Index(i)].event->TypeId() == type_id) return ring_[Index(i)].event;
+    return nullptr;
+  }
+
+  void pop_front() noexcept { take_front(); }
+  void pop_back() noexcept { Release(ring_[Index(--size_)]); }
+
+  void clear() noexcept {
+    while (!empty()) pop_back();
+    head_ = 0;
+  }
+
+  void reserve(std::size_t capacity) {
+    while (capacity_ < capacity) Grow();
+  }
+
+  // Release the storage of an empty queue.
+  void shrink_to_fit() noexcept {
+    if (!empty() || live_ != 0) return;
+    ring_.reset();
+    arena_.reset();
+    head_ = capacity_ = 0;
+  }
+
+ private:
+  static constexpr std::size_t kArenaAlign = alignof(std::max_align_t);
+
+  std::size_t Index(std::size_t offset) const noexcept { return (head_ + offset) & (capacity_ - 1); }
+
+  Entry Store(const detail::EventBase& event) {
+    const detail::EventTypeInfo& info = event.TypeInfo();
+    const std::size_t offset = (used_ + info.align - 1) & ~(info.align - 1);
+    if (info.align <= kArenaAlign && offset + info.size <= ArenaBytes) {
+      auto* storage = reinterpret_cast<unsigned char*>(arena_.get()) + offset;
+      used_ = offset + info.size;
+      ++live_;
+      return {event.CloneInto(storage, info.size, info.align), true};
+    }
+    return {event.Clone().release(), false};
+  }
+
+  void Release(const Entry& entry) noexcept {
+    if (!entry.scratch) {
+      delete entry.event;
+      return;
+    }
+    entry.event->~EventBase();
+    if (--live_ == 0) used_ = 0;
+  }
+
+  void Grow() {
+    if (!arena_) {
+      detail::AllocationTracker::Note<AllocationKind::kQueue, ScratchEventQueue>(ArenaBytes);
+      arena_ = std::make_unique<std::max_align_t[]>((ArenaBytes + sizeof(std::max_align_t) - 1) /
+                                                    sizeof(std::max_align_t));
+    }
+    std::size_t capacity = capacity_ ? capacity_ * 2 : 4;
+    detail::AllocationTracker::Note<AllocationKind::kQueue, ScratchEventQueue>(capacity * sizeof(Entry));
+    auto ring = std::make_unique<Entry[]>(capacity);
+    for (std::size_t i = 0; i < size_; ++i) ring[i] = ring_[Index(i)];
+    ring_ = std::move(ring);
+    head_ = 0;
+    capacity_ = capacity;
+  }
+
+  std::unique_ptr<Entry[]> ring_;
+  std::unique_ptr<std::max_align_t[]> arena_;
+  std::size_t head_ = 0;
+  std::size_t size_ = 0;
+  std::size_t capacity_ = 0;
+  std::size_t used_ = 0;  // Arena bytes handed out since it last started over.
+  std::size_t live_ = 0;  // Events in the arena, queued or taken.
+};
+
+namespace detail {
+
+// Priority lanes of a posted-event queue: PriorityEventQueue::kLanes, or 0 for queues without lanes.
+template <typename Queue, typename = void>
+inline constexpr std::size_t kQueueLanes = 0;
+
+template <typename Queue>
+inline constexpr std::size_t kQueueLanes<Queue, std::void_t<decltype(Queue::kLanes)>> = Queue::kLanes;
+
+// Conflation of an event type: its `conflation` member, or Conflation::kNone.
+template <typename Ev, typename = void>
+inline constexpr Conflation kConflation = Conflation::kNone;
+
+template <typename Ev>
+inline constexpr Conflation kConflation<Ev, std::void_t<decltype(Ev::conflation)>> = Ev::conflation;
+
+// Capacity of a bounded queue: FixedEventQueue::kCapacity, or 0 for queues that grow.
+template <typename Queue, typename = void>
+inline constexpr std::size_t kQueueCapacity = 0;
+
+template <typename Queue>
+inline constexpr std::size_t kQueueCapacity<Queue, std::void_t<decltype(Queue::kCapacity)>> = Queue::kCapacity;
+
+// Time to live of an event type in the deferred queue: its `ttl` member (any std::chrono duration), or zero.
+template <typename Ev, typename = void>
+inline constexpr std::chrono::steady_clock::duration kEventTtl{};
+
+template <typename Ev>
+inline constexpr std::chrono::steady_clock::duration kEventTtl<Ev, std::void_t<decltype(Ev::ttl)>> =
+    std::chrono::duration_cast<std::chrono::steady_clock::duration>(Ev::ttl);
+
+// Time points kept in step with the events of a queue (deadlines, enqueue times): inline for a queue of Capacity
+// events, growing by doubling for 0. earliest() is a lower bound of the time points, exact after pushes alone.
+template <std::size_t Capacity>
+class TimeRing {
+ public:
+  using TimePoint = std::chrono::steady_clock::time_point;
+
+  std::size_t size() const noexcept { return size_; }
+  TimePoint front() const noexcept { return slots_[head_]; }
+  TimePoint back() const noexcept { return slots_[Index(size_ - 1)]; }
+  TimePoint earliest() const noexcept { return earliest_; }
+
+  void push_back(TimePoint time) {
+    if constexpr (Capacity == 0) {
+      if (size_ == capacity_) Grow();
+    }
+    UFSM_ASSERT(size_ < capacity_);
+    slots_[Index(size_++)] = time;
+    earliest_ = std::min(earliest_, time);
+  }
+  void push_front(TimePoint time) {
+    if constexpr (Capacity == 0) {
+      if (size_ == capacity_) Grow();
+    }
+    UFSM_ASSERT(size_ < capacity_);
+    head_ = Index(capacity_ - 1);
+    slots_[head_] = time;
+    ++size_;
+    earliest_ = std::min(earliest_, time);
+  }
+  void pop_front() noexcept {
+    head_ = Index(1);
+    if (--size_ == 0) reset_earliest();
+  }
+  void pop_back() noexcept {
+    if (--size_ == 0) reset_earliest();
+  }
+  void clear() noexcept {
+    head_ = size_ = 0;
+    reset_earliest();
+  }
+  // Forget the earliest time point, before pushing back the ones kept by a sweep.
+  void reset_earliest() noexcept { earliest_ = TimePoint::max(); }
+
+ private:
+  std::size_t Index(std::size_t offset) const noexcept { return (head_ + offset) % capacity_; }
+
+  void Grow() {
+    std::size_t capacity = capacity_ ? capacity_ * 2 : 4;
+    AllocationTracker::Note<AllocationKind::kQueue, TimeRing>(capacity * sizeof(TimePoint));
+    auto slots = std::make_unique<TimePoint[]>(capacity);
+    for (std::size_t i = 0; i < size_; ++i) slots[i] = slots_[Index(i)];
+    slots_ = std::move(slots);
+    head_ = 0;
+    capacity_ = capacity;
+  }
+
+  std::conditional_t<Capacity == 0, std::unique_ptr<TimePoint[]>, std::array<TimePoint, Capacity>> slots_{};
+  std::size_t head_ = 0;
+  std::size_t size_ = 0;
+  std::size_t capacity_ = Capacity;
+  TimePoint earliest_ = TimePoint::max();
+};
 
-// SFINAE check for OnEntry method.
-template <typename StateType, typename = void>
-struct HasOnEntryMethod : std::false_type {};
+// Stands in for a member a policy leaves out.
+struct Disabled {};
 
-template <typename StateType>
-struct HasOnEntryMethod<StateType, std::void_t<decltype(std::declval<StateType&>().OnEntry())>> : std::true_type {};
+}  // namespace detail
 
-// SFINAE check for OnExit method.
-template <typename StateType, typename = void>
-struct HasOnExitMethod : std::false_type {};
+// Compile-time configuration of a state machine, passed as the third StateMachine argument.
+// Override members by inheriting:
+//   struct SessionPolicy : ufsm::DefaultPolicy { static constexpr std::size_t kMaxDepth = 3; };
+//   struct Session : ufsm::StateMachine<Session, Idle, SessionPolicy> {};
+struct DefaultPolicy {
+  // Capacity of the active state path, stored inline in the machine.
+  // Entering a state nested deeper than this is a compile-time error. It cannot be derived from the hierarchy: the
+  // states are still incomplete where the machine class, and so its members, are instantiated.
+  static constexpr std::size_t kMaxDepth = 8;
+
+  // Queues for posted and deferred events: DynamicEventQueue, FixedEventQueue<...>, or for posted events
+  // PriorityEventQueue<...> and ScratchEventQueue<...>.
+  using PostedQueue = DynamicEventQueue;
+  using DeferredQueue = DynamicEventQueue;
+
+  // Backpressure on the posted and deferred queues: crossing a watermark calls the machine's
+  //   void OnQueueHigh(ufsm::QueueKind queue, std::size_t depth);
+  //   void OnQueueLow(ufsm::QueueKind queue, std::size_t depth);
+  // and TryPostEvent() refuses events while the posted queue is at its high watermark. {} disables them.
+  static constexpr Watermarks kPostedWatermarks{};
+  static constexpr Watermarks kDeferredWatermarks{};
+
+  // Aging of deferred events. With kDeferredTtl, an event whose type has a `ttl` member (a std::chrono duration) is
+  // dropped instead of replayed once it has been deferred that long. Deferring more than kMaxDeferred events drops
+  // the oldest one first; 0 is no limit. Dropped events go to the machine's optional
+  //   void OnDeferredEventDropped(const ufsm::detail::EventBase& event);
+  static constexpr bool kDeferredTtl = false;
+  static constexpr std::size_t kMaxDeferred = 0;
+
+  // Stamp queued events with their enqueue time and record how long each waited in the posted and in the deferred
+  // queue, per event type (see SojournStats), and in the machine's optional
+  //   void OnEventSojourn(ufsm::QueueKind queue, const ufsm::detail::EventBase& event, std::chrono::nanoseconds wait);
+  static constexpr bool kQueueSojourn = false;
+
+  // Freed state blocks kept per state type and thread, so that entering a state again reuses memory instead of
+  // allocating. 0 returns them to the heap. WarmUp() fills the pools of every reachable state.
+  static constexpr std::size_t kStatePoolSize = 0;
+};
 
-template <typename StateType>
-struct HasOnExitMethod<StateType, std::void_t<decltype(std::declval<StateType&>().OnExit())>> : std::true_type {};
+// Bytes carried by an event without copying them: borrowed from the caller, or shared through a refcounted owner.
+// An event type holding a Payload defines `Ev Own() const` returning a copy with `payload.Own()`; queues store that
+// copy, so dispatching the event directly reads the caller's bytes, and deferring or posting it keeps them alive.
+//   FSM_EVENT(EvPacket) {
+//     ufsm::Payload payload;
+//     EvPacket Own() const { return EvPacket{payload.Own()}; }
+//   };
+class Payload {
+ public:
+  Payload() = default;
 
-// Helper to construct a chain of states.
-// Recursively constructs states from Head to Tail.
-template <typename ContextList, typename OutermostContext>
-struct Constructor;
+  // Bytes valid for as long as the caller keeps them, at least for the ProcessEvent() call.
+  static Payload Borrow(const void* data, std::size_t size) noexcept { return Payload(data, size, nullptr); }
+  static Payload Borrow(std::string_view bytes) noexcept { return Borrow(bytes.data(), bytes.size()); }
 
-template <typename Head, typename... Tail, typename OutermostContext>
-struct Constructor<mp::List<Head, Tail...>, OutermostContext> {
-  template <typename ContextPtr, typename Factory = std::nullptr_t>
-  static void Construct(const ContextPtr& context_ptr, OutermostContext& state_machine, Factory&& factory = nullptr) {
-    if constexpr (sizeof...(Tail) == 0)
-      Head::DeepConstruct(context_ptr, state_machine, std::forward<Factory>(factory));  // Pass factory only to final state
-    else
-      Constructor<mp::List<Tail...>, OutermostContext>::Construct(Head::ShallowConstruct(context_ptr, state_machine), state_machine, std::forward<Factory>(factory));
+  // Bytes kept alive by `owner` (a refcounted buffer handle); Own() copies the handle instead of the bytes.
+  static Payload Share(std::shared_ptr<const void> owner, const void* data, std::size_t size) noexcept {
+    return Payload(data, size, std::move(owner));
   }
-};
 
-// Helper to build the context list for a transition.
-// Constructs the list of states that need to be entered to reach DestState from CurrentContext.
-template <class CurrentContext, class DestState>
-struct MakeContextList {
-  using type = typename mp::PushBack<typename mp::BuildPath<typename DestState::ContextTypeList, CurrentContext>::type,
-                                     DestState>::type;
+  const unsigned char* data() const noexcept { return data_; }
+  std::size_t size() const noexcept { return size_; }
+  bool empty() const noexcept { return size_ == 0; }
+  std::string_view view() const noexcept { return {reinterpret_cast<const char*>(data_), size_}; }
+  // Whether the bytes are kept alive by the payload itself.
+  bool owned() const noexcept { return owner_ != nullptr || size_ == 0; }
+
+  // A payload that stays valid without the caller's buffer: sharing the owner, or a copy of borrowed bytes.
+  Payload Own() const {
+    if (owned()) return *this;
+    detail::AllocationTracker::Note<AllocationKind::kEvent, Payload>(size_);
+    std::shared_ptr<unsigned char[]> bytes(new unsigned char[size_]);
+    std::memcpy(bytes.get(), data_, size_);
+    const unsigned char* data = bytes.get();
+    return Payload(data, size_, std::move(bytes));
+  }
+
+ private:
+  Payload(const void* data, std::size_t size, std::shared_ptr<const void> owner) noexcept
+      : data_(static_cast<const unsigned char*>(data)), size_(size), owner_(std::move(owner)) {}
+
+  const unsigned char* data_ = nullptr;
+  std::size_t size_ = 0;
+  std::shared_ptr<const void> owner_;
 };
 
+namespace detail {
+
+// Whether an event type makes its queued copies with `Ev Own() const` (see Payload).
+template <typename Ev, typename = void>
+inline constexpr bool kHasOwn = false;
+
+template <typename Ev>
+inline constexpr bool kHasOwn<Ev, std::void_t<decltype(std::declval<const Ev&>().Own())>> =
+    std::is_same_v<decltype(std::declval<const Ev&>().Own()), Ev>;
+
 }  // namespace detail
 
 // CRTP base class for events.
@@ -289,12 +1651,23 @@ class Event : public detail::EventBase {
   Event() noexcept : detail::EventBase(StaticTypeId()) {
     static_assert(std::is_base_of_v<Event, Derived>, "Derived event must inherit from ufsm::Event<Derived>");
   }
-  const char* Name() const noexcept override {
-    static const std::string name{detail::PrettyTypeName<Derived>()};
-    return name.c_str();
-  }
+  const char* Name() const noexcept override { return StaticName(); }
   detail::EventBase::Ptr Clone() const override {
-    return detail::EventBase::Ptr(new Derived(static_cast<const Derived&>(*this)));
+    detail::AllocationTracker::Note<AllocationKind::kEvent, Derived>(sizeof(Derived));
+    return detail::EventBase::Ptr(new Derived(Owned()));
+  }
+  detail::EventBase* CloneInto(void* storage, std::size_t size, std::size_t align) const override {
+    if (sizeof(Derived) > size || alignof(Derived) > align) return nullptr;
+    return new (storage) Derived(Owned());
+  }
+
+  // The copy of the event that a queue keeps: Derived::Own() for events borrowing their data, a plain copy otherwise.
+  decltype(auto) Owned() const {
+    if constexpr (detail::kHasOwn<Derived>) {
+      return static_cast<const Derived&>(*this).Own();
+    } else {
+      return static_cast<const Derived&>(*this);
+    }
   }
 
  private:
@@ -304,9 +1677,16 @@ class Event : public detail::EventBase {
   friend class ::ufsm::Transition;
   template <class>
   friend class ::ufsm::Deferral;
+  template <typename, typename, typename>
+  friend class ::ufsm::StateMachine;
   static const void* StaticTypeId() noexcept {
-    static const int tag = 0;
-    return &tag;
+    static constexpr detail::EventTypeInfo info{sizeof(Derived), alignof(Derived), detail::kEventTtl<Derived>,
+                                                &detail::SojournRecordOf<Derived>};
+    return &info;
+  }
+  static const char* StaticName() noexcept {
+    static const std::string name{detail::PrettyTypeName<Derived>()};
+    return name.c_str();
   }
 };
 
@@ -398,13 +1778,41 @@ class State : public detail::StateBase {
     OutermostContext().PostEvent(std::forward<Ev>(event));
   }
 
+  // Post an event to a priority lane of the queue.
+  template <class Ev>
+  void PostEvent(Ev&& event, std::size_t priority) {
+    OutermostContext().PostEvent(std::forward<Ev>(event), priority);
+  }
+
+  // Post an event unless the queue is full or at its high watermark.
+  template <class Ev>
+  [[nodiscard]] bool TryPostEvent(Ev&& event) {
+    return OutermostContext().TryPostEvent(std::forward<Ev>(event));
+  }
+
+  template <class Ev>
+  [[nodiscard]] bool TryPostEvent(Ev&& event, std::size_t priority) {
+    return OutermostContext().TryPostEvent(std::forward<Ev>(event), priority);
+  }
+
   // Defer the current event.
   [[nodiscard]] Result DeferEvent() {
-    UFSM_ASSERT(context_->OutermostContextBase().current_event_ != nullptr);
+    UFSM_ASSERT(context_->OutermostContextBase().core_.CurrentEvent() != nullptr);
     deferred_flag_ = true;
     return Result::kDeferEvent;
   }
 
+  // Terminate the machine from a reaction: every active state exits and queued events are dropped.
+  // Like a transition, this destroys the calling state, so return the result right away.
+  [[nodiscard]] Result TerminateMachine() {
+    auto& state_machine = OutermostContextBase();
+#if !defined(NDEBUG)
+    UFSM_ASSERT(!state_machine.in_transition_);
+#endif
+    state_machine.TerminateImpl();
+    return Result::kConsumed;
+  }
+
   // Access a specific context in the hierarchy.
   template <class TargetContext>
   const TargetContext& Context() const {
@@ -439,15 +1847,7 @@ class State : public detail::StateBase {
   template <typename DestState, typename Action, typename... Args>
   [[nodiscard]] Result Transit(Action&& action, with_args_t, Args&&... args) {
     auto factory = [t = std::make_tuple(std::forward<Args>(args)...)](auto ctx) mutable {
-      return std::apply([ctx](auto&&... a) {
-        if constexpr (std::is_constructible_v<DestState, decltype(ctx), decltype(a)...>)
-          return std::make_unique<DestState>(ctx, std::move(a)...);
-        else {
-          auto state = std::make_unique<DestState>(std::move(a)...);
-          state->context_ = ctx;
-          return state;
-        }
-      }, std::move(t));
+      return std::apply([ctx](auto&&... a) { return DestState::MakeState(ctx, std::move(a)...); }, std::move(t));
     };
     return TransitImpl<DestState>(std::forward<Action>(action), std::move(factory));
   }
@@ -457,35 +1857,48 @@ class State : public detail::StateBase {
   [[nodiscard]] constexpr Result DiscardEvent() const noexcept { return Result::kDiscardEvent; }
   [[nodiscard]] constexpr Result ConsumeEvent() const noexcept { return Result::kConsumed; }
 
-  const void* TypeId() const noexcept override { return StaticTypeId(); }
-  const char* Name() const noexcept override {
-    static const std::string name{detail::PrettyTypeName<Derived>()};
-    return name.c_str();
-  }
+ protected:
+  State(ContextPtrType context = nullptr) : detail::StateBase(&kDescriptor), context_(context) {}
 
-  void Exit() override {
-    if constexpr (detail::HasOnExitMethod<Derived>::value) {
-      static_cast<Derived*>(this)->OnExit();
-    }
+ public:
+  // States are allocated through their type's pool (see DefaultPolicy::kStatePoolSize).
+  static void* operator new(std::size_t size) {
+    if (size == sizeof(Derived)) return Pool::Allocate();
+    detail::AllocationTracker::Note<AllocationKind::kState, Derived>(size);
+    return ::operator new(size);
   }
-
- protected:
-  State(ContextPtrType context = nullptr) : context_(context) {}
-  ~State() {
-    // If events were deferred, move them to the posted events queue upon state destruction.
-    if (context_ && deferred_flag_) {
-      auto& out = context_->OutermostContextBase();
-      for (; !out.deferred_events_.empty(); out.deferred_events_.pop_back())
-        out.posted_events_.push_front(std::move(out.deferred_events_.back()));
-    }
+  static void* operator new(std::size_t size, std::align_val_t align) {
+    detail::AllocationTracker::Note<AllocationKind::kState, Derived>(size);
+    return ::operator new(size, align);
+  }
+  static void* operator new(std::size_t, void* place) noexcept { return place; }
+  static void operator delete(void* block, std::size_t size) noexcept {
+    if (size == sizeof(Derived))
+      Pool::Free(block);
+    else
+      ::operator delete(block);
+  }
+  static void operator delete(void* block, std::size_t size, std::align_val_t align) noexcept {
+    ::operator delete(block, size, align);
   }
 
  private:
-  static const void* StaticTypeId() noexcept {
-    static const int tag = 0;
-    return &tag;
+  static const void* StaticTypeId() noexcept { return &kDescriptor; }
+  static const char* StaticName() noexcept {
+    static const std::string name{detail::PrettyTypeName<Derived>()};
+    return name.c_str();
+  }
+  static constexpr auto ExitFunction() -> void (*)(detail::StateBase&) {
+    if constexpr (detail::HasOnExitMethod<Derived>::value)
+      return [](detail::StateBase& state) { static_cast<Derived&>(state).OnExit(); };
+    else
+      return nullptr;
   }
 
+  static const detail::StateDescriptor kDescriptor;
+
+  using Pool = detail::StatePool<Derived, OutermostContextBaseType::PolicyType::kStatePoolSize>;
+
   const OutermostContextBaseType& OutermostContextBase() const { return context_->OutermostContextBase(); }
   OutermostContextBaseType& OutermostContextBase() { return context_->OutermostContextBase(); }
 
@@ -570,66 +1983,119 @@ class State : public detail::StateBase {
     return result == Result::kNoReaction ? Result::kForwardEvent : result;
   }
 
-  Result ReactImpl(const detail::EventBase& event) override {
-    auto res = LocalReact(event, typename Derived::reactions{});
-    // If not handled locally, forward to parent context.
-    return res == Result::kForwardEvent ? context_->ReactImpl(event) : res;
-  }
+  // Defined out of the class, like DeepConstruct() and ShallowConstruct() below, so that FSM_EXTERN_STATE() keeps
+  // the reactions and everything they transition to in the state's own translation unit.
+  Result ReactImpl(const detail::EventBase& event) override;
 
   template <typename, typename, typename>
   friend class ufsm::State;
-  template <class, class>
+  template <class, class, class>
   friend class ufsm::StateMachine;
   template <class, class>
   friend struct ufsm::detail::Constructor;
 
-  template <typename Factory = std::nullptr_t>
-  static void DeepConstruct(const ContextPtrType& context, OutermostContextBaseType& out_context, Factory&& factory = nullptr) {
-    static_assert(std::is_base_of_v<State, Derived>, "Derived state must inherit from ufsm::State<Derived, ...>");
-    static_assert(std::is_void_v<InnerInitial> || std::is_base_of_v<detail::StateBase, InnerInitial>,
-                  "InnerInitial must be a State or void");
-    auto* p_inner = ShallowConstruct(context, out_context, std::forward<Factory>(factory));
+  // Enter the state, built without Transit arguments, and then its initial substates.
+  static void DeepConstruct(const ContextPtrType& context, OutermostContextBaseType& out_context);
+
+  // Enter the state, built without Transit arguments, but not its substates.
+  static InnerContextPtrType ShallowConstruct(const ContextPtrType& context, OutermostContextBaseType& out_context);
+
+  // Enter the state built by a Transit(with_args, ...) factory, and then its initial substates.
+  template <typename Factory>
+  static void DeepConstruct(const ContextPtrType& context, OutermostContextBaseType& out_context, Factory&& factory) {
+    auto* p_inner = Enter(factory(context), out_context);
     if constexpr (!std::is_same_v<void, InnerInitial>) InnerInitial::DeepConstruct(p_inner, out_context);
   }
 
-  template <typename Factory = std::nullptr_t>
-  static InnerContextPtrType ShallowConstruct(const ContextPtrType& context, OutermostContextBaseType& out_context, [[maybe_unused]] Factory&& factory = nullptr) {
-    std::unique_ptr<Derived> state;
-    if constexpr (!std::is_same_v<std::decay_t<Factory>, std::nullptr_t>) {
-      state = factory(context);  // TransitWithArgs path
-    } else if constexpr (std::is_constructible_v<Derived, ContextPtrType>) {
-      state = std::make_unique<Derived>(context);
-    } else if constexpr (std::is_default_constructible_v<Derived>) {
-      state = std::make_unique<Derived>();
+  static InnerContextPtrType Enter(std::unique_ptr<detail::StateBase> state, OutermostContextBaseType& out_context) {
+    auto* ptr = out_context.template Add<Derived>(std::move(state));
+    if constexpr (detail::HasOnEntryMethod<Derived>::value) ptr->OnEntry();
+    return ptr;
+  }
+
+  // Allocate the state, preferring a constructor that takes the context pointer.
+  // It is handed over as a StateBase pointer, so that states do not each instantiate their own std::unique_ptr.
+  template <typename... Args>
+  static std::unique_ptr<detail::StateBase> MakeState(const ContextPtrType& context, Args&&... args) {
+    if constexpr (std::is_constructible_v<Derived, ContextPtrType, Args&&...>) {
+      return std::unique_ptr<detail::StateBase>(new Derived(context, std::forward<Args>(args)...));
+    } else if constexpr (std::is_constructible_v<Derived, Args&&...>) {
+      auto* state = new Derived(std::forward<Args>(args)...);
       state->context_ = context;
+      return std::unique_ptr<detail::StateBase>(state);
     } else {
       static_assert(!sizeof(Derived), "State requires constructor arguments. Use TransitWithArgs().");
+      return nullptr;
     }
-    auto* ptr = out_context.Add(std::move(state));
-    if constexpr (detail::HasOnEntryMethod<Derived>::value) ptr->OnEntry();
-    return ptr;
   }
 
   ContextPtrType context_;
-  bool deferred_flag_ = false;
 };
 
+template <typename Derived, typename ContextState, typename InnerInitial>
+const detail::StateDescriptor State<Derived, ContextState, InnerInitial>::kDescriptor{
+    &StaticName, ExitFunction(), detail::kStateJournalId<Derived>};
+
+template <typename Derived, typename ContextState, typename InnerInitial>
+Result State<Derived, ContextState, InnerInitial>::ReactImpl(const detail::EventBase& event) {
+  auto res = LocalReact(event, typename Derived::reactions{});
+  // If not handled locally, forward to parent context.
+  return res == Result::kForwardEvent ? context_->ReactImpl(event) : res;
+}
+
+template <typename Derived, typename ContextState, typename InnerInitial>
+void State<Derived, ContextState, InnerInitial>::DeepConstruct(const ContextPtrType& context,
+                                                               OutermostContextBaseType& out_context) {
+  static_assert(std::is_base_of_v<State, Derived>, "Derived state must inherit from ufsm::State<Derived, ...>");
+  static_assert(std::is_void_v<InnerInitial> || std::is_base_of_v<detail::StateBase, InnerInitial>,
+                "InnerInitial must be a State or void");
+  auto* p_inner = ShallowConstruct(context, out_context);
+  if constexpr (!std::is_same_v<void, InnerInitial>) {
+    static_assert(detail::kConstructibleInContext<InnerInitial>,
+                  "InnerInitial requires constructor arguments, which initial states cannot get");
+    InnerInitial::DeepConstruct(p_inner, out_context);
+  }
+}
+
+template <typename Derived, typename ContextState, typename InnerInitial>
+typename State<Derived, ContextState, InnerInitial>::InnerContextPtrType
+State<Derived, ContextState, InnerInitial>::ShallowConstruct(const ContextPtrType& context,
+                                                             OutermostContextBaseType& out_context) {
+  // An explicit instantiation reaches here for states that only Transit arguments can build; callers that would
+  // construct such a state without them fail to compile instead.
+  if constexpr (detail::kConstructibleInContext<Derived>) {
+    return Enter(MakeState(context), out_context);
+  } else {
+    UFSM_ASSERT(false && "ufsm: state requires constructor arguments");
+    return nullptr;
+  }
+}
+
 // The root of the state hierarchy.
-template <typename Derived, typename InnerInitial>
+template <typename Derived, typename InnerInitial, typename Policy>
 class StateMachine {
+  using PostedQueue = typename Policy::PostedQueue;
+  using DeferredQueue = typename Policy::DeferredQueue;
+  using Clock = std::chrono::steady_clock;
+  using TimePoint = Clock::time_point;
+
  public:
+  using InnerInitialType = InnerInitial;
   using InnerContextType = Derived;
   using OutermostContextType = Derived;
   using OutermostContextBaseType = StateMachine;
   using InnerContextPtrType = Derived*;
   using ContextTypeList = mp::List<>;
   using ContextType = void;
+  using PolicyType = Policy;
 
   // Start the state machine.
   void Initiate() {
     static_assert(std::is_base_of_v<StateMachine, Derived>,
                   "Derived machine must inherit from ufsm::StateMachine<Derived, ...>");
     static_assert(std::is_base_of_v<detail::StateBase, InnerInitial>, "InnerInitial must be a State");
+    static_assert(detail::kConstructibleInContext<InnerInitial>,
+                  "InnerInitial requires constructor arguments, which initial states cannot get");
     TerminateImpl();
     InnerInitial::DeepConstruct(static_cast<Derived*>(this), *static_cast<Derived*>(this));
   }
@@ -642,7 +2108,45 @@ class StateMachine {
     TerminateImpl();
   }
 
-  bool Terminated() const noexcept { return !current_state_; }
+  bool Terminated() const noexcept { return !core_.CurrentState() && !hibernated_; }
+
+  // Pay the first-use costs of the machine before it takes traffic.
+  // Every state and event type reachable from the initial state through initial substates and declarative reactions
+  // (plus Extra, for types only named in React() bodies) gets its lazily initialized statics set up and, with
+  // Policy::kStatePoolSize, its state pool filled. Both are shared by all machines on the calling thread. This
+  // machine's posted and deferred queues also get their first block of storage.
+  template <typename... Extra>
+  void WarmUp() {
+    WarmUpTypes(typename mp::Closure<mp::List<InnerInitial, Extra...>, detail::ReachableFrom>::type{});
+    posted_events_.reserve(1);
+    deferred_events_.reserve(1);
+  }
+
+  // Hibernate an idle machine.
+  // The active states are destroyed without running OnExit() and replaced by a compact image holding the leaf
+  // state type, the deferral bookkeeping and whatever each state returns from an optional `Persist() const`.
+  // Deferred events are kept. The next ProcessEvent() rehydrates the states without running OnEntry(); a state
+  // with Persist() is reconstructed from the persisted value, like Transit<S>(ufsm::with_args, value).
+  // Returns false if the machine is not idle (terminated, hibernated, dispatching or holding posted events), or if
+  // an active state was built from Transit arguments it cannot be rebuilt from.
+  bool Hibernate() {
+    if (!core_.CurrentState() || !hibernate_ || in_event_loop_ || !posted_events_.empty()) return false;
+    auto image = hibernate_(*this);
+    core_.Discard(path_.data());
+    posted_events_.shrink_to_fit();
+    deferred_events_.shrink_to_fit();
+    hibernated_ = std::move(image);
+    return true;
+  }
+
+  bool Hibernated() const noexcept { return hibernated_ != nullptr; }
+
+  // Restore the states of a hibernated machine. ProcessEvent() calls this implicitly.
+  void Rehydrate() {
+    if (!hibernated_) return;
+    auto image = std::move(hibernated_);
+    image->Rehydrate(*this);
+  }
 
   // Process an event.
   // This method handles the event loop, ensuring that posted events are processed
@@ -652,21 +2156,89 @@ class StateMachine {
     return ProcessEventLoop(event);
   }
 
+  // Process an event as ProcessEvent() does, without calling any of the machine's hooks (OnEventProcessed(),
+  // OnUnhandledEvent() and the queue hooks). For rebuilding a machine from recorded events (see ufsm/journal.h): the
+  // reactions run again, their observers do not.
+  Result ReplayEvent(const detail::EventBase& event) {
+    detail::RestoreOnExit<bool> guard(replaying_, true);
+    return ProcessEventLoop(event);
+  }
+
+  // Run an action as one run-to-completion step, like the reaction to an event: the events it posts are processed
+  // before Run() returns. Called from within a reaction, the action just runs. ufsm/coroutine.h resumes activities
+  // through this.
+  template <class Action>
+  void Run(Action&& action) {
+#if !defined(NDEBUG)
+    UFSM_ASSERT(!in_transition_);
+#endif
+    RunToCompletion([&] {
+      std::forward<Action>(action)();
+      return Result::kConsumed;
+    });
+  }
+
   // Post an event to be processed later.
+  // An event type with a `conflation` member is conflated with a pending event of its type, if there is one, instead
+  // of being queued again (see ufsm::Conflation); the event being processed is no longer pending.
   template <class Ev>
   void PostEvent(Ev&& event) {
-    posted_events_.push_back(static_cast<const detail::EventBase&>(event).Clone());
+    Post<false>(static_cast<const std::decay_t<Ev>&>(event), 0);
+  }
+
+  // Post an event to a priority lane, with a PriorityEventQueue as the policy's PostedQueue. Lanes with a higher
+  // priority are drained first and each keeps posting order; the event being processed always completes first.
+  template <class Ev>
+  void PostEvent(Ev&& event, std::size_t priority) {
+    static_assert(detail::kQueueLanes<PostedQueue> > 0, "Posting with a priority needs a PriorityEventQueue");
+    UFSM_ASSERT(priority < detail::kQueueLanes<PostedQueue>);
+    Post<false>(static_cast<const std::decay_t<Ev>&>(event), priority);
+  }
+
+  // Post an event unless the posted queue is full, or with Policy::kPostedWatermarks at its high watermark (the
+  // lane's fill, with priority lanes). A refused event is dropped without calling OnQueueOverflow() and false is
+  // returned, so that producers can back off; an event conflated into a pending one is never refused.
+  template <class Ev>
+  [[nodiscard]] bool TryPostEvent(Ev&& event) {
+    return Post<true>(static_cast<const std::decay_t<Ev>&>(event), 0);
+  }
+
+  template <class Ev>
+  [[nodiscard]] bool TryPostEvent(Ev&& event, std::size_t priority) {
+    static_assert(detail::kQueueLanes<PostedQueue> > 0, "Posting with a priority needs a PriorityEventQueue");
+    UFSM_ASSERT(priority < detail::kQueueLanes<PostedQueue>);
+    return Post<true>(static_cast<const std::decay_t<Ev>&>(event), priority);
+  }
+
+  // Events waiting in the posted and deferred queues, for monitoring.
+  std::size_t PostedDepth() const noexcept { return posted_events_.size(); }
+  std::size_t DeferredDepth() const noexcept { return deferred_events_.size(); }
+
+  // Drop the deferred events whose time to live has passed (see DefaultPolicy::kDeferredTtl). Deferring, releasing
+  // and processing events expire them too; call this on an idle machine to free what stale deferrals hold. It
+  // compares the clock with the earliest deadline and walks the deferred queue only once that has passed.
+  void ExpireDeferredEvents() {
+    static_assert(Policy::kDeferredTtl, "Expiring deferred events needs Policy::kDeferredTtl");
+    if (const TimePoint now = Clock::now(); now >= deferred_deadlines_.earliest()) ExpireDeferred(now);
   }
 
   // Check if the machine is in a specific state.
   template <class StateT>
   bool IsInState() const {
     static_assert(std::is_base_of_v<detail::StateBase, StateT>, "StateT must be a state");
-    for (const auto& p : active_path_)
-      if (p && p->TypeId() == StateT::StaticTypeId()) return true;
+    if (hibernated_) return hibernated_->Contains(StateT::StaticTypeId());
+    for (std::size_t i = 0; i < core_.Depth(); ++i)
+      if (path_[i]->TypeId() == StateT::StaticTypeId()) return true;
     return false;
   }
 
+  // Identity of the leaf state type, equal for all machines in the same leaf state (hibernated or not); nullptr
+  // when terminated.
+  const void* LeafTypeId() const noexcept {
+    if (hibernated_) return hibernated_->LeafTypeId();
+    return core_.CurrentState() ? core_.CurrentState()->TypeId() : nullptr;
+  }
+
   template <class TargetContext = Derived>
   const TargetContext& Context() const {
     return *static_cast<const Derived*>(this);
@@ -680,8 +2252,14 @@ class StateMachine {
   Derived& OutermostContext() { return *static_cast<Derived*>(this); }
 
  protected:
-  StateMachine() { active_path_.reserve(8); }
-  virtual ~StateMachine() { TerminateImpl(); }
+  StateMachine() = default;
+  virtual ~StateMachine() {
+    // Derived is already gone, so a hibernated machine is not rehydrated just to be torn down, and the machine's
+    // hooks are not called for the events still queued.
+    destroying_ = true;
+    hibernated_.reset();
+    TerminateImpl();
+  }
 
  private:
   const StateMachine& OutermostContextBase() const { return *this; }
@@ -689,6 +2267,7 @@ class StateMachine {
 
   template <typename, typename, typename>
   friend class ufsm::State;
+  friend struct detail::BroadcastAccess;
 
 #if !defined(NDEBUG)
   bool in_transition_ = false;
@@ -696,12 +2275,112 @@ class StateMachine {
 
   Result ReactImpl(const detail::EventBase&) { return Result::kForwardEvent; }
 
+  template <typename... Types>
+  static void WarmUpTypes(mp::List<Types...>) {
+    (WarmUpType<Types>(), ...);
+  }
+
+  template <typename T>
+  static void WarmUpType() {
+    (void)T::StaticTypeId();
+    (void)T::StaticName();
+    if constexpr (detail::IsState<T>::value) T::Pool::Reserve();
+  }
+
+  // Compact image of a hibernated active path.
+  class HibernatedBase {
+   public:
+    virtual ~HibernatedBase() = default;
+    virtual void Rehydrate(StateMachine& machine) = 0;
+    virtual bool Contains(const void* type_id) const noexcept = 0;
+    virtual const void* LeafTypeId() const noexcept = 0;
+  };
+
+  // Image of the path States... (outermost first), capturing per state its persisted data and deferral flag.
+  template <typename PathList>
+  class HibernatedPath;
+
+  template <typename... States>
+  class HibernatedPath<mp::List<States...>> final : public HibernatedBase {
+   public:
+    static std::unique_ptr<HibernatedBase> Capture(StateMachine& machine) {
+      return Capture(machine, std::index_sequence_for<States...>{});
+    }
+
+    void Rehydrate(StateMachine& machine) override {
+      // Outermost first, each state inside the previous one.
+      void* context = static_cast<Derived*>(&machine);
+      (..., (context = RestoreLevel<States>(machine, context)));
+    }
+
+    bool Contains(const void* type_id) const noexcept override {
+      return ((States::StaticTypeId() == type_id) || ...);
+    }
+
+    const void* LeafTypeId() const noexcept override {
+      const void* leaf = nullptr;
+      (..., (leaf = States::StaticTypeId()));
+      return leaf;
+    }
+
+   private:
+    template <typename StateType>
+    struct Level {
+      typename detail::PersistedType<StateType>::type data;
+      bool deferred;
+    };
+
+    // One base per state of the path; the states are distinct.
+    struct Levels : Level<States>... {};
+
+    explicit HibernatedPath(Level<States>... levels) : levels_{std::move(levels)...} {}
+
+    template <std::size_t... I>
+    static std::unique_ptr<HibernatedBase> Capture(StateMachine& machine, std::index_sequence<I...>) {
+      UFSM_ASSERT(machine.core_.Depth() == sizeof...(States));
+      detail::AllocationTracker::Note<AllocationKind::kHibernation, Derived>(sizeof(HibernatedPath));
+      return std::unique_ptr<HibernatedBase>(
+          new HibernatedPath(CaptureLevel(static_cast<States&>(*machine.path_[I]))...));
+    }
+
+    template <typename StateType>
+    static Level<StateType> CaptureLevel(const StateType& state) {
+      if constexpr (detail::HasPersistMethod<StateType>::value)
+        return Level<StateType>{state.Persist(), state.deferred_flag_};
+      else
+        return Level<StateType>{{}, state.deferred_flag_};
+    }
+
+    template <typename StateType>
+    void* RestoreLevel(StateMachine& machine, void* context) {
+      auto* parent = static_cast<typename StateType::ContextPtrType>(context);
+      auto& level = static_cast<Level<StateType>&>(levels_);
+      StateType* state;
+      if constexpr (detail::HasPersistMethod<StateType>::value)
+        state = machine.template Add<StateType>(StateType::MakeState(parent, std::move(level.data)));
+      else
+        state = machine.template Add<StateType>(StateType::MakeState(parent));
+      state->deferred_flag_ = level.deferred;
+      return state;
+    }
+
+    Levels levels_;
+  };
+
   template <class StateType>
-  StateType* Add(std::unique_ptr<StateType> state_ptr) {
-    state_ptr->SetActiveIndex(active_path_.size());
-    StateType* raw_ptr = state_ptr.get();
-    active_path_.push_back(std::move(state_ptr));
-    if constexpr (std::is_same_v<typename StateType::InnerInitialType, void>) current_state_ = raw_ptr;
+  StateType* Add(std::unique_ptr<detail::StateBase> state_ptr) {
+    static_assert(mp::Size<typename StateType::ContextTypeList>::value <= Policy::kMaxDepth,
+                  "State is nested deeper than Policy::kMaxDepth, raise it in the machine's policy");
+    auto* raw_ptr = static_cast<StateType*>(state_ptr.get());
+    constexpr bool kLeaf = std::is_same_v<typename StateType::InnerInitialType, void>;
+    core_.Push(path_.data(), std::move(state_ptr), kLeaf);
+    if constexpr (kLeaf) {
+      using PathList = typename detail::MakeContextList<Derived, StateType>::type;
+      if constexpr (detail::kRestorablePath<PathList>)
+        hibernate_ = &HibernatedPath<PathList>::Capture;
+      else
+        hibernate_ = nullptr;
+    }
     return raw_ptr;
   }
 
@@ -709,90 +2388,361 @@ class StateMachine {
 #if !defined(NDEBUG)
     UFSM_ASSERT(!in_transition_);
 #endif
-    // If we are already in the event loop (re-entrant call), just process the event immediately.
-    if (in_event_loop_) return ProcessEventImpl(event);
+    return RunToCompletion([&] { return ProcessEventImpl(event); });
+  }
+
+  template <class Step>
+  Result RunToCompletion(Step&& step) {
+    // If we are already in the event loop (re-entrant call), just run the step immediately.
+    if (in_event_loop_) return step();
+    Rehydrate();
 
     // Otherwise, mark that we are in the event loop.
     detail::RestoreOnExit<bool> guard(in_event_loop_, true);
-    Result last = ProcessEventImpl(event);
+    if constexpr (Policy::kDeferredTtl) {
+      if (const TimePoint now = Clock::now(); now >= deferred_deadlines_.earliest()) ExpireDeferred(now);
+    }
+    Result last = step();
 
     // Process posted events after the current event.
     // This queue may grow as events are processed.
-    for (; !posted_events_.empty(); posted_events_.pop_front()) last = ProcessEventImpl(*posted_events_.front());
+    // Each event is taken off the queue before dispatch, so deferred events released to the front while it is
+    // being processed go ahead of the remaining ones.
+    while (!posted_events_.empty()) {
+      [[maybe_unused]] TimePoint since;
+      if constexpr (Policy::kQueueSojourn) {
+        auto& stamps = posted_stamps_[PostedFrontLane()];
+        since = stamps.front();
+        stamps.pop_front();
+      }
+      auto event = posted_events_.take_front();
+      if constexpr (Policy::kQueueSojourn) RecordSojourn(QueueKind::kPosted, *event, since, Clock::now());
+      WatchDepth<QueueKind::kPosted>();
+      last = ProcessEventImpl(*event);
+    }
     return last;
   }
 
   Result ProcessEventImpl(const detail::EventBase& event) {
-    detail::RestoreOnExit<const detail::EventBase*> guard(current_event_, &event);
-
     // Delegate reaction to the current state.
-    auto res = current_state_ ? current_state_->ReactImpl(event) : Result::kForwardEvent;
+    auto res = core_.Dispatch(event);
 
-    detail::InvokeOnEventProcessedIfPresent(*static_cast<Derived*>(this), current_state_, event, res);
+    if (!HooksMuted())
+      detail::InvokeOnEventProcessedIfPresent(*static_cast<Derived*>(this), core_.CurrentState(), event, res);
 
     // Handle deferral.
     if (res == Result::kDeferEvent) {
-      deferred_events_.push_back(event.Clone());
+      Defer(event);
+      WatchDepth<QueueKind::kDeferred>();
       return Result::kConsumed;
     }
 
     // Handle unhandled events.
-    if (res == Result::kForwardEvent) detail::InvokeOnUnhandledEventIfPresent(*static_cast<Derived*>(this), event);
+    if (res == Result::kForwardEvent && !HooksMuted())
+      detail::InvokeOnUnhandledEventIfPresent(*static_cast<Derived*>(this), event);
     return res;
   }
 
-  void ResetToDepth(std::size_t n) {
-    while (active_path_.size() > n) {
-      active_path_.back()->Exit();
-      active_path_.pop_back();
+  // Queue an event, handing it to OnQueueOverflow() if the queue is full and its policy says so.
+  template <typename Queue>
+  void Enqueue(Queue& queue, const detail::EventBase& event, bool front = false) {
+    CheckQueued<Queue>(event, front ? queue.push_front(event) : queue.push_back(event));
+  }
+
+  // Post an event to a lane (0 without lanes), conflating it first. With kTry an event that finds the queue full or
+  // at its high watermark is refused instead of being handed to the overflow policy. Returns whether it was taken.
+  template <bool kTry, typename Ev>
+  bool Post(const Ev& event, [[maybe_unused]] std::size_t lane) {
+    static_assert(PostedQueue::template kFits<Ev>, "Event type does not fit the posted queue's slots");
+    constexpr bool kLanes = detail::kQueueLanes<PostedQueue> > 0;
+    if constexpr (detail::kConflation<Ev> != Conflation::kNone) {
+      detail::EventBase* pending;
+      if constexpr (kLanes) {
+        pending = posted_events_.find_last(event.TypeId(), lane);
+      } else {
+        pending = posted_events_.find_last(event.TypeId());
+      }
+      if (Conflate(pending, event)) return true;
+    }
+    if constexpr (kTry) {
+      constexpr std::size_t kHigh = Policy::kPostedWatermarks.high;
+      bool full;
+      if constexpr (kLanes) {
+        full = posted_events_.full(lane) || (kHigh > 0 && posted_events_.size(lane) >= kHigh);
+      } else {
+        full = posted_events_.full() || (kHigh > 0 && posted_events_.size() >= kHigh);
+      }
+      if (full) return false;
+    }
+    const detail::EventBase& base = event;
+    [[maybe_unused]] const std::size_t size = PostedSize(lane);
+    bool queued;
+    if constexpr (kLanes) {
+      queued = posted_events_.push_back(base, lane);
+    } else {
+      queued = posted_events_.push_back(base);
+    }
+    if constexpr (Policy::kQueueSojourn) {
+      if (queued) Stamp(posted_stamps_[lane], PostedSize(lane) == size, false, Clock::now());
     }
-    current_state_ = active_path_.empty() ? nullptr : active_path_.back().get();
+    CheckQueued<PostedQueue>(base, queued);
+    WatchDepth<QueueKind::kPosted>();
+    return queued;
   }
 
-  void TerminateImpl() {
-    ResetToDepth(0);
-    posted_events_.clear();
-    deferred_events_.clear();
+  // Events in a lane of the posted queue (the whole queue without lanes), and the lane dispatched from next.
+  std::size_t PostedSize([[maybe_unused]] std::size_t lane) const noexcept {
+    if constexpr (detail::kQueueLanes<PostedQueue> > 0) {
+      return posted_events_.size(lane);
+    } else {
+      return posted_events_.size();
+    }
+  }
+  std::size_t PostedFrontLane() const noexcept {
+    if constexpr (detail::kQueueLanes<PostedQueue> > 0) {
+      return posted_events_.front_lane();
+    } else {
+      return 0;
+    }
   }
 
-  void TerminateImpl(detail::StateBase& state) {
-    if (active_path_.empty()) {
-      current_state_ = nullptr;
-      return;
+  // Record the enqueue time of an event just queued at the front or back, after a full queue dropped its oldest
+  // event to make room if `dropped`.
+  template <typename Stamps>
+  static void Stamp(Stamps& stamps, bool dropped, bool front, TimePoint now) {
+    if (dropped) stamps.pop_front();
+    if (front) {
+      stamps.push_front(now);
+    } else {
+      stamps.push_back(now);
     }
-    auto idx = state.ActiveIndex();
-    UFSM_ASSERT(idx < active_path_.size() && active_path_[idx].get() == &state);
-    // Reset the state machine to the depth of the state being terminated.
-    // This effectively exits all states deeper than 'state'.
-    ResetToDepth(idx < active_path_.size() && active_path_[idx].get() == &state ? idx : 0);
   }
 
-  void TerminateAfter(detail::StateBase& state) {
-    if (active_path_.empty()) {
-      current_state_ = nullptr;
-      return;
+  // Report how long an event waited in a queue, to its type's SojournRecord and to OnEventSojourn() unless hooks are
+  // muted.
+  void RecordSojourn(QueueKind queue, const detail::EventBase& event, TimePoint since, TimePoint now) {
+    const auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(now - since);
+    SojournRecord& record = event.TypeInfo().sojourn();
+    (queue == QueueKind::kPosted ? record.posted : record.deferred).Add(wait);
+    if constexpr (detail::HasOnEventSojournMethod<Derived>::value) {
+      if (!HooksMuted()) static_cast<Derived*>(this)->OnEventSojourn(queue, event, wait);
+    }
+  }
+
+  // Call OnQueueHigh() when a queue has grown to its high watermark, then OnQueueLow() once it is back down to its
+  // low one. Compiled out for queues without watermarks; while hooks are muted the crossings are tracked, not reported.
+  template <QueueKind kQueue>
+  void WatchDepth() {
+    constexpr Watermarks kMarks =
+        kQueue == QueueKind::kPosted ? Policy::kPostedWatermarks : Policy::kDeferredWatermarks;
+    if constexpr (kMarks.high > 0) {
+      static_assert(kMarks.low < kMarks.high, "A queue's low watermark must be below its high one");
+      static_assert(detail::HasQueueWatermarkHooks<Derived>::value,
+                    "Queue watermarks require Derived::OnQueueHigh(ufsm::QueueKind, std::size_t) and OnQueueLow()");
+      bool& high = kQueue == QueueKind::kPosted ? posted_high_ : deferred_high_;
+      const std::size_t depth = kQueue == QueueKind::kPosted ? posted_events_.size() : deferred_events_.size();
+      if (!high && depth >= kMarks.high) {
+        high = true;
+        if (!HooksMuted()) static_cast<Derived*>(this)->OnQueueHigh(kQueue, depth);
+      } else if (high && depth <= kMarks.low) {
+        high = false;
+        if (!HooksMuted()) static_cast<Derived*>(this)->OnQueueLow(kQueue, depth);
+      }
+    }
+  }
+
+  // Fold a posted event of a conflated type into the pending event of its type, if there is one.
+  template <typename Ev>
+  static bool Conflate(detail::EventBase* pending, const Ev& event) {
+    static_assert(std::is_base_of_v<Event<Ev>, Ev>, "A conflated event must derive from ufsm::Event<itself>");
+    if (!pending) return false;
+    if constexpr (detail::kConflation<Ev> == Conflation::kKeepLatest) {
+      static_assert(std::is_copy_assignable_v<Ev>, "Conflation::kKeepLatest needs a copy-assignable event");
+      static_cast<Ev&>(*pending) = event.Owned();
+    } else {
+      static_cast<Ev&>(*pending).Merge(event);
+    }
+    return true;
+  }
+
+  // Hand an event that did not make it into a queue to OnQueueOverflow(), if the queue's policy says so.
+  template <typename Queue>
+  void CheckQueued([[maybe_unused]] const detail::EventBase& event, [[maybe_unused]] bool queued) {
+    if constexpr (Queue::kOverflow == OverflowPolicy::kCallHook) {
+      static_assert(detail::HasOnQueueOverflowMethod<Derived>::value,
+                    "OverflowPolicy::kCallHook requires Derived::OnQueueOverflow(const ufsm::detail::EventBase&)");
+      if (!queued && !HooksMuted()) static_cast<Derived*>(this)->OnQueueOverflow(event);
+    }
+  }
+
+  // Queue an event deferred by the active state, within Policy::kMaxDeferred and with its deadline.
+  void Defer(const detail::EventBase& event) {
+    if constexpr (Policy::kMaxDeferred > 0) {
+      if (deferred_events_.size() >= Policy::kMaxDeferred) {
+        PopDeferredTimes(false);
+        DropDeferred(deferred_events_.front());
+        deferred_events_.pop_front();
+      }
+    }
+    if constexpr (Policy::kDeferredTtl || Policy::kQueueSojourn) {
+      const TimePoint now = Clock::now();
+      if constexpr (Policy::kDeferredTtl) {
+        if (now >= deferred_deadlines_.earliest()) ExpireDeferred(now);
+      }
+      const std::size_t size = deferred_events_.size();
+      const bool queued = deferred_events_.push_back(event);
+      if (queued) {
+        // A full queue dropping its oldest event made room for this one.
+        if (deferred_events_.size() == size) PopDeferredTimes(false);
+        if constexpr (Policy::kDeferredTtl) {
+          const auto ttl = event.TypeInfo().ttl;
+          deferred_deadlines_.push_back(ttl.count() > 0 ? now + ttl : TimePoint::max());
+        }
+        if constexpr (Policy::kQueueSojourn) deferred_stamps_.push_back(now);
+      }
+      CheckQueued<DeferredQueue>(event, queued);
+    } else {
+      Enqueue(deferred_events_, event);
     }
-    auto idx = state.ActiveIndex();
-    UFSM_ASSERT(idx < active_path_.size() && active_path_[idx].get() == &state);
-    // Reset the state machine to the depth after the state.
-    // This effectively exits all states deeper than 'state', but keeps 'state' active.
-    ResetToDepth(idx < active_path_.size() && active_path_[idx].get() == &state ? idx + 1 : 0);
   }
 
-  detail::StateBase* current_state_ = nullptr;
-  std::vector<std::unique_ptr<detail::StateBase>> active_path_;
-  const detail::EventBase* current_event_ = nullptr;
-  std::vector<detail::EventBase::Ptr> deferred_events_;
-  std::deque<detail::EventBase::Ptr> posted_events_;
+  // Forget the deadline and enqueue time of the deferred event at the front or back of the queue.
+  void PopDeferredTimes(bool back) noexcept {
+    if constexpr (Policy::kDeferredTtl) back ? deferred_deadlines_.pop_back() : deferred_deadlines_.pop_front();
+    if constexpr (Policy::kQueueSojourn) back ? deferred_stamps_.pop_back() : deferred_stamps_.pop_front();
+  }
+
+  // Drop the deferred events due by `now`, keeping the order of the others.
+  void ExpireDeferred(TimePoint now) {
+    deferred_deadlines_.reset_earliest();
+    for (std::size_t n = deferred_events_.size(); n > 0; --n) {
+      const TimePoint deadline = deferred_deadlines_.front();
+      [[maybe_unused]] TimePoint since;
+      if constexpr (Policy::kQueueSojourn) since = deferred_stamps_.front();
+      PopDeferredTimes(false);
+      auto event = deferred_events_.take_front();
+      if (deadline <= now) {
+        DropDeferred(*event);
+        continue;
+      }
+      if constexpr (std::is_same_v<DeferredQueue, DynamicEventQueue>) {
+        deferred_events_.push_back(std::move(event));
+      } else {
+        deferred_events_.push_back(*event);
+      }
+      deferred_deadlines_.push_back(deadline);
+      if constexpr (Policy::kQueueSojourn) deferred_stamps_.push_back(since);
+    }
+  }
+
+  // Report a deferred event dropped for its age or the kMaxDeferred cap, unless hooks are muted.
+  void DropDeferred([[maybe_unused]] const detail::EventBase& event) {
+    if constexpr (detail::HasOnDeferredEventDroppedMethod<Derived>::value) {
+      if (!HooksMuted()) static_cast<Derived*>(this)->OnDeferredEventDropped(event);
+    }
+  }
+
+  // Move the deferred events to the front of the posted queue, keeping their order. Those past their deadline are
+  // dropped instead.
+  void ReleaseDeferredEvents() {
+    [[maybe_unused]] TimePoint now;
+    if constexpr (Policy::kQueueSojourn) {
+      now = Clock::now();
+    } else if constexpr (Policy::kDeferredTtl) {
+      now = deferred_deadlines_.earliest() != TimePoint::max() ? Clock::now() : TimePoint::min();
+    }
+    while (!deferred_events_.empty()) {
+      if constexpr (Policy::kDeferredTtl) {
+        if (deferred_deadlines_.back() <= now) {
+          PopDeferredTimes(true);
+          DropDeferred(deferred_events_.back());
+          deferred_events_.pop_back();
+          continue;
+        }
+      }
+      if constexpr (Policy::kQueueSojourn) RecordSojourn(QueueKind::kDeferred, deferred_events_.back(),
+                                                         deferred_stamps_.back(), now);
+      PopDeferredTimes(true);
+      [[maybe_unused]] const std::size_t size = PostedSize(0);
+      bool queued = true;
+      if constexpr (std::is_same_v<PostedQueue, DynamicEventQueue> && std::is_same_v<DeferredQueue, DynamicEventQueue>) {
+        posted_events_.push_front(deferred_events_.take_back());
+      } else {
+        queued = posted_events_.push_front(deferred_events_.back());
+        CheckQueued<PostedQueue>(deferred_events_.back(), queued);
+        deferred_events_.pop_back();
+      }
+      if constexpr (Policy::kQueueSojourn) {
+        if (queued) Stamp(posted_stamps_[0], PostedSize(0) == size, true, now);
+      }
+    }
+    WatchDepth<QueueKind::kDeferred>();
+    WatchDepth<QueueKind::kPosted>();
+  }
+
+  // The machine's hooks are not called while replaying recorded events, nor from ~StateMachine() once Derived is gone.
+  bool HooksMuted() const noexcept { return replaying_ || destroying_; }
+
+  // Exit the states deeper than n; events deferred by any of them go back to the posted queue.
+  void ResetToDepth(std::size_t n) {
+    if (core_.ResetToDepth(path_.data(), n)) ReleaseDeferredEvents();
+  }
+
+  void TerminateImpl() {
+    // A hibernated machine is woken up first so that its states exit like any other.
+    Rehydrate();
+    ResetToDepth(0);
+    posted_events_.clear();
+    deferred_events_.clear();
+    if constexpr (Policy::kDeferredTtl) deferred_deadlines_.clear();
+    if constexpr (Policy::kQueueSojourn) {
+      for (auto& stamps : posted_stamps_) stamps.clear();
+      deferred_stamps_.clear();
+    }
+    WatchDepth<QueueKind::kPosted>();
+    WatchDepth<QueueKind::kDeferred>();
+  }
+
+  // Exit the state and the states below it.
+  void TerminateImpl(detail::StateBase& state) { ResetToDepth(core_.DepthOf(path_.data(), state, false)); }
+
+  // Exit the states below the state, keeping it active.
+  void TerminateAfter(detail::StateBase& state) { ResetToDepth(core_.DepthOf(path_.data(), state, true)); }
+
+  detail::MachineCore core_;
+  std::array<std::unique_ptr<detail::StateBase>, Policy::kMaxDepth> path_{};
+  DeferredQueue deferred_events_;
+  PostedQueue posted_events_;
+  std::unique_ptr<HibernatedBase> hibernated_;
+  std::unique_ptr<HibernatedBase> (*hibernate_)(StateMachine&) = nullptr;
   bool in_event_loop_ = false;
+  bool replaying_ = false;      // In ReplayEvent(): observer hooks are skipped.
+  bool destroying_ = false;     // In ~StateMachine(): Derived is gone, so are its hooks.
+  bool posted_high_ = false;    // Posted queue is past its high watermark, waiting to drain to its low one.
+  bool deferred_high_ = false;  // Likewise for the deferred queue.
+  std::conditional_t<Policy::kDeferredTtl, detail::TimeRing<detail::kQueueCapacity<DeferredQueue>>,
+                     detail::Disabled>
+      deferred_deadlines_;  // Deadline of each deferred event, with Policy::kDeferredTtl.
+  // Enqueue time of each queued event, with Policy::kQueueSojourn; the posted queue has one ring per lane.
+  std::conditional_t<Policy::kQueueSojourn,
+                     std::array<detail::TimeRing<detail::kQueueCapacity<PostedQueue>>,
+                                std::max<std::size_t>(detail::kQueueLanes<PostedQueue>, 1)>,
+                     detail::Disabled>
+      posted_stamps_;
+  std::conditional_t<Policy::kQueueSojourn, detail::TimeRing<detail::kQueueCapacity<DeferredQueue>>, detail::Disabled>
+      deferred_stamps_;
 };
 
 }  // namespace ufsm
 
 // Macros for defining state machines, states, and events.
-#define FSM_STATE_MACHINE(machine_type, initial_state_type) \
-  struct initial_state_type;                                \
+#define _FSM_STATE_MACHINE_2(machine_type, initial_state_type) \
+  struct initial_state_type;                                   \
   struct machine_type : ufsm::StateMachine<machine_type, initial_state_type>
+#define _FSM_STATE_MACHINE_3(machine_type, initial_state_type, policy_type) \
+  struct initial_state_type;                                                \
+  struct machine_type : ufsm::StateMachine<machine_type, initial_state_type, policy_type>
+#define FSM_STATE_MACHINE(...) _FSM_GET_MACRO(__VA_ARGS__, _FSM_STATE_MACHINE_3, _FSM_STATE_MACHINE_2)(__VA_ARGS__)
 #define _FSM_STATE_2(state_type, parent_state_type) \
   struct parent_state_type;                         \
   struct state_type : ufsm::State<state_type, parent_state_type>
@@ -804,4 +2754,20 @@ class StateMachine {
 #define _FSM_GET_MACRO(first_arg, second_arg, third_arg, selected_macro, ...) selected_macro
 #define FSM_EVENT(event_type) struct event_type : ufsm::Event<event_type>
 
+// Explicit instantiation of a state's reactions and construction, for machines whose states are defined across
+// several translation units. Put FSM_EXTERN_STATE() after the state's definition in its header and
+// FSM_INSTANTIATE_STATE() in the one source file that defines its member functions, both with the arguments given
+// to FSM_STATE(). Other files then only call into the state instead of compiling its transitions again.
+#define _FSM_EXTERN_STATE_2(state_type, parent_state_type) \
+  extern template class ufsm::State<state_type, parent_state_type>
+#define _FSM_EXTERN_STATE_3(state_type, parent_state_type, initial_state_type) \
+  extern template class ufsm::State<state_type, parent_state_type, initial_state_type>
+#define FSM_EXTERN_STATE(...) _FSM_GET_MACRO(__VA_ARGS__, _FSM_EXTERN_STATE_3, _FSM_EXTERN_STATE_2)(__VA_ARGS__)
+#define _FSM_INSTANTIATE_STATE_2(state_type, parent_state_type) \
+  template class ufsm::State<state_type, parent_state_type>
+#define _FSM_INSTANTIATE_STATE_3(state_type, parent_state_type, initial_state_type) \
+  template class ufsm::State<state_type, parent_state_type, initial_state_type>
+#define FSM_INSTANTIATE_STATE(...) \
+  _FSM_GET_MACRO(__VA_ARGS__, _FSM_INSTANTIATE_STATE_3, _FSM_INSTANTIATE_STATE_2)(__VA_ARGS__)
+
 #endif  // UFSM_UFSM_H_
@@ -0,0 +1,178 @@
+#ifndef UFSM_WIRE_H_
+#define UFSM_WIRE_H_
+
+// Wire registry: decodes messages tagged with a numeric ID straight into ufsm events and dispatches them.
+//
+// Each event type that travels on the wire declares `static constexpr ufsm::WireId wire_id`: a fixed number or
+// ufsm::HashWireName("name"), the 32-bit FNV-1a hash of a name the application picks. The ID is part of the protocol.
+// Unlike type names it does not depend on the compiler, namespace or build, so journals and replicas can store it.
+//
+// A WireRegistry maps IDs to per-type decode functions. Each one constructs its event in place in a buffer owned and
+// reused by the registry, sized for the largest registered type, so Dispatch() hands the event to ProcessEvent()
+// without touching the heap. An event that has to outlive the call is copied by the queue that keeps it, as usual;
+// with a ufsm::Payload it can even borrow the message bytes until then.
+//
+// A registry is not thread safe: use one per ingress thread. Failures are reported as false with errno set.
+
+#include <ufsm/ufsm.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace ufsm {
+
+using WireId = std::uint32_t;
+
+// 32-bit FNV-1a hash of a wire name, for IDs derived from names rather than assigned by hand.
+constexpr WireId HashWireName(std::string_view name) noexcept {
+  WireId hash = 0x811c9dc5u;
+  for (char c : name) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 0x01000193u;
+  }
+  return hash;
+}
+
+// Constructs an event from its encoded bytes in `storage`, with placement new, and returns it; returns nullptr
+// without constructing anything if the bytes are malformed. `storage` fits the event type it was registered for.
+//   static ufsm::detail::EventBase* Decode(std::string_view bytes, void* storage) {
+//     if (bytes.size() != 4) return nullptr;
+//     return new (storage) EvSetSpeed(ReadLe32(bytes.data()));
+//   }
+using WireDecoder = detail::EventBase* (*)(std::string_view bytes, void* storage);
+
+namespace detail {
+
+// Wire ID of an event type: its `wire_id` member.
+template <typename Ev, typename = void>
+inline constexpr bool kHasWireId = false;
+
+template <typename Ev>
+inline constexpr bool kHasWireId<Ev, std::void_t<decltype(Ev::wire_id)>> = true;
+
+template <typename Ev, typename = void>
+inline constexpr bool kHasWireDecode = false;
+
+template <typename Ev>
+inline constexpr bool kHasWireDecode<Ev, std::void_t<decltype(WireDecoder{&Ev::Decode})>> = true;
+
+}  // namespace detail
+
+class WireRegistry {
+ public:
+  WireRegistry() = default;
+  WireRegistry(const WireRegistry&) = delete;
+  WireRegistry& operator=(const WireRegistry&) = delete;
+
+  // Register Ev under Ev::wire_id, decoded by Ev::Decode or `decode`. Fails with EEXIST if the ID is taken, and with
+  // EBUSY while this registry is dispatching an event, which lives in the buffer a registration may replace.
+  template <class Ev>
+  bool Register() {
+    static_assert(detail::kHasWireDecode<Ev>,
+                  "Register<Ev>() needs `static ufsm::detail::EventBase* Ev::Decode(std::string_view, void*)`");
+    return Register<Ev>(&Ev::Decode);
+  }
+
+  template <class Ev>
+  bool Register(WireDecoder decode) {
+    static_assert(std::is_base_of_v<Event<Ev>, Ev>, "A wire event must derive from ufsm::Event<itself>");
+    static_assert(detail::kHasWireId<Ev>, "A wire event needs `static constexpr ufsm::WireId wire_id`");
+    static_assert(alignof(Ev) <= alignof(std::max_align_t), "Over-aligned events cannot be decoded in place");
+    if (busy_) {
+      errno = EBUSY;
+      return false;
+    }
+    const WireId id = Ev::wire_id;
+    auto it = Find(id);
+    if (it != entries_.end() && it->id == id) {
+      errno = EEXIST;
+      return false;
+    }
+    entries_.insert(it, Entry{id, decode, detail::PrettyTypeName<Ev>()});
+    if (sizeof(Ev) > buffer_size_) {
+      buffer_ = std::make_unique<std::max_align_t[]>((sizeof(Ev) + sizeof(std::max_align_t) - 1) /
+                                                     sizeof(std::max_align_t));
+      buffer_size_ = sizeof(Ev);
+    }
+    return true;
+  }
+
+  std::size_t size() const noexcept { return entries_.size(); }
+  bool Contains(WireId id) const noexcept { return Lookup(id) != nullptr; }
+
+  // Type name of the event registered under an ID, empty if none.
+  std::string_view Name(WireId id) const noexcept {
+    const Entry* entry = Lookup(id);
+    return entry ? entry->name : std::string_view();
+  }
+
+  // Decode a message and process it with `machine`, storing the outcome in `result` if given.
+  // Fails with ENOENT for an unregistered ID, EBADMSG if the decoder rejects the bytes, and EBUSY when called from
+  // a reaction to an event this registry is dispatching, whose buffer is still in use.
+  template <class Machine>
+  bool Dispatch(Machine& machine, WireId id, std::string_view bytes, Result* result = nullptr) {
+    return Decode(id, bytes, [&](const detail::EventBase& event) {
+      Result r = machine.ProcessEvent(event);
+      if (result) *result = r;
+    });
+  }
+
+  // Decode a message and pass the event to `fn(const ufsm::detail::EventBase&)`, for callers that post or route it
+  // themselves. The event is destroyed when `fn` returns. Fails like Dispatch().
+  template <class Fn>
+  bool Decode(WireId id, std::string_view bytes, Fn&& fn) {
+    const Entry* entry = Lookup(id);
+    if (!entry) {
+      errno = ENOENT;
+      return false;
+    }
+    if (busy_) {
+      errno = EBUSY;
+      return false;
+    }
+    detail::EventBase* event = entry->decode(bytes, buffer_.get());
+    if (!event) {
+      errno = EBADMSG;
+      return false;
+    }
+    detail::RestoreOnExit<bool> busy(busy_, true);
+    struct Destroy {
+      detail::EventBase* event;
+      ~Destroy() { event->~EventBase(); }
+    } destroy{event};
+    std::forward<Fn>(fn)(static_cast<const detail::EventBase&>(*event));
+    return true;
+  }
+
+ private:
+  struct Entry {
+    WireId id;
+    WireDecoder decode;
+    std::string_view name;
+  };
+
+  std::vector<Entry>::iterator Find(WireId id) {
+    return std::lower_bound(entries_.begin(), entries_.end(), id,
+                            [](const Entry& entry, WireId key) { return entry.id < key; });
+  }
+
+  const Entry* Lookup(WireId id) const noexcept {
+    auto it = std::lower_bound(entries_.begin(), entries_.end(), id,
+                               [](const Entry& entry, WireId key) { return entry.id < key; });
+    return it != entries_.end() && it->id == id ? &*it : nullptr;
+  }
+
+  std::vector<Entry> entries_;  // Sorted by ID.
+  std::unique_ptr<std::max_align_t[]> buffer_;
+  std::size_t buffer_size_ = 0;
+  bool busy_ = false;
+};
+
+}  // namespace ufsm
+
+#endif  // UFSM_WIRE_H_
@@ -0,0 +1,115 @@
+#include <gtest/gtest.h>
+
+#include <ufsm/ufsm.h>
+
+#include <string_view>
+
+// The test target is built with UFSM_ALLOC_STATS, so allocations are tracked in every build type.
+
+namespace {
+
+FSM_EVENT(ABEvTick){};
+FSM_EVENT(ABEvEcho){};
+FSM_EVENT(ABEvSwitch){};
+
+struct ABTop;
+struct ABRunning;
+struct ABPaused;
+
+FSM_STATE_MACHINE(AllocMachine, ABTop) { int ticks = 0; };
+
+FSM_STATE(ABTop, AllocMachine, ABRunning){};
+
+FSM_STATE(ABRunning, ABTop) {
+  using reactions = ufsm::List<ufsm::Reaction<ABEvTick>, ufsm::Transition<ABEvSwitch, ABPaused>>;
+  void React(const ABEvTick&) { OutermostContext().ticks++; }
+};
+
+FSM_STATE(ABPaused, ABTop) { using reactions = ufsm::List<ufsm::Transition<ABEvSwitch, ABRunning>>; };
+
+struct ABIdle;
+
+struct FixedPolicy : ufsm::DefaultPolicy {
+  using PostedQueue = ufsm::FixedEventQueue<4, ufsm::OverflowPolicy::kAssert, ABEvTick, ABEvEcho>;
+  using DeferredQueue = ufsm::FixedEventQueue<4, ufsm::OverflowPolicy::kAssert, ABEvTick, ABEvEcho>;
+};
+
+FSM_STATE_MACHINE(FixedQueueMachine, ABIdle, FixedPolicy) { int ticks = 0; };
+
+FSM_STATE(ABIdle, FixedQueueMachine) {
+  using reactions = ufsm::List<ufsm::Reaction<ABEvEcho>, ufsm::Reaction<ABEvTick>>;
+  void React(const ABEvEcho&) { PostEvent(ABEvTick{}); }
+  void React(const ABEvTick&) { OutermostContext().ticks++; }
+};
+
+const ufsm::AllocationRecord* FindRecord(std::string_view name_part) {
+  for (auto* r = ufsm::AllocationStats::Records(); r; r = r->next)
+    if (r->name.find(name_part) != std::string_view::npos) return r;
+  return nullptr;
+}
+
+}  // namespace
+
+TEST(AllocationBehaviorTest, SteadyStateDispatchDoesNotAllocate) {
+  AllocMachine machine;
+  machine.Initiate();
+  machine.ProcessEvent(ABEvTick{});
+
+  ufsm::NoAllocScope scope;
+  for (int i = 0; i < 1000; ++i) machine.ProcessEvent(ABEvTick{});
+  EXPECT_EQ(scope.Allocations(), 0u);
+  EXPECT_EQ(machine.ticks, 1001);
+}
+
+TEST(AllocationBehaviorTest, PostingIntoFixedQueueDoesNotAllocate) {
+  FixedQueueMachine machine;
+  machine.Initiate();
+
+  ufsm::NoAllocScope scope;
+  for (int i = 0; i < 1000; ++i) machine.ProcessEvent(ABEvEcho{});
+  EXPECT_EQ(scope.Allocations(), 0u);
+  EXPECT_EQ(machine.ticks, 1000);
+}
+
+TEST(AllocationBehaviorTest, ScopeCountsTransitionsAndPostedClones) {
+  AllocMachine machine;
+  machine.Initiate();
+
+  ufsm::NoAllocScope scope(false);
+  machine.ProcessEvent(ABEvSwitch{});
+  EXPECT_EQ(scope.Allocations(), 1u);  // ABPaused
+
+  {
+    ufsm::NoAllocScope inner(false);
+    machine.PostEvent(ABEvSwitch{});  // Queue storage, then the clone.
+    EXPECT_EQ(inner.Allocations(), 2u);
+  }
+  EXPECT_EQ(scope.Allocations(), 3u);
+}
+
+TEST(AllocationBehaviorTest, StatsAreBrokenDownByType) {
+  AllocMachine machine;
+  machine.Initiate();
+  ufsm::AllocationStats::Reset();
+
+  machine.ProcessEvent(ABEvSwitch{});
+  machine.ProcessEvent(ABEvSwitch{});
+  machine.PostEvent(ABEvTick{});
+
+  auto* paused = FindRecord("ABPaused");
+  ASSERT_NE(paused, nullptr);
+  EXPECT_EQ(paused->kind, ufsm::AllocationKind::kState);
+  EXPECT_EQ(paused->count.load(), 1u);
+  EXPECT_EQ(paused->bytes.load(), sizeof(ABPaused));
+
+  auto* running = FindRecord("ABRunning");
+  ASSERT_NE(running, nullptr);
+  EXPECT_EQ(running->count.load(), 1u);
+
+  auto* tick = FindRecord("ABEvTick");
+  ASSERT_NE(tick, nullptr);
+  EXPECT_EQ(tick->kind, ufsm::AllocationKind::kEvent);
+  EXPECT_EQ(tick->count.load(), 1u);
+
+  EXPECT_EQ(ufsm::AllocationStats::TotalCount(), 4u);  // Two states, the queue storage and one clone.
+}
@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+
+#include <ufsm/ufsm.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+FSM_EVENT(BEvPacket) {
+  explicit BEvPacket(ufsm::Payload p) : payload(std::move(p)) {}
+  BEvPacket Own() const { return BEvPacket{payload.Own()}; }
+  ufsm::Payload payload;
+};
+
+FSM_EVENT(BEvFrame) {
+  static constexpr auto conflation = ufsm::Conflation::kKeepLatest;
+  explicit BEvFrame(ufsm::Payload p) : payload(std::move(p)) {}
+  BEvFrame Own() const { return BEvFrame{payload.Own()}; }
+  ufsm::Payload payload;
+};
+
+FSM_EVENT(BEvOpen){};
+
+struct BEClosed;
+struct BEOpen;
+
+FSM_STATE_MACHINE(BEMachine, BEClosed) {
+  std::vector<std::string> seen;
+  std::vector<const unsigned char*> data;  // Where each dispatched payload was read from.
+  bool repost = false;
+
+  void See(const ufsm::Payload& payload) {
+    seen.emplace_back(payload.view());
+    data.push_back(payload.data());
+  }
+};
+
+FSM_STATE(BEClosed, BEMachine) {
+  using reactions = ufsm::List<ufsm::Deferral<BEvPacket>, ufsm::Reaction<BEvFrame>, ufsm::Transition<BEvOpen, BEOpen>>;
+  void React(const BEvFrame& e) { OutermostContext().See(e.payload); }
+};
+
+FSM_STATE(BEOpen, BEMachine) {
+  using reactions = ufsm::List<ufsm::Reaction<BEvPacket>, ufsm::Reaction<BEvFrame>>;
+  void React(const BEvFrame& e) { OutermostContext().See(e.payload); }
+  void React(const BEvPacket& e) {
+    auto& machine = OutermostContext();
+    machine.See(e.payload);
+    if (machine.repost) {
+      machine.repost = false;
+      PostEvent(e);
+    }
+  }
+};
+
+}  // namespace
+
+TEST(BorrowedEventBehaviorTest, DispatchReadsTheCallersBytes) {
+  BEMachine machine;
+  machine.Initiate();
+  machine.ProcessEvent(BEvOpen{});
+  std::string buffer = "hello";
+
+  ufsm::NoAllocScope no_alloc;
+  machine.ProcessEvent(BEvPacket{ufsm::Payload::Borrow(buffer)});
+  EXPECT_EQ(machine.seen, (std::vector<std::string>{"hello"}));
+  EXPECT_EQ(machine.data[0], reinterpret_cast<const unsigned char*>(buffer.data()));
+  EXPECT_EQ(no_alloc.Allocations(), 0u);
+}
+
+TEST(BorrowedEventBehaviorTest, DeferredEventOwnsACopyOfBorrowedBytes) {
+  BEMachine machine;
+  machine.Initiate();
+  std::string buffer = "first";
+  machine.ProcessEvent(BEvPacket{ufsm::Payload::Borrow(buffer)});
+  buffer = "XXXXX";  // The caller reuses its buffer.
+
+  machine.ProcessEvent(BEvOpen{});
+  EXPECT_EQ(machine.seen, (std::vector<std::string>{"first"}));
+  EXPECT_NE(machine.data[0], reinterpret_cast<const unsigned char*>(buffer.data()));
+}
+
+TEST(BorrowedEventBehaviorTest, SharedBufferIsKeptAliveByItsHandle) {
+  BEMachine machine;
+  machine.Initiate();
+  auto buffer = std::make_shared<std::string>("shared");
+  machine.ProcessEvent(BEvPacket{ufsm::Payload::Share(buffer, buffer->data(), buffer->size())});
+  EXPECT_EQ(buffer.use_count(), 2);
+
+  const auto* bytes = reinterpret_cast<const unsigned char*>(buffer->data());
+  buffer.reset();
+  machine.ProcessEvent(BEvOpen{});
+  EXPECT_EQ(machine.seen, (std::vector<std::string>{"shared"}));
+  EXPECT_EQ(machine.data[0], bytes);  // Not copied.
+}
+
+TEST(BorrowedEventBehaviorTest, RepostedAndConflatedEventsOwnTheirBytes) {
+  BEMachine machine;
+  machine.Initiate();
+  std::string a = "aa", b = "bb";
+  machine.PostEvent(BEvFrame{ufsm::Payload::Borrow(a)});
+  machine.PostEvent(BEvFrame{ufsm::Payload::Borrow(b)});  // Replaces the pending frame.
+  b = "XX";
+  machine.ProcessEvent(BEvOpen{});
+  EXPECT_EQ(machine.seen, (std::vector<std::string>{"bb"}));
+
+  machine.repost = true;
+  std::string c = "cc";
+  machine.ProcessEvent(BEvPacket{ufsm::Payload::Borrow(c)});
+  EXPECT_EQ(machine.seen, (std::vector<std::string>{"bb", "cc", "cc"}));
+  EXPECT_NE(machine.data[2], reinterpret_cast<const unsigned char*>(c.data()));
+}
@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+
+#include <ufsm/broadcast.h>
+
+#include <memory>
+#include <vector>
+
+FSM_EVENT(BcEvTick){};
+FSM_EVENT(BcEvNext){};
+
+struct BcA;
+struct BcB;
+struct BcC;
+
+std::vector<int> bc_visits;  // Machine ids in dispatch order.
+
+FSM_STATE_MACHINE(BcMachine, BcA) {
+  explicit BcMachine(int id = 0) : id(id) {}
+  int id;
+  int ticks = 0;
+};
+
+FSM_STATE(BcA, BcMachine) {
+  using reactions = ufsm::List<ufsm::Reaction<BcEvTick>, ufsm::Transition<BcEvNext, BcB>>;
+  ufsm::Result React(const BcEvTick&) {
+    bc_visits.push_back(OutermostContext().id);
+    ++OutermostContext().ticks;
+    // Moving on does not make the machine receive the broadcast twice.
+    return Transit<BcB>();
+  }
+};
+
+FSM_STATE(BcB, BcMachine) {
+  using reactions = ufsm::List<ufsm::Reaction<BcEvTick>, ufsm::Transition<BcEvNext, BcC>>;
+  ufsm::Result React(const BcEvTick&) {
+    bc_visits.push_back(OutermostContext().id);
+    ++OutermostContext().ticks;
+    return DiscardEvent();
+  }
+};
+
+FSM_STATE(BcC, BcMachine) {
+  using reactions = ufsm::List<ufsm::Reaction<BcEvTick>>;
+  ufsm::Result React(const BcEvTick&) {
+    bc_visits.push_back(OutermostContext().id);
+    ++OutermostContext().ticks;
+    return DiscardEvent();
+  }
+};
+
+TEST(BroadcastBehaviorTest, MachinesAreDispatchedGroupedByLeafState) {
+  // Leaf states by id: A B C A B C ...
+  std::vector<std::unique_ptr<BcMachine>> pool;
+  for (int id = 0; id < 9; ++id) {
+    pool.push_back(std::make_unique<BcMachine>(id));
+    pool.back()->Initiate();
+    for (int step = 0; step < id % 3; ++step) pool.back()->ProcessEvent(BcEvNext{});
+  }
+  EXPECT_EQ(pool[0]->LeafTypeId(), pool[3]->LeafTypeId());
+  EXPECT_NE(pool[0]->LeafTypeId(), pool[1]->LeafTypeId());
+
+  bc_visits.clear();
+  EXPECT_EQ(ufsm::Broadcast(pool, BcEvTick{}), 9u);
+  EXPECT_EQ(bc_visits, (std::vector<int>{0, 3, 6, 1, 4, 7, 2, 5, 8}));
+  for (auto& machine : pool) EXPECT_EQ(machine->ticks, 1);
+  EXPECT_TRUE(pool[0]->IsInState<BcB>());
+}
+
+TEST(BroadcastBehaviorTest, AcceptsMachinesByValueAndTerminatedOnes) {
+  std::vector<BcMachine> pool(3);
+  pool[0].Initiate();
+  pool[2].Initiate();
+  EXPECT_EQ(pool[1].LeafTypeId(), nullptr);
+
+  bc_visits.clear();
+  EXPECT_EQ(ufsm::Broadcast(pool, BcEvTick{}), 3u);
+  EXPECT_EQ(pool[0].ticks, 1);
+  EXPECT_EQ(pool[1].ticks, 0);
+  EXPECT_EQ(pool[2].ticks, 1);
+}
+
+TEST(BroadcastBehaviorTest, HibernatedMachinesGroupWithTheirLeafState) {
+  std::vector<BcMachine> pool(2);
+  for (auto& machine : pool) machine.Initiate();
+  const void* leaf = pool[0].LeafTypeId();
+  ASSERT_TRUE(pool[1].Hibernate());
+  EXPECT_EQ(pool[1].LeafTypeId(), leaf);
+
+  bc_visits.clear();
+  ufsm::Broadcast(pool, BcEvTick{});
+  EXPECT_FALSE(pool[1].Hibernated());
+  EXPECT_EQ(pool[1].ticks, 1);
+}
@@ -0,0 +1,179 @@
+#include <gtest/gtest.h>
+
+#include <ufsm/coroutine.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+// Executor with a virtual clock, driven by the test.
+class ManualExecutor {
+ public:
+  void Post(std::function<void()> callback) { PostAfter(0ns, std::move(callback)); }
+  void PostAfter(std::chrono::nanoseconds delay, std::function<void()> callback) {
+    timers_.emplace(now_ + delay, std::move(callback));
+  }
+
+  void Advance(std::chrono::nanoseconds by) {
+    auto until = now_ + by;
+    while (!timers_.empty() && timers_.begin()->first <= until) {
+      auto node = timers_.extract(timers_.begin());
+      now_ = node.key();
+      node.mapped()();
+    }
+    now_ = until;
+  }
+
+  std::size_t Pending() const { return timers_.size(); }
+
+ private:
+  std::chrono::nanoseconds now_{0};
+  std::multimap<std::chrono::nanoseconds, std::function<void()>> timers_;
+};
+
+std::vector<std::string> log;
+
+struct FrameProbe {
+  ~FrameProbe() { log.emplace_back("frame destroyed"); }
+};
+
+}  // namespace
+
+FSM_EVENT(CoEvConnected){};
+FSM_EVENT(CoEvReady) {
+  explicit CoEvReady(int v) : value(v) {}
+  int value;
+};
+FSM_EVENT(CoEvAbort){};
+
+struct CoConnecting;
+struct CoReady;
+struct CoIdle;
+
+FSM_STATE_MACHINE(CoMachine, CoConnecting) {
+  ManualExecutor executor;
+  std::function<void()> handshake_done;  // Completion of the pending handshake, if any.
+  int value = 0;
+};
+
+FSM_STATE(CoConnecting, CoMachine) {
+  using reactions = ufsm::List<ufsm::Transition<CoEvConnected, CoReady>, ufsm::Transition<CoEvAbort, CoIdle>>;
+
+  void OnEntry() { activity = Connect(); }
+
+  ufsm::Activity Connect() {
+    FrameProbe probe;
+    log.emplace_back("connecting");
+    co_await ufsm::Delay(OutermostContext().executor, 10ms);
+    log.emplace_back("connected");
+    PostEvent(CoEvConnected{});
+    // Exiting the state right after posting does not tear down the running frame.
+    co_await ufsm::Yield(OutermostContext().executor);
+    log.emplace_back("not reached");
+  }
+
+  ufsm::Activity activity;
+};
+
+FSM_STATE(CoReady, CoMachine) {
+  using reactions = ufsm::List<ufsm::Reaction<CoEvReady>, ufsm::Transition<CoEvAbort, CoIdle>>;
+
+  void OnEntry() { activity = Handshake(); }
+
+  ufsm::Activity Handshake() {
+    int value = co_await ufsm::AwaitCallback<int>(
+        [this](auto done) { OutermostContext().handshake_done = [done] { done(42); }; });
+    log.emplace_back("handshake " + std::to_string(value));
+    PostEvent(CoEvReady{value});
+  }
+
+  ufsm::Result React(const CoEvReady& ev) {
+    OutermostContext().value = ev.value;
+    log.emplace_back(std::string("ready, activity done: ") + (activity.Done() ? "yes" : "no"));
+    return DiscardEvent();
+  }
+
+  ufsm::Activity activity;
+};
+
+FSM_STATE(CoIdle, CoMachine){};
+
+TEST(CoroutineActivityBehaviorTest, ActivityResumesThroughTheMachine) {
+  log.clear();
+  CoMachine machine;
+  machine.Initiate();
+  EXPECT_EQ(log, (std::vector<std::string>{"connecting"}));
+
+  machine.executor.Advance(5ms);
+  EXPECT_TRUE(machine.IsInState<CoConnecting>());
+
+  machine.executor.Advance(5ms);
+  EXPECT_TRUE(machine.IsInState<CoReady>());
+  EXPECT_EQ(log, (std::vector<std::string>{"connecting", "connected", "frame destroyed"}));
+
+  ASSERT_TRUE(machine.handshake_done);
+  machine.handshake_done();
+  EXPECT_EQ(machine.value, 42);
+  EXPECT_EQ(log.back(), "ready, activity done: yes");
+
+  // The yield posted by the cancelled activity is a no-op.
+  machine.executor.Advance(1ms);
+  EXPECT_EQ(machine.executor.Pending(), 0u);
+  EXPECT_EQ(std::count(log.begin(), log.end(), "not reached"), 0);
+}
+
+TEST(CoroutineActivityBehaviorTest, ExitingTheStateCancelsThePendingActivity) {
+  log.clear();
+  CoMachine machine;
+  machine.Initiate();
+  machine.ProcessEvent(CoEvAbort{});
+  EXPECT_TRUE(machine.IsInState<CoIdle>());
+  EXPECT_EQ(log, (std::vector<std::string>{"connecting", "frame destroyed"}));
+
+  // The timer still fires but finds the activity gone.
+  machine.executor.Advance(10ms);
+  EXPECT_TRUE(machine.IsInState<CoIdle>());
+  EXPECT_EQ(log.size(), 2u);
+}
+
+TEST(CoroutineActivityBehaviorTest, LateCompletionIsIgnoredAfterCancellation) {
+  log.clear();
+  CoMachine machine;
+  machine.Initiate();
+  machine.executor.Advance(10ms);
+  ASSERT_TRUE(machine.IsInState<CoReady>());
+
+  machine.ProcessEvent(CoEvAbort{});
+  machine.handshake_done();
+  EXPECT_TRUE(machine.IsInState<CoIdle>());
+  EXPECT_EQ(machine.value, 0);
+}
+
+struct CoInline;
+
+FSM_STATE_MACHINE(CoInlineMachine, CoInline){};
+
+FSM_STATE(CoInline, CoInlineMachine) {
+  void OnEntry() { activity = Run(); }
+
+  ufsm::Activity Run() {
+    int value = co_await ufsm::AwaitCallback<int>([](auto done) { done(7); });
+    log.emplace_back("inline " + std::to_string(value));
+  }
+
+  ufsm::Activity activity;
+};
+
+TEST(CoroutineActivityBehaviorTest, InlineCompletionDoesNotSuspend) {
+  log.clear();
+  CoInlineMachine machine;
+  machine.Initiate();
+  EXPECT_EQ(log, (std::vector<std::string>{"inline 7"}));
+}
@@ -156,4 +156,17 @@ TEST(deferral_behavior, defer_event_helper_defers_current_event_until_state_exit
   EXPECT_EQ(sm.seq[0], 42);
 }
 
+TEST(deferral_behavior, deferred_events_released_by_posted_event_are_dispatched) {
+  DeferSm sm;
+  sm.Initiate();
+
+  sm.ProcessEvent(EvPayload{});
+  sm.PostEvent(EvGo{});
+
+  // EvGo is dispatched from the posted queue and releases the deferred payload to the front of that queue.
+  sm.ProcessEvent(EvMarker{});
+  ASSERT_EQ(sm.seq.size(), 1u);
+  EXPECT_EQ(sm.seq[0], 42);
+}
+
 }  // namespace
@@ -0,0 +1,159 @@
+#include <gtest/gtest.h>
+
+#include <ufsm/ufsm.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using namespace std::chrono_literals;
+
+FSM_EVENT(DTEvRequest) {
+  static constexpr auto ttl = 2ms;
+  explicit DTEvRequest(int v) : value(v) {}
+  int value;
+};
+FSM_EVENT(DTEvCommand) {
+  explicit DTEvCommand(int v) : value(v) {}
+  int value;
+};
+FSM_EVENT(DTEvOpen){};
+FSM_EVENT(DTEvPing){};
+// Long-lived, and counts its copies: a bounded deferred queue copies an event each time it is moved within it.
+FSM_EVENT(DTEvLease) {
+  static constexpr auto ttl = std::chrono::hours(1);
+  explicit DTEvLease(int* copies) : copies(copies) {}
+  DTEvLease(const DTEvLease& other) : ufsm::Event<DTEvLease>(other), copies(other.copies) { ++*copies; }
+  int* copies;
+};
+
+struct DTPolicy : ufsm::DefaultPolicy {
+  static constexpr bool kDeferredTtl = true;
+};
+
+struct DTCappedPolicy : ufsm::DefaultPolicy {
+  static constexpr std::size_t kMaxDeferred = 2;
+};
+
+struct DTFixedPolicy : ufsm::DefaultPolicy {
+  static constexpr bool kDeferredTtl = true;
+  using PostedQueue = ufsm::FixedEventQueue<3, ufsm::OverflowPolicy::kAssert, DTEvRequest, DTEvCommand>;
+  using DeferredQueue = ufsm::FixedEventQueue<3, ufsm::OverflowPolicy::kDropOldest, DTEvRequest, DTEvCommand>;
+};
+
+struct DTLeasePolicy : ufsm::DefaultPolicy {
+  static constexpr bool kDeferredTtl = true;
+  using DeferredQueue = ufsm::FixedEventQueue<64, ufsm::OverflowPolicy::kAssert, DTEvLease>;
+};
+
+template <typename Policy>
+struct DTClosed;
+template <typename Policy>
+struct DTOpen;
+
+template <typename Policy>
+struct DTMachine : ufsm::StateMachine<DTMachine<Policy>, DTClosed<Policy>, Policy> {
+  std::vector<int> seen;
+  std::vector<int> dropped;
+
+  void OnDeferredEventDropped(const ufsm::detail::EventBase& e) {
+    if (e.TypeId() == DTEvRequest{0}.TypeId()) {
+      dropped.push_back(static_cast<const DTEvRequest&>(e).value);
+    } else {
+      dropped.push_back(static_cast<const DTEvCommand&>(e).value);
+    }
+  }
+};
+
+template <typename Policy>
+struct DTClosed : ufsm::State<DTClosed<Policy>, DTMachine<Policy>> {
+  using reactions = ufsm::List<ufsm::Deferral<DTEvRequest>, ufsm::Deferral<DTEvCommand>, ufsm::Deferral<DTEvLease>,
+                               ufsm::Transition<DTEvOpen, DTOpen<Policy>>>;
+};
+
+template <typename Policy>
+struct DTOpen : ufsm::State<DTOpen<Policy>, DTMachine<Policy>> {
+  using reactions = ufsm::List<ufsm::Reaction<DTEvRequest>, ufsm::Reaction<DTEvCommand>>;
+  void React(const DTEvRequest& e) { this->OutermostContext().seen.push_back(e.value); }
+  void React(const DTEvCommand& e) { this->OutermostContext().seen.push_back(e.value); }
+};
+
+using DTAging = DTMachine<DTPolicy>;
+
+}  // namespace
+
+TEST(DeferredTtlBehaviorTest, ExpiredEventsAreDroppedInsteadOfReplayed) {
+  DTAging machine;
+  machine.Initiate();
+  machine.ProcessEvent(DTEvRequest{1});
+  machine.ProcessEvent(DTEvCommand{2});
+  std::this_thread::sleep_for(5ms);
+  machine.ProcessEvent(DTEvRequest{3});
+
+  machine.ProcessEvent(DTEvOpen{});
+  EXPECT_EQ(machine.dropped, (std::vector<int>{1}));
+  EXPECT_EQ(machine.seen, (std::vector<int>{2, 3}));
+}
+
+TEST(DeferredTtlBehaviorTest, IdleMachineExpiresOnRequestKeepingOrder) {
+  DTAging machine;
+  machine.Initiate();
+  machine.ProcessEvent(DTEvCommand{1});
+  machine.ProcessEvent(DTEvRequest{2});
+  machine.ProcessEvent(DTEvCommand{3});
+  machine.ExpireDeferredEvents();
+  EXPECT_EQ(machine.DeferredDepth(), 3u);
+
+  std::this_thread::sleep_for(5ms);
+  machine.ExpireDeferredEvents();
+  EXPECT_EQ(machine.DeferredDepth(), 2u);
+  EXPECT_EQ(machine.dropped, (std::vector<int>{2}));
+
+  machine.ProcessEvent(DTEvOpen{});
+  EXPECT_EQ(machine.seen, (std::vector<int>{1, 3}));
+}
+
+TEST(DeferredTtlBehaviorTest, MaxDeferredDropsOldestFirst) {
+  DTMachine<DTCappedPolicy> machine;
+  machine.Initiate();
+  for (int i = 1; i <= 4; ++i) machine.ProcessEvent(DTEvCommand{i});
+  EXPECT_EQ(machine.DeferredDepth(), 2u);
+  EXPECT_EQ(machine.dropped, (std::vector<int>{1, 2}));
+
+  machine.ProcessEvent(DTEvOpen{});
+  EXPECT_EQ(machine.seen, (std::vector<int>{3, 4}));
+}
+
+TEST(DeferredTtlBehaviorTest, BoundedQueueKeepsDeadlinesInStepWithoutAllocating) {
+  DTMachine<DTFixedPolicy> machine;
+  machine.Initiate();
+  {
+    ufsm::NoAllocScope no_alloc;
+    machine.ProcessEvent(DTEvRequest{1});
+    for (int i = 2; i <= 4; ++i) machine.ProcessEvent(DTEvCommand{i});  // Pushes out 1 with its deadline.
+    machine.ProcessEvent(DTEvRequest{5});                               // Pushes out 2.
+    std::this_thread::sleep_for(5ms);
+    machine.ExpireDeferredEvents();
+    EXPECT_EQ(machine.dropped, (std::vector<int>{5}));
+    EXPECT_EQ(no_alloc.Allocations(), 0u);
+  }
+  machine.ProcessEvent(DTEvOpen{});
+  EXPECT_EQ(machine.seen, (std::vector<int>{3, 4}));
+}
+
+TEST(DeferredTtlBehaviorTest, UnexpiredDeadlinesLeaveTheQueueAlone) {
+  int copies = 0;
+  DTMachine<DTLeasePolicy> machine;
+  machine.Initiate();
+  for (int i = 0; i < 50; ++i) machine.ProcessEvent(DTEvLease{&copies});
+  EXPECT_EQ(copies, 50);
+
+  // Nothing is due, so neither unrelated events nor an explicit expiry move the deferred events.
+  for (int i = 0; i < 50; ++i) machine.ProcessEvent(DTEvPing{});
+  machine.ExpireDeferredEvents();
+  EXPECT_EQ(copies, 50);
+  EXPECT_EQ(machine.DeferredDepth(), 50u);
+  EXPECT_TRUE(machine.dropped.empty());
+}
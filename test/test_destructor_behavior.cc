@@ -1,6 +1,10 @@
 #include <gtest/gtest.h>
 
 #include <ufsm/ufsm.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include "test_support.h"
@@ -86,3 +90,51 @@ TEST(DestructorBehaviorTest, DestructorTerminatesInAllScenarios) {
                                                       "DStateB",
                                                   });
 }
+
+FSM_EVENT(DEventValue){};
+FSM_EVENT(DEventStale) { static constexpr auto ttl = std::chrono::milliseconds(1); };
+
+struct DQueueClosed;
+
+// Every queue hook enabled: a full posted queue, watermarks on both queues, deferred TTLs and sojourn times.
+struct DQueuePolicy : ufsm::DefaultPolicy {
+  using PostedQueue = ufsm::FixedEventQueue<2, ufsm::OverflowPolicy::kCallHook, DEventValue, DEventStale>;
+  static constexpr ufsm::Watermarks kPostedWatermarks{2, 0};
+  static constexpr ufsm::Watermarks kDeferredWatermarks{2, 0};
+  static constexpr bool kDeferredTtl = true;
+  static constexpr bool kQueueSojourn = true;
+};
+
+FSM_STATE_MACHINE(DQueueMachine, DQueueClosed, DQueuePolicy) {
+  // Static, so that it can be read after the machine is gone.
+  static inline std::vector<std::string> hooks;
+
+  void OnQueueHigh(ufsm::QueueKind, std::size_t) { hooks.emplace_back("OnQueueHigh"); }
+  void OnQueueLow(ufsm::QueueKind, std::size_t) { hooks.emplace_back("OnQueueLow"); }
+  void OnQueueOverflow(const ufsm::detail::EventBase&) { hooks.emplace_back("OnQueueOverflow"); }
+  void OnDeferredEventDropped(const ufsm::detail::EventBase&) { hooks.emplace_back("OnDeferredEventDropped"); }
+  void OnEventSojourn(ufsm::QueueKind, const ufsm::detail::EventBase&, std::chrono::nanoseconds) {
+    hooks.emplace_back("OnEventSojourn");
+  }
+};
+
+FSM_STATE(DQueueClosed, DQueueMachine) {
+  using reactions = ufsm::List<ufsm::Deferral<DEventValue>, ufsm::Deferral<DEventStale>>;
+};
+
+TEST(DestructorBehaviorTest, DestructorCallsNoQueueHook) {
+  {
+    DQueueMachine machine;
+    machine.Initiate();
+    machine.ProcessEvent(DEventStale{});
+    for (int i = 0; i < 3; ++i) machine.ProcessEvent(DEventValue{});
+    machine.PostEvent(DEventValue{});
+    machine.PostEvent(DEventValue{});
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    ExpectSeq(DQueueMachine::hooks, {"OnQueueHigh", "OnQueueHigh"});
+    DQueueMachine::hooks.clear();
+    // Exiting DQueueClosed drops the stale event, times the others and overflows the posted queue with them, and
+    // takes both queues down to their low watermarks, all once DQueueMachine itself is gone.
+  }
+  ExpectSeq(DQueueMachine::hooks, {});
+}
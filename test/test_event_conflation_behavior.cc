@@ -0,0 +1,132 @@
+#include <gtest/gtest.h>
+
+#include <ufsm/ufsm.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+FSM_EVENT(CFEvLevel) {
+  static constexpr auto conflation = ufsm::Conflation::kKeepLatest;
+  explicit CFEvLevel(int v) : level(v) {}
+  int level;
+};
+
+FSM_EVENT(CFEvDelta) {
+  static constexpr auto conflation = ufsm::Conflation::kMerge;
+  explicit CFEvDelta(int d) : delta(d) {}
+  void Merge(const CFEvDelta& newer) {
+    delta += newer.delta;
+    ++merged;
+  }
+  int delta;
+  int merged = 0;
+};
+
+FSM_EVENT(CFEvMarker) {
+  explicit CFEvMarker(int v) : value(v) {}
+  int value;
+};
+
+FSM_EVENT(CFEvFlood){};
+
+template <typename Policy>
+struct CFIdle;
+
+template <typename Policy>
+struct CFMachine : ufsm::StateMachine<CFMachine<Policy>, CFIdle<Policy>, Policy> {
+  std::vector<std::string> seen;
+  bool echo = false;  // Post the next level while processing one.
+};
+
+template <typename Policy>
+struct CFIdle : ufsm::State<CFIdle<Policy>, CFMachine<Policy>> {
+  using reactions = ufsm::List<ufsm::Reaction<CFEvLevel>, ufsm::Reaction<CFEvDelta>, ufsm::Reaction<CFEvMarker>,
+                               ufsm::Reaction<CFEvFlood>>;
+
+  void React(const CFEvLevel& e) {
+    auto& machine = this->OutermostContext();
+    machine.seen.push_back("level " + std::to_string(e.level));
+    if (machine.echo && e.level < 3) this->PostEvent(CFEvLevel{e.level + 1});
+  }
+  void React(const CFEvDelta& e) {
+    this->OutermostContext().seen.push_back("delta " + std::to_string(e.delta) + " x" + std::to_string(e.merged + 1));
+  }
+  void React(const CFEvMarker& e) { this->OutermostContext().seen.push_back("marker " + std::to_string(e.value)); }
+  void React(const CFEvFlood&) {
+    for (int i = 1; i <= 100; ++i) {
+      this->PostEvent(CFEvLevel{i});
+      this->PostEvent(CFEvDelta{1});
+    }
+  }
+};
+
+// Two slots, asserting on overflow.
+struct CFBoundedPolicy : ufsm::DefaultPolicy {
+  using PostedQueue = ufsm::FixedEventQueue<2, ufsm::OverflowPolicy::kAssert, CFEvLevel, CFEvDelta, CFEvMarker>;
+};
+
+struct CFLanesPolicy : ufsm::DefaultPolicy {
+  using PostedQueue = ufsm::PriorityEventQueue<2, 4, ufsm::OverflowPolicy::kAssert, CFEvLevel, CFEvDelta, CFEvMarker>;
+};
+
+using CFDynamic = CFMachine<ufsm::DefaultPolicy>;
+
+}  // namespace
+
+TEST(EventConflationBehaviorTest, LatestValueReplacesPendingOneInPlace) {
+  CFDynamic machine;
+  machine.Initiate();
+  machine.PostEvent(CFEvLevel{1});
+  machine.PostEvent(CFEvMarker{0});
+  machine.PostEvent(CFEvLevel{2});
+  machine.PostEvent(CFEvLevel{3});
+  machine.ProcessEvent(CFEvMarker{-1});
+  EXPECT_EQ(machine.seen, (std::vector<std::string>{"marker -1", "level 3", "marker 0"}));
+}
+
+TEST(EventConflationBehaviorTest, MergeHookFoldsPendingEvents) {
+  CFDynamic machine;
+  machine.Initiate();
+  for (int i = 1; i <= 4; ++i) machine.PostEvent(CFEvDelta{i});
+  machine.ProcessEvent(CFEvMarker{0});
+  EXPECT_EQ(machine.seen, (std::vector<std::string>{"marker 0", "delta 10 x4"}));
+}
+
+TEST(EventConflationBehaviorTest, EventsWithoutConflationAreAllQueued) {
+  CFDynamic machine;
+  machine.Initiate();
+  machine.PostEvent(CFEvMarker{1});
+  machine.PostEvent(CFEvMarker{2});
+  machine.ProcessEvent(CFEvMarker{0});
+  EXPECT_EQ(machine.seen, (std::vector<std::string>{"marker 0", "marker 1", "marker 2"}));
+}
+
+TEST(EventConflationBehaviorTest, EventBeingProcessedIsNoLongerPending) {
+  CFDynamic machine;
+  machine.Initiate();
+  machine.echo = true;
+  machine.ProcessEvent(CFEvLevel{1});
+  EXPECT_EQ(machine.seen, (std::vector<std::string>{"level 1", "level 2", "level 3"}));
+}
+
+TEST(EventConflationBehaviorTest, FloodFitsBoundedQueueAndCostsOneDispatchPerType) {
+  CFMachine<CFBoundedPolicy> machine;
+  machine.Initiate();
+  ufsm::NoAllocScope no_alloc;
+  machine.ProcessEvent(CFEvFlood{});
+  EXPECT_EQ(machine.seen, (std::vector<std::string>{"level 100", "delta 100 x100"}));
+  EXPECT_EQ(no_alloc.Allocations(), 0u);
+}
+
+TEST(EventConflationBehaviorTest, PriorityLanesConflateWithinALane) {
+  CFMachine<CFLanesPolicy> machine;
+  machine.Initiate();
+  machine.PostEvent(CFEvLevel{1});
+  machine.PostEvent(CFEvLevel{2}, 1);
+  machine.PostEvent(CFEvLevel{3});
+  machine.PostEvent(CFEvLevel{4}, 1);
+  machine.ProcessEvent(CFEvMarker{0});
+  EXPECT_EQ(machine.seen, (std::vector<std::string>{"marker 0", "level 4", "level 3"}));
+}
@@ -0,0 +1,259 @@
+#include <gtest/gtest.h>
+
+#include <ufsm/journal.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+FSM_EVENT(EJEvStart) { static constexpr ufsm::WireId wire_id = 1; };
+FSM_EVENT(EJEvStop) { static constexpr ufsm::WireId wire_id = 2; };
+
+FSM_EVENT(EJEvSpeed) {
+  static constexpr ufsm::WireId wire_id = 3;
+  explicit EJEvSpeed(std::int32_t v) : value(v) {}
+  std::size_t Encode(unsigned char* out, std::size_t capacity) const {
+    if (capacity >= sizeof(value)) std::memcpy(out, &value, sizeof(value));
+    return sizeof(value);
+  }
+  static ufsm::detail::EventBase* Decode(std::string_view bytes, void* storage) {
+    if (bytes.size() != sizeof(std::int32_t)) return nullptr;
+    std::int32_t value;
+    std::memcpy(&value, bytes.data(), sizeof(value));
+    return new (storage) EJEvSpeed(value);
+  }
+  std::int32_t value;
+};
+
+template <class Ev>
+ufsm::detail::EventBase* DecodeEmpty(std::string_view bytes, void* storage) {
+  return bytes.empty() ? new (storage) Ev() : nullptr;
+}
+
+struct EJIdle;
+struct EJRunning;
+
+// Small queues with every queue hook enabled, so that replay has hooks to skip.
+struct EJPolicy : ufsm::DefaultPolicy {
+  using PostedQueue = ufsm::FixedEventQueue<1, ufsm::OverflowPolicy::kCallHook, EJEvStart, EJEvStop, EJEvSpeed>;
+  static constexpr ufsm::Watermarks kPostedWatermarks{1, 0};
+  static constexpr ufsm::Watermarks kDeferredWatermarks{1, 0};
+  static constexpr std::size_t kMaxDeferred = 1;
+  static constexpr bool kQueueSojourn = true;
+};
+
+FSM_STATE_MACHINE(EJMachine, EJIdle, EJPolicy) {
+  void OnEventProcessed(const ufsm::detail::StateBase*, const ufsm::detail::EventBase&, ufsm::Result) { ++observed; }
+  void OnUnhandledEvent(const ufsm::detail::EventBase&) { ++unhandled; }
+  void OnQueueHigh(ufsm::QueueKind, std::size_t) { ++queue_hooks; }
+  void OnQueueLow(ufsm::QueueKind, std::size_t) { ++queue_hooks; }
+  void OnQueueOverflow(const ufsm::detail::EventBase&) { ++queue_hooks; }
+  void OnDeferredEventDropped(const ufsm::detail::EventBase&) { ++queue_hooks; }
+  void OnEventSojourn(ufsm::QueueKind, const ufsm::detail::EventBase&, std::chrono::nanoseconds) { ++queue_hooks; }
+  std::int64_t total = 0;
+  int observed = 0;
+  int unhandled = 0;
+  int queue_hooks = 0;
+};
+
+// Keeps only the latest speed until started.
+FSM_STATE(EJIdle, EJMachine) {
+  using reactions = ufsm::List<ufsm::Deferral<EJEvSpeed>, ufsm::Transition<EJEvStart, EJRunning>>;
+};
+
+FSM_STATE(EJRunning, EJMachine) {
+  static constexpr ufsm::WireId journal_id = ufsm::HashWireName("ej.running");
+  using reactions = ufsm::List<ufsm::Reaction<EJEvSpeed>, ufsm::Transition<EJEvStop, EJIdle>>;
+  // A zero speed posts two more into the one-slot posted queue, overflowing it.
+  void React(const EJEvSpeed& e) {
+    OutermostContext().total += e.value;
+    if (e.value == 0) {
+      PostEvent(EJEvSpeed{1});
+      PostEvent(EJEvSpeed{2});
+    }
+  }
+};
+
+class EventJournalBehaviorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    prefix_ = ::testing::TempDir() + "ufsm_journal_" + ::testing::UnitTest::GetInstance()->current_test_info()->name();
+    RemoveSegments();
+    ASSERT_TRUE(registry_.Register<EJEvStart>(&DecodeEmpty<EJEvStart>));
+    ASSERT_TRUE(registry_.Register<EJEvStop>(&DecodeEmpty<EJEvStop>));
+    ASSERT_TRUE(registry_.Register<EJEvSpeed>());
+  }
+  void TearDown() override { RemoveSegments(); }
+
+  void RemoveSegments() {
+    std::vector<std::uint32_t> sequences;
+    ufsm::detail::ListJournalSegments(prefix_, sequences);
+    for (auto sequence : sequences) std::remove(ufsm::detail::JournalSegmentPath(prefix_, sequence).c_str());
+  }
+
+  std::string prefix_;
+  ufsm::WireRegistry registry_;
+};
+
+}  // namespace
+
+TEST_F(EventJournalBehaviorTest, ReplayRebuildsTheMachineAcrossSegmentsWithoutHooks) {
+  EJMachine machine;
+  machine.Initiate();
+  ufsm::JournalWriter writer;
+  ASSERT_TRUE(writer.Open(prefix_, {256, false}));
+  ufsm::Result result = ufsm::Result::kNoReaction;
+  // Deferred while idle: the second speed pushes the first out.
+  ASSERT_TRUE(writer.Process(machine, EJEvSpeed{1000}));
+  ASSERT_TRUE(writer.Process(machine, EJEvSpeed{2000}));
+  ASSERT_TRUE(writer.Process(machine, EJEvStart{}, &result));
+  EXPECT_EQ(result, ufsm::Result::kConsumed);
+  for (int i = 1; i <= 100; ++i) ASSERT_TRUE(writer.Process(machine, EJEvSpeed{i}));
+  ASSERT_TRUE(writer.Process(machine, EJEvSpeed{0}));
+  ASSERT_TRUE(writer.Process(machine, EJEvStart{}, &result));
+  EXPECT_EQ(result, ufsm::Result::kForwardEvent);
+  EXPECT_TRUE(writer.Sync());
+  EXPECT_EQ(writer.records(), 105u);
+  writer.Close();
+  EXPECT_EQ(machine.total, 2000 + 5050 + 1);
+  // Deferred high, dropped, sojourn and low; posted high, sojourn and low, twice; one overflow.
+  EXPECT_EQ(machine.queue_hooks, 11);
+
+  ufsm::JournalReader reader;
+  ASSERT_TRUE(reader.Open(prefix_));
+  EXPECT_GT(reader.segments().size(), 1u);
+  EJMachine replica;
+  replica.Initiate();
+  std::size_t replayed = 0;
+  ASSERT_TRUE(reader.Replay(replica, registry_, &replayed));
+  EXPECT_EQ(replayed, 105u);
+  EXPECT_TRUE(replica.IsInState<EJRunning>());
+  EXPECT_EQ(replica.total, machine.total);
+  EXPECT_EQ(replica.observed, 0);
+  EXPECT_EQ(replica.unhandled, 0);
+  EXPECT_EQ(replica.queue_hooks, 0);
+  EXPECT_EQ(machine.observed, 107);
+  EXPECT_EQ(machine.unhandled, 1);
+}
+
+TEST_F(EventJournalBehaviorTest, RecordsLeafTransitionsWhenAsked) {
+  EJMachine machine;
+  machine.Initiate();
+  ufsm::JournalWriter writer;
+  ASSERT_TRUE(writer.Open(prefix_, {4096, true}));
+  ASSERT_TRUE(writer.Process(machine, EJEvStart{}));
+  ASSERT_TRUE(writer.Process(machine, EJEvSpeed{5}));
+  ASSERT_TRUE(writer.Process(machine, EJEvStop{}));
+  writer.Close();
+
+  ufsm::JournalReader reader;
+  ASSERT_TRUE(reader.Open(prefix_));
+  std::vector<ufsm::JournalRecord> records;
+  ASSERT_TRUE(reader.ForEach([&](const ufsm::JournalRecord& record) {
+    records.push_back(record);
+    return true;
+  }));
+  ASSERT_EQ(records.size(), 5u);
+  // EJRunning declares a stable journal ID; EJIdle falls back to the hash of its type name.
+  const auto idle = ufsm::JournalStateId<EJIdle>(), running = ufsm::JournalStateId<EJRunning>();
+  EXPECT_EQ(running, ufsm::HashWireName("ej.running"));
+  EXPECT_EQ(idle, ufsm::HashWireName(ufsm::detail::PrettyTypeName<EJIdle>()));
+  EXPECT_EQ(records[1].kind, ufsm::JournalRecordKind::kTransition);
+  EXPECT_EQ(records[1].id, EJEvStart::wire_id);
+  EXPECT_EQ(records[1].from, idle);
+  EXPECT_EQ(records[1].to, running);
+  EXPECT_EQ(records[2].kind, ufsm::JournalRecordKind::kEvent);
+  EXPECT_EQ(records[2].id, EJEvSpeed::wire_id);
+  EXPECT_EQ(records[2].bytes.size(), sizeof(std::int32_t));
+  EXPECT_EQ(records[4].kind, ufsm::JournalRecordKind::kTransition);
+  EXPECT_EQ(records[4].from, running);
+  EXPECT_EQ(records[4].to, idle);
+}
+
+TEST_F(EventJournalBehaviorTest, LostTransitionRecordsDoNotFailProcessedEvents) {
+  EJMachine machine;
+  machine.Initiate();
+  ufsm::JournalWriter writer;
+  // Each segment holds one record without payload, too little for a transition record.
+  constexpr std::size_t kSegment =
+      sizeof(ufsm::detail::JournalSegmentHeader) + sizeof(ufsm::detail::JournalRecordHeader);
+  ASSERT_TRUE(writer.Open(prefix_, {kSegment, true}));
+  EXPECT_TRUE(writer.Process(machine, EJEvStart{}));
+  EXPECT_TRUE(machine.IsInState<EJRunning>());
+  EXPECT_EQ(writer.lost_transitions(), 1u);
+
+  // An event that cannot be written is not processed.
+  EXPECT_FALSE(writer.Process(machine, EJEvSpeed{7}));
+  EXPECT_EQ(errno, EMSGSIZE);
+  EXPECT_EQ(machine.total, 0);
+}
+
+TEST_F(EventJournalBehaviorTest, ReopeningAppendsANewSegment) {
+  ufsm::JournalWriter writer;
+  ASSERT_TRUE(writer.Open(prefix_));
+  ASSERT_TRUE(writer.Append(EJEvSpeed{1}));
+  ASSERT_TRUE(writer.Open(prefix_));
+  EXPECT_EQ(writer.segment(), 1u);
+  ASSERT_TRUE(writer.Append(EJEvSpeed{2}));
+  writer.Close();
+
+  ufsm::JournalReader reader;
+  ASSERT_TRUE(reader.Open(prefix_));
+  EXPECT_EQ(reader.segments(), (std::vector<std::uint32_t>{0, 1}));
+  std::vector<std::uint32_t> segments;
+  ASSERT_TRUE(reader.ForEach([&](const ufsm::JournalRecord& record) {
+    segments.push_back(record.segment);
+    return true;
+  }));
+  EXPECT_EQ(segments, (std::vector<std::uint32_t>{0, 1}));
+}
+
+TEST_F(EventJournalBehaviorTest, FailuresSetErrno) {
+  ufsm::JournalReader reader;
+  errno = 0;
+  EXPECT_FALSE(reader.Open(prefix_));
+  EXPECT_EQ(errno, ENOENT);
+
+  ufsm::JournalWriter writer;
+  EXPECT_FALSE(writer.Append(EJEvStop{}));
+  EXPECT_EQ(errno, EBADF);
+  EXPECT_FALSE(writer.Open(prefix_, {8, false}));
+  EXPECT_EQ(errno, EINVAL);
+  ASSERT_TRUE(writer.Open(prefix_, {32, false}));
+  EXPECT_TRUE(writer.Append(EJEvSpeed{1}));
+  EXPECT_FALSE(writer.AppendTransition(1, 2, 3));  // 20 bytes do not fit after the 16-byte header.
+  EXPECT_EQ(errno, EMSGSIZE);
+  writer.Close();
+
+  // An event the registry does not know stops the replay after the events before it.
+  RemoveSegments();
+  ASSERT_TRUE(writer.Open(prefix_));
+  ASSERT_TRUE(writer.Append(EJEvStart{}));
+  ASSERT_TRUE(writer.Append(EJEvSpeed{7}));
+  writer.Close();
+  ufsm::WireRegistry partial;
+  ASSERT_TRUE(partial.Register<EJEvStart>(&DecodeEmpty<EJEvStart>));
+  ASSERT_TRUE(reader.Open(prefix_));
+  EJMachine replica;
+  replica.Initiate();
+  std::size_t replayed = 0;
+  EXPECT_FALSE(reader.Replay(replica, partial, &replayed));
+  EXPECT_EQ(errno, ENOENT);
+  EXPECT_EQ(replayed, 1u);
+  EXPECT_TRUE(replica.IsInState<EJRunning>());
+
+  // A damaged record kind is reported rather than skipped.
+  std::FILE* file = std::fopen(ufsm::detail::JournalSegmentPath(prefix_, 0).c_str(), "r+b");
+  ASSERT_NE(file, nullptr);
+  const std::uint32_t bad = 9;
+  std::fseek(file, sizeof(ufsm::detail::JournalSegmentHeader), SEEK_SET);
+  std::fwrite(&bad, sizeof(bad), 1, file);
+  std::fclose(file);
+  EXPECT_FALSE(reader.ForEach([](const ufsm::JournalRecord&) { return true; }));
+  EXPECT_EQ(errno, EINVAL);
+}
@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+
+#include <ufsm/ufsm.h>
+
+#include <vector>
+
+namespace {
+
+FSM_EVENT(FQEvValue) {
+  explicit FQEvValue(int v) : value(v) {}
+  int value;
+};
+FSM_EVENT(FQEvFlush){};
+FSM_EVENT(FQEvOpen){};
+
+template <ufsm::OverflowPolicy Overflow>
+struct FQPolicy : ufsm::DefaultPolicy {
+  using PostedQueue = ufsm::FixedEventQueue<3, Overflow, FQEvValue, FQEvFlush, FQEvOpen>;
+  using DeferredQueue = ufsm::FixedEventQueue<2, Overflow, FQEvValue, FQEvFlush, FQEvOpen>;
+};
+
+template <ufsm::OverflowPolicy Overflow>
+struct FQClosed;
+template <ufsm::OverflowPolicy Overflow>
+struct FQOpen;
+
+template <ufsm::OverflowPolicy Overflow>
+struct FQMachine : ufsm::StateMachine<FQMachine<Overflow>, FQClosed<Overflow>, FQPolicy<Overflow>> {
+  std::vector<int> seen;
+  std::vector<const void*> overflowed;
+
+  void OnQueueOverflow(const ufsm::detail::EventBase& e) { overflowed.push_back(e.TypeId()); }
+};
+
+// Defers values until opened.
+template <ufsm::OverflowPolicy Overflow>
+struct FQClosed : ufsm::State<FQClosed<Overflow>, FQMachine<Overflow>> {
+  using reactions =
+      ufsm::List<ufsm::Deferral<FQEvValue>, ufsm::Reaction<FQEvFlush>, ufsm::Transition<FQEvOpen, FQOpen<Overflow>>>;
+
+  // Posting from a reaction fills the posted queue before anything is dispatched.
+  void React(const FQEvFlush&) {
+    for (int i = 0; i < 5; ++i) this->PostEvent(FQEvValue{i});
+    this->PostEvent(FQEvOpen{});
+  }
+};
+
+template <ufsm::OverflowPolicy Overflow>
+struct FQOpen : ufsm::State<FQOpen<Overflow>, FQMachine<Overflow>> {
+  using reactions = ufsm::List<ufsm::Reaction<FQEvValue>>;
+  void React(const FQEvValue& e) { this->OutermostContext().seen.push_back(e.value); }
+};
+
+using DropNewestMachine = FQMachine<ufsm::OverflowPolicy::kDropNewest>;
+using DropOldestMachine = FQMachine<ufsm::OverflowPolicy::kDropOldest>;
+using HookMachine = FQMachine<ufsm::OverflowPolicy::kCallHook>;
+
+}  // namespace
+
+TEST(FixedEventQueueBehaviorTest, StorageIsInlineAndSizedFromLargestEvent) {
+  using Queue = FQPolicy<ufsm::OverflowPolicy::kAssert>::PostedQueue;
+  EXPECT_EQ(Queue::kSlotSize, sizeof(FQEvValue));
+  EXPECT_GE(sizeof(DropNewestMachine), 3 * sizeof(FQEvValue) + 2 * sizeof(FQEvValue));
+  EXPECT_TRUE(Queue::kFits<FQEvOpen>);
+}
+
+TEST(FixedEventQueueBehaviorTest, DeferredEventsAreReleasedInOrder) {
+  DropNewestMachine machine;
+  machine.Initiate();
+
+  machine.ProcessEvent(FQEvValue{1});
+  machine.ProcessEvent(FQEvValue{2});
+  machine.ProcessEvent(FQEvOpen{});
+
+  EXPECT_TRUE(machine.IsInState<FQOpen<ufsm::OverflowPolicy::kDropNewest>>());
+  EXPECT_EQ(machine.seen, (std::vector<int>{1, 2}));
+}
+
+TEST(FixedEventQueueBehaviorTest, DropNewestRejectsEventsPushedIntoFullQueue) {
+  DropNewestMachine machine;
+  machine.Initiate();
+
+  // Posted queue holds 3: values 0..2 are kept, 3, 4 and FQEvOpen are dropped.
+  // The deferred queue holds 2: value 2 is dropped when deferred.
+  machine.ProcessEvent(FQEvFlush{});
+  machine.ProcessEvent(FQEvOpen{});
+  EXPECT_EQ(machine.seen, (std::vector<int>{0, 1}));
+  EXPECT_TRUE(machine.overflowed.empty());
+}
+
+TEST(FixedEventQueueBehaviorTest, DropOldestKeepsMostRecentEvents) {
+  DropOldestMachine machine;
+  machine.Initiate();
+
+  // Posted queue ends up with 3, 4, FQEvOpen; 3 and 4 are deferred and released on open.
+  machine.ProcessEvent(FQEvFlush{});
+  EXPECT_EQ(machine.seen, (std::vector<int>{3, 4}));
+}
+
+TEST(FixedEventQueueBehaviorTest, CallHookReportsDroppedEvents) {
+  HookMachine machine;
+  machine.Initiate();
+
+  machine.ProcessEvent(FQEvFlush{});
+  // Posted overflow: values 3, 4 and FQEvOpen. Deferred overflow: value 2.
+  const void* value = FQEvValue{0}.TypeId();
+  const void* open = FQEvOpen{}.TypeId();
+  EXPECT_EQ(machine.overflowed, (std::vector<const void*>{value, value, open, value}));
+
+  machine.ProcessEvent(FQEvOpen{});
+  EXPECT_EQ(machine.seen, (std::vector<int>{0, 1}));
+}
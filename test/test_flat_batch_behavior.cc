@@ -0,0 +1,124 @@
+#include <gtest/gtest.h>
+
+#include <ufsm/flat.h>
+
+#include <random>
+#include <vector>
+
+FSM_EVENT(FbEvStart){};
+FSM_EVENT(FbEvStop){};
+FSM_EVENT(FbEvAudit){};
+
+struct FbIdle;
+struct FbRunning;
+struct FbAuditing;
+
+int fb_actions = 0;
+
+struct FbCountAction {
+  void operator()() const { ++fb_actions; }
+};
+
+FSM_STATE_MACHINE(FbJob, FbIdle){};
+
+FSM_STATE(FbIdle, FbJob) {
+  using reactions = ufsm::List<ufsm::Transition<FbEvStart, FbRunning>, ufsm::Transition<FbEvAudit, FbAuditing>>;
+};
+
+FSM_STATE(FbRunning, FbJob) {
+  using reactions = ufsm::List<ufsm::Transition<FbEvStop, FbIdle, FbCountAction>, ufsm::Reaction<FbEvAudit>>;
+  ufsm::Result React(const FbEvAudit&) { return ufsm::Result::kConsumed; }
+};
+
+FSM_STATE(FbAuditing, FbJob) { using reactions = ufsm::List<ufsm::Transition<FbEvStop, FbIdle>>; };
+
+using JobPool = ufsm::FlatPool<FbJob>;
+
+namespace {
+
+const ufsm::BatchIsa kIsas[] = {ufsm::BatchIsa::kScalar, ufsm::BatchIsa::kAvx2, ufsm::BatchIsa::kAvx512,
+                                ufsm::BatchIsa::kAuto};
+
+}  // namespace
+
+TEST(FlatBatchBehaviorTest, CustomReactionsAreLeftToTheCaller) {
+  JobPool pool;
+  auto id = pool.Add();
+  pool.ProcessEvent(id, FbEvStart{});
+  EXPECT_EQ(pool.ProcessEvent(id, FbEvAudit{}), ufsm::Result::kNoReaction);
+  EXPECT_TRUE(pool.IsInState<FbRunning>(id));
+
+  std::vector<JobPool::Id> custom;
+  pool.ApplyBatch(FbEvAudit{}, custom);
+  EXPECT_EQ(custom, std::vector<JobPool::Id>{id});
+  EXPECT_TRUE(pool.IsInState<FbRunning>(id));
+}
+
+TEST(FlatBatchBehaviorTest, EveryKernelMatchesProcessEvent) {
+  // Not a multiple of any vector width, so the scalar tail runs too.
+  constexpr std::size_t kInstances = 1000;
+  for (ufsm::BatchIsa isa : kIsas) {
+    if (!JobPool::Supports(isa)) continue;
+    SCOPED_TRACE(static_cast<int>(isa));
+    JobPool batched;
+    JobPool reference;
+    for (std::size_t i = 0; i < kInstances; ++i) {
+      batched.Add();
+      reference.Add();
+    }
+
+    std::mt19937 rng(11);
+    std::vector<JobPool::EventIndex> events(kInstances);
+    for (int round = 0; round < 20; ++round) {
+      std::vector<JobPool::Id> expected_custom;
+      int expected_actions = 0;
+      for (std::size_t id = 0; id < kInstances; ++id) {
+        events[id] = static_cast<JobPool::EventIndex>(rng() % (JobPool::kEventCount + 1));
+        ufsm::Result result = ufsm::Result::kForwardEvent;
+        int before = fb_actions;
+        if (events[id] == JobPool::EventIndexOf<FbEvStart>())
+          result = reference.ProcessEvent(id, FbEvStart{});
+        else if (events[id] == JobPool::EventIndexOf<FbEvStop>())
+          result = reference.ProcessEvent(id, FbEvStop{});
+        else if (events[id] == JobPool::EventIndexOf<FbEvAudit>())
+          result = reference.ProcessEvent(id, FbEvAudit{});
+        expected_actions += fb_actions - before;
+        if (result == ufsm::Result::kNoReaction) expected_custom.push_back(id);
+      }
+
+      std::vector<JobPool::Id> custom;
+      fb_actions = 0;
+      batched.ApplyBatch(events.data(), custom, isa);
+      EXPECT_EQ(fb_actions, expected_actions);
+      EXPECT_EQ(custom, expected_custom);
+      for (std::size_t id = 0; id < kInstances; ++id) ASSERT_EQ(batched.Leaf(id), reference.Leaf(id)) << id;
+    }
+  }
+}
+
+TEST(FlatBatchBehaviorTest, OneEventForEveryInstance) {
+  for (ufsm::BatchIsa isa : kIsas) {
+    if (!JobPool::Supports(isa)) continue;
+    JobPool pool;
+    for (int i = 0; i < 37; ++i) pool.Add();
+    std::vector<JobPool::Id> custom;
+    pool.ApplyBatch(FbEvStart{}, custom, isa);
+    pool.ApplyBatch(FbEvAudit{}, custom, isa);
+    EXPECT_EQ(custom.size(), 37u);
+    fb_actions = 0;
+    pool.ApplyBatch(FbEvStop{}, custom, isa);
+    EXPECT_EQ(fb_actions, 37);
+    for (JobPool::Id id = 0; id < pool.Size(); ++id) EXPECT_TRUE(pool.IsInState<FbIdle>(id));
+  }
+}
+
+TEST(FlatBatchBehaviorTest, NoEventLeavesInstancesAlone) {
+  JobPool pool;
+  for (int i = 0; i < 64; ++i) pool.Add();
+  std::vector<JobPool::EventIndex> events(pool.Size(), JobPool::kNoEvent);
+  events[5] = JobPool::EventIndexOf<FbEvAudit>();
+  std::vector<JobPool::Id> custom;
+  pool.ApplyBatch(events.data(), custom);
+  EXPECT_TRUE(custom.empty());
+  for (JobPool::Id id = 0; id < pool.Size(); ++id) EXPECT_EQ(pool.IsInState<FbAuditing>(id), id == 5);
+}
@@ -0,0 +1,119 @@
+#include <gtest/gtest.h>
+
+#include <ufsm/flat.h>
+
+#include <random>
+#include <vector>
+
+FSM_EVENT(FpEvPower){};
+FSM_EVENT(FpEvWork){};
+FSM_EVENT(FpEvDone){};
+FSM_EVENT(FpEvFault){};
+FSM_EVENT(FpEvIgnored){};
+
+struct FpOff;
+struct FpOn;
+struct FpIdle;
+struct FpBusy;
+struct FpFailed;
+
+int fp_actions = 0;
+
+struct FpCountAction {
+  void operator()() const { ++fp_actions; }
+};
+
+FSM_STATE_MACHINE(FpDevice, FpOff){};
+
+FSM_STATE(FpOff, FpDevice) { using reactions = ufsm::List<ufsm::Transition<FpEvPower, FpOn>>; };
+
+// Composite: its transitions apply in both substates.
+FSM_STATE(FpOn, FpDevice, FpIdle) {
+  using reactions = ufsm::List<ufsm::Transition<FpEvPower, FpOff>, ufsm::Transition<FpEvFault, FpFailed>>;
+};
+
+FSM_STATE(FpIdle, FpOn) { using reactions = ufsm::List<ufsm::Transition<FpEvWork, FpBusy, FpCountAction>>; };
+
+// Overrides the enclosing state's reaction to FpEvFault.
+FSM_STATE(FpBusy, FpOn) {
+  using reactions = ufsm::List<ufsm::Transition<FpEvDone, FpIdle>, ufsm::Transition<FpEvFault, FpIdle>>;
+};
+
+FSM_STATE(FpFailed, FpDevice) { using reactions = ufsm::List<ufsm::Transition<FpEvPower, FpOff>>; };
+
+using DevicePool = ufsm::FlatPool<FpDevice>;
+
+TEST(FlatPoolBehaviorTest, InstancesAreOneByteOfLeafState) {
+  static_assert(sizeof(DevicePool::StateIndex) == 1);
+  static_assert(DevicePool::kLeafCount == 4);  // Off, Idle, Busy, Failed
+  DevicePool pool;
+  auto id = pool.Add();
+  EXPECT_TRUE(pool.IsInState<FpOff>(id));
+  EXPECT_EQ(pool.Leaf(id), DevicePool::IndexOf<FpOff>());
+}
+
+TEST(FlatPoolBehaviorTest, TransitionsFollowHierarchicalDispatch) {
+  fp_actions = 0;
+  DevicePool pool;
+  auto id = pool.Add();
+
+  EXPECT_EQ(pool.ProcessEvent(id, FpEvPower{}), ufsm::Result::kConsumed);
+  EXPECT_TRUE(pool.IsInState<FpOn>(id));
+  EXPECT_TRUE(pool.IsInState<FpIdle>(id));  // Drilled down to the initial substate.
+
+  EXPECT_EQ(pool.ProcessEvent(id, FpEvDone{}), ufsm::Result::kForwardEvent);
+  EXPECT_EQ(pool.ProcessEvent(id, FpEvIgnored{}), ufsm::Result::kForwardEvent);
+
+  pool.ProcessEvent(id, FpEvWork{});
+  EXPECT_TRUE(pool.IsInState<FpBusy>(id));
+  EXPECT_EQ(fp_actions, 1);
+
+  pool.ProcessEvent(id, FpEvFault{});  // Handled by FpBusy itself.
+  EXPECT_TRUE(pool.IsInState<FpIdle>(id));
+  pool.ProcessEvent(id, FpEvFault{});  // Inherited from FpOn.
+  EXPECT_TRUE(pool.IsInState<FpFailed>(id));
+  EXPECT_FALSE(pool.IsInState<FpOn>(id));
+}
+
+TEST(FlatPoolBehaviorTest, MatchesTheFullEngineOnRandomEventStreams) {
+  DevicePool pool;
+  std::vector<FpDevice> machines(16);
+  for (auto& machine : machines) {
+    machine.Initiate();
+    pool.Add();
+  }
+
+  std::mt19937 rng(7);
+  for (int step = 0; step < 2000; ++step) {
+    std::size_t id = rng() % machines.size();
+    auto check = [&](const auto& event) {
+      auto expected = machines[id].ProcessEvent(event);
+      EXPECT_EQ(pool.ProcessEvent(id, event) == ufsm::Result::kConsumed, expected == ufsm::Result::kConsumed);
+    };
+    switch (rng() % 4) {
+      case 0: check(FpEvPower{}); break;
+      case 1: check(FpEvWork{}); break;
+      case 2: check(FpEvDone{}); break;
+      default: check(FpEvFault{}); break;
+    }
+    ASSERT_EQ(pool.IsInState<FpOff>(id), machines[id].IsInState<FpOff>());
+    ASSERT_EQ(pool.IsInState<FpIdle>(id), machines[id].IsInState<FpIdle>());
+    ASSERT_EQ(pool.IsInState<FpBusy>(id), machines[id].IsInState<FpBusy>());
+    ASSERT_EQ(pool.IsInState<FpFailed>(id), machines[id].IsInState<FpFailed>());
+  }
+}
+
+TEST(FlatPoolBehaviorTest, KeepsAContextPerInstance) {
+  struct Telemetry {
+    explicit Telemetry(int serial) : serial(serial) {}
+    int serial;
+  };
+  ufsm::FlatPool<FpDevice, Telemetry> pool;
+  auto a = pool.Add(10);
+  auto b = pool.Add(20);
+  pool.Broadcast(FpEvPower{});
+  EXPECT_TRUE(pool.IsInState<FpIdle>(a));
+  EXPECT_TRUE(pool.IsInState<FpIdle>(b));
+  EXPECT_EQ(pool.ContextOf(b).serial, 20);
+  EXPECT_EQ(pool.Size(), 2u);
+}
@@ -0,0 +1,146 @@
+#include <gtest/gtest.h>
+
+#include <ufsm/ufsm.h>
+
+#include <string>
+#include <vector>
+
+#include "test_support.h"
+
+namespace {
+
+struct HibernationTag {};
+using Log = LifecycleLog<HibernationTag>;
+
+FSM_EVENT(HEvLogin) {
+  explicit HEvLogin(std::string u) : user(std::move(u)) {}
+  std::string user;
+};
+FSM_EVENT(HEvPing){};
+FSM_EVENT(HEvUpload){};
+FSM_EVENT(HEvReady){};
+FSM_EVENT(HEvLogout){};
+
+struct HGuest;
+struct HSession;
+struct HBusy;
+struct HIdle;
+
+FSM_STATE_MACHINE(HibernatingMachine, HGuest) {
+  // HSession::OnExit() writes to trace, so the states exit before it is destroyed rather than in ~StateMachine().
+  ~HibernatingMachine() { Terminate(); }
+  std::vector<std::string> trace;
+};
+
+FSM_STATE(HGuest, HibernatingMachine) {
+  using reactions = ufsm::List<ufsm::Reaction<HEvLogin>>;
+  HGuest() { Log::RecordConstruction("HGuest"); }
+  ~HGuest() { Log::RecordDestruction("HGuest"); }
+  ufsm::Result React(const HEvLogin& e) { return Transit<HSession>(ufsm::with_args, e.user); }
+};
+
+FSM_STATE(HSession, HibernatingMachine, HBusy) {
+  using reactions = ufsm::List<ufsm::Transition<HEvLogout, HGuest>>;
+  explicit HSession(std::string u) : user(std::move(u)) { Log::RecordConstruction("HSession"); }
+  ~HSession() { Log::RecordDestruction("HSession"); }
+  void OnEntry() { OutermostContext().trace.push_back("HSession::OnEntry"); }
+  void OnExit() { OutermostContext().trace.push_back("HSession::OnExit"); }
+  std::string Persist() const { return user; }
+  std::string user;
+};
+
+FSM_STATE(HBusy, HSession) {
+  using reactions = ufsm::List<ufsm::Deferral<HEvUpload>, ufsm::Transition<HEvReady, HIdle>>;
+  HBusy() { Log::RecordConstruction("HBusy"); }
+  ~HBusy() { Log::RecordDestruction("HBusy"); }
+};
+
+FSM_STATE(HIdle, HSession) {
+  using reactions = ufsm::List<ufsm::Reaction<HEvPing>, ufsm::Reaction<HEvUpload>>;
+  HIdle() { Log::RecordConstruction("HIdle"); }
+  ~HIdle() { Log::RecordDestruction("HIdle"); }
+  void React(const HEvPing&) { OutermostContext().trace.push_back("ping:" + Context<HSession>().user); }
+  void React(const HEvUpload&) { OutermostContext().trace.push_back("upload:" + Context<HSession>().user); }
+};
+
+}  // namespace
+
+TEST(HibernationBehaviorTest, HibernateReleasesStatesAndKeepsQueries) {
+  Log::Clear();
+  HibernatingMachine machine;
+  machine.Initiate();
+  machine.ProcessEvent(HEvLogin{"alice"});
+  machine.ProcessEvent(HEvReady{});
+  Log::Clear();
+
+  ASSERT_TRUE(machine.Hibernate());
+  EXPECT_TRUE(machine.Hibernated());
+  EXPECT_FALSE(machine.Terminated());
+  ExpectSeq(Log::Destruction(), {"HIdle", "HSession"});
+
+  // Queries are answered from the hibernated image.
+  EXPECT_TRUE(machine.IsInState<HSession>());
+  EXPECT_TRUE(machine.IsInState<HIdle>());
+  EXPECT_FALSE(machine.IsInState<HGuest>());
+
+  // Hibernating twice is refused.
+  EXPECT_FALSE(machine.Hibernate());
+}
+
+TEST(HibernationBehaviorTest, NextEventRehydratesWithPersistedDataAndNoEntryExitHooks) {
+  Log::Clear();
+  HibernatingMachine machine;
+  machine.Initiate();
+  machine.ProcessEvent(HEvLogin{"alice"});
+  machine.ProcessEvent(HEvReady{});
+  machine.trace.clear();
+
+  ASSERT_TRUE(machine.Hibernate());
+  Log::Clear();
+
+  machine.ProcessEvent(HEvPing{});
+  EXPECT_FALSE(machine.Hibernated());
+  ExpectSeq(Log::Construction(), {"HSession", "HIdle"});
+  ExpectSeq(machine.trace, {"ping:alice"});
+
+  // A regular transition after rehydration exits the restored states normally.
+  machine.ProcessEvent(HEvLogout{});
+  EXPECT_TRUE(machine.IsInState<HGuest>());
+  ExpectSeq(machine.trace, {"ping:alice", "HSession::OnExit"});
+}
+
+TEST(HibernationBehaviorTest, DeferredEventsSurviveHibernation) {
+  HibernatingMachine machine;
+  machine.Initiate();
+  machine.ProcessEvent(HEvLogin{"bob"});
+
+  // HBusy defers the upload; the deferral must still be released once HBusy exits after rehydration.
+  machine.ProcessEvent(HEvUpload{});
+  ASSERT_TRUE(machine.Hibernate());
+
+  machine.ProcessEvent(HEvReady{});
+  EXPECT_TRUE(machine.IsInState<HIdle>());
+  ExpectSeq(machine.trace, {"HSession::OnEntry", "upload:bob"});
+}
+
+TEST(HibernationBehaviorTest, NonIdleMachinesAreNotHibernated) {
+  HibernatingMachine machine;
+  EXPECT_FALSE(machine.Hibernate());
+
+  machine.Initiate();
+  machine.PostEvent(HEvPing{});
+  EXPECT_FALSE(machine.Hibernate());
+}
+
+TEST(HibernationBehaviorTest, TerminateWakesHibernatedStatesToExitThem) {
+  HibernatingMachine machine;
+  machine.Initiate();
+  machine.ProcessEvent(HEvLogin{"carol"});
+  ASSERT_TRUE(machine.Hibernate());
+  machine.trace.clear();
+
+  machine.Terminate();
+  EXPECT_TRUE(machine.Terminated());
+  EXPECT_FALSE(machine.Hibernated());
+  ExpectSeq(machine.trace, {"HSession::OnExit"});
+}
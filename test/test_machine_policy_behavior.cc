@@ -0,0 +1,65 @@
+#include <gtest/gtest.h>
+
+#include <ufsm/ufsm.h>
+
+#include <vector>
+
+FSM_EVENT(MPEvBurst) { int count = 0; };
+FSM_EVENT(MPEvItem) { int value = 0; };
+FSM_EVENT(MPEvDown){};
+
+struct MPTop;
+struct MPLeaf;
+struct MPInner;
+
+struct ShallowPolicy : ufsm::DefaultPolicy {
+  static constexpr std::size_t kMaxDepth = 2;
+};
+
+FSM_STATE_MACHINE(PolicyMachine, MPTop, ShallowPolicy) { std::vector<int> items; };
+
+FSM_STATE(MPTop, PolicyMachine, MPLeaf){};
+
+FSM_STATE(MPLeaf, MPTop) {
+  using reactions = ufsm::List<ufsm::Reaction<MPEvBurst>, ufsm::Reaction<MPEvItem>, ufsm::Transition<MPEvDown, MPInner>>;
+
+  void React(const MPEvBurst& e) {
+    for (int i = 0; i < e.count; ++i) {
+      MPEvItem item;
+      item.value = i;
+      PostEvent(item);
+    }
+  }
+
+  void React(const MPEvItem& e) { OutermostContext().items.push_back(e.value); }
+};
+
+FSM_STATE(MPInner, MPTop){};
+
+TEST(MachinePolicyBehaviorTest, ActivePathFitsPolicyDepth) {
+  PolicyMachine machine;
+  machine.Initiate();
+  EXPECT_TRUE(machine.IsInState<MPTop>());
+  EXPECT_TRUE(machine.IsInState<MPLeaf>());
+
+  machine.ProcessEvent(MPEvDown{});
+  EXPECT_TRUE(machine.IsInState<MPTop>());
+  EXPECT_TRUE(machine.IsInState<MPInner>());
+}
+
+TEST(MachinePolicyBehaviorTest, PostedQueueGrowsAndKeepsFifoOrder) {
+  PolicyMachine machine;
+  machine.Initiate();
+
+  // An event posted from outside stays ahead of the burst posted while dispatching.
+  MPEvItem first;
+  first.value = -1;
+  machine.PostEvent(first);
+  MPEvBurst burst;
+  burst.count = 37;
+  machine.ProcessEvent(burst);
+
+  ASSERT_EQ(machine.items.size(), 38u);
+  EXPECT_EQ(machine.items.front(), -1);
+  for (int i = 0; i < 37; ++i) EXPECT_EQ(machine.items[i + 1], i);
+}
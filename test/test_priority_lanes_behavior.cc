@@ -0,0 +1,102 @@
+#include <gtest/gtest.h>
+
+#include <ufsm/ufsm.h>
+
+#include <vector>
+
+namespace {
+
+FSM_EVENT(PLEvValue) {
+  explicit PLEvValue(int v) : value(v) {}
+  int value;
+};
+FSM_EVENT(PLEvOpen){};
+
+constexpr std::size_t kLow = 0, kHigh = 1, kUrgent = 2;
+
+struct PLPolicy : ufsm::DefaultPolicy {
+  using PostedQueue = ufsm::PriorityEventQueue<3, 6, ufsm::OverflowPolicy::kCallHook, PLEvValue, PLEvOpen>;
+  using DeferredQueue = ufsm::FixedEventQueue<4, ufsm::OverflowPolicy::kAssert, PLEvValue, PLEvOpen>;
+};
+
+struct PLClosed;
+struct PLOpen;
+
+FSM_STATE_MACHINE(PLMachine, PLClosed, PLPolicy) {
+  std::vector<int> seen;
+  int overflowed = 0;
+  int urgent_on = -1;  // Value that posts an urgent 99 when processed.
+
+  void OnQueueOverflow(const ufsm::detail::EventBase&) { ++overflowed; }
+};
+
+FSM_STATE(PLClosed, PLMachine) {
+  using reactions = ufsm::List<ufsm::Deferral<PLEvValue>, ufsm::Transition<PLEvOpen, PLOpen>>;
+};
+
+FSM_STATE(PLOpen, PLMachine) {
+  using reactions = ufsm::List<ufsm::Reaction<PLEvValue>>;
+  void React(const PLEvValue& e) {
+    auto& machine = OutermostContext();
+    machine.seen.push_back(e.value);
+    if (e.value == machine.urgent_on) PostEvent(PLEvValue{99}, kUrgent);
+  }
+};
+
+}  // namespace
+
+TEST(PriorityLanesBehaviorTest, HigherLanesAreDrainedFirstInPostingOrder) {
+  PLMachine machine;
+  machine.Initiate();
+  machine.ProcessEvent(PLEvOpen{});
+
+  machine.PostEvent(PLEvValue{1});
+  machine.PostEvent(PLEvValue{2}, kLow);
+  machine.PostEvent(PLEvValue{10}, kUrgent);
+  machine.PostEvent(PLEvValue{5}, kHigh);
+  machine.PostEvent(PLEvValue{11}, kUrgent);
+  machine.ProcessEvent(PLEvValue{0});
+  EXPECT_EQ(machine.seen, (std::vector<int>{0, 10, 11, 5, 1, 2}));
+}
+
+TEST(PriorityLanesBehaviorTest, UrgentEventOvertakesBacklogAfterCurrentStep) {
+  PLMachine machine;
+  machine.Initiate();
+  machine.ProcessEvent(PLEvOpen{});
+  machine.urgent_on = 1;
+
+  for (int i = 1; i <= 3; ++i) machine.PostEvent(PLEvValue{i});
+  machine.ProcessEvent(PLEvValue{0});
+  EXPECT_EQ(machine.seen, (std::vector<int>{0, 1, 99, 2, 3}));
+}
+
+TEST(PriorityLanesBehaviorTest, ReleasedDeferredEventsGoToFrontOfLowestLane) {
+  PLMachine machine;
+  machine.Initiate();
+  machine.ProcessEvent(PLEvValue{1});
+  machine.ProcessEvent(PLEvValue{2});
+
+  // 4 and the urgent 7 are deferred as well; opening releases them all ahead of the low 3.
+  machine.PostEvent(PLEvValue{3}, kLow);
+  machine.PostEvent(PLEvOpen{}, kHigh);
+  machine.PostEvent(PLEvValue{7}, kUrgent);
+  machine.ProcessEvent(PLEvValue{4});
+  EXPECT_TRUE(machine.IsInState<PLOpen>());
+  EXPECT_EQ(machine.seen, (std::vector<int>{1, 2, 4, 7, 3}));
+}
+
+TEST(PriorityLanesBehaviorTest, EachLaneIsBoundedOnItsOwnWithoutAllocating) {
+  PLMachine machine;
+  machine.Initiate();
+  machine.ProcessEvent(PLEvOpen{});
+
+  ufsm::NoAllocScope no_alloc;
+  for (int i = 0; i < 7; ++i) machine.PostEvent(PLEvValue{i}, kLow);
+  EXPECT_EQ(machine.overflowed, 1);
+  machine.PostEvent(PLEvValue{50}, kUrgent);
+  EXPECT_EQ(machine.overflowed, 1);
+
+  machine.ProcessEvent(PLEvValue{100});
+  EXPECT_EQ(machine.seen, (std::vector<int>{100, 50, 0, 1, 2, 3, 4, 5}));
+  EXPECT_EQ(no_alloc.Allocations(), 0u);
+}
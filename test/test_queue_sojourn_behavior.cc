@@ -0,0 +1,140 @@
+#include <gtest/gtest.h>
+
+#include <ufsm/ufsm.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using namespace std::chrono_literals;
+
+FSM_EVENT(SJEvWork) {
+  explicit SJEvWork(int v) : value(v) {}
+  int value;
+};
+FSM_EVENT(SJEvParked){};
+FSM_EVENT(SJEvOpen){};
+
+struct SJPolicy : ufsm::DefaultPolicy {
+  static constexpr bool kQueueSojourn = true;
+};
+
+struct SJLanesPolicy : ufsm::DefaultPolicy {
+  static constexpr bool kQueueSojourn = true;
+  using PostedQueue = ufsm::PriorityEventQueue<2, 4, ufsm::OverflowPolicy::kAssert, SJEvWork, SJEvParked, SJEvOpen>;
+  using DeferredQueue = ufsm::FixedEventQueue<2, ufsm::OverflowPolicy::kAssert, SJEvWork, SJEvParked, SJEvOpen>;
+};
+
+struct SJWait {
+  ufsm::QueueKind queue;
+  std::string event;
+  std::chrono::nanoseconds wait;
+};
+
+template <typename Policy>
+struct SJClosed;
+template <typename Policy>
+struct SJOpen;
+
+template <typename Policy>
+struct SJMachine : ufsm::StateMachine<SJMachine<Policy>, SJClosed<Policy>, Policy> {
+  std::vector<SJWait> waits;
+
+  void OnEventSojourn(ufsm::QueueKind queue, const ufsm::detail::EventBase& event, std::chrono::nanoseconds wait) {
+    std::string name = event.Name();
+    waits.push_back({queue, name.substr(name.rfind(':') + 1), wait});
+  }
+};
+
+template <typename Policy>
+struct SJClosed : ufsm::State<SJClosed<Policy>, SJMachine<Policy>> {
+  using reactions = ufsm::List<ufsm::Deferral<SJEvParked>, ufsm::Reaction<SJEvWork>,
+                               ufsm::Transition<SJEvOpen, SJOpen<Policy>>>;
+  void React(const SJEvWork& e) {
+    if (e.value == 0) {
+      this->PostEvent(SJEvWork{1});
+      this->PostEvent(SJEvWork{2});
+    }
+  }
+};
+
+template <typename Policy>
+struct SJOpen : ufsm::State<SJOpen<Policy>, SJMachine<Policy>> {
+  using reactions = ufsm::List<ufsm::Reaction<SJEvParked>, ufsm::Reaction<SJEvWork>>;
+  void React(const SJEvParked&) {}
+  void React(const SJEvWork&) {}
+};
+
+const ufsm::SojournRecord* FindRecord(std::string_view type) {
+  for (auto* r = ufsm::SojournStats::Records(); r; r = r->next)
+    if (r->name.size() >= type.size() && r->name.substr(r->name.size() - type.size()) == type) return r;
+  return nullptr;
+}
+
+}  // namespace
+
+TEST(QueueSojournBehaviorTest, PostedWaitsAreRecordedPerEventType) {
+  ufsm::SojournStats::Reset();
+  SJMachine<SJPolicy> machine;
+  machine.Initiate();
+  machine.ProcessEvent(SJEvWork{0});
+
+  ASSERT_EQ(machine.waits.size(), 2u);
+  EXPECT_EQ(machine.waits[0].queue, ufsm::QueueKind::kPosted);
+  EXPECT_EQ(machine.waits[0].event, "SJEvWork");
+  const auto* record = FindRecord("SJEvWork");
+  ASSERT_NE(record, nullptr);
+  EXPECT_EQ(record->posted.Count(), 2u);
+  EXPECT_EQ(record->deferred.Count(), 0u);
+}
+
+TEST(QueueSojournBehaviorTest, DeferredWaitRunsFromDeferralToRelease) {
+  ufsm::SojournStats::Reset();
+  SJMachine<SJPolicy> machine;
+  machine.Initiate();
+  machine.ProcessEvent(SJEvParked{});
+  std::this_thread::sleep_for(3ms);
+  machine.ProcessEvent(SJEvOpen{});
+
+  // Released to the posted queue, then dispatched from it.
+  ASSERT_EQ(machine.waits.size(), 2u);
+  EXPECT_EQ(machine.waits[0].queue, ufsm::QueueKind::kDeferred);
+  EXPECT_GE(machine.waits[0].wait, 3ms);
+  EXPECT_EQ(machine.waits[1].queue, ufsm::QueueKind::kPosted);
+  EXPECT_LT(machine.waits[1].wait, machine.waits[0].wait);
+
+  const auto* record = FindRecord("SJEvParked");
+  ASSERT_NE(record, nullptr);
+  EXPECT_EQ(record->deferred.Count(), 1u);
+  EXPECT_GE(record->deferred.Quantile(0.5), 2ms);
+}
+
+TEST(QueueSojournBehaviorTest, EachLaneKeepsItsOwnStamps) {
+  SJMachine<SJLanesPolicy> machine;
+  machine.Initiate();
+  machine.ProcessEvent(SJEvOpen{});
+  machine.PostEvent(SJEvWork{1}, 0);
+  std::this_thread::sleep_for(20ms);
+  machine.PostEvent(SJEvParked{}, 1);
+  ufsm::NoAllocScope no_alloc;
+  machine.ProcessEvent(SJEvWork{0});
+
+  ASSERT_EQ(machine.waits.size(), 2u);
+  EXPECT_EQ(machine.waits[0].event, "SJEvParked");
+  EXPECT_LT(machine.waits[0].wait, 20ms);
+  EXPECT_EQ(machine.waits[1].event, "SJEvWork");
+  EXPECT_GE(machine.waits[1].wait, 20ms);
+}
+
+TEST(QueueSojournBehaviorTest, HistogramQuantilesAreUpperBoundsWithinTwo) {
+  ufsm::SojournHistogram histogram;
+  EXPECT_EQ(histogram.Quantile(0.5), 0ns);
+  for (int i = 0; i < 99; ++i) histogram.Add(100ns);
+  histogram.Add(1ms);
+  EXPECT_EQ(histogram.Count(), 100u);
+  EXPECT_EQ(histogram.Quantile(0.5), 128ns);
+  EXPECT_EQ(histogram.Quantile(1.0), 1048576ns);
+}
@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+
+#include <ufsm/ufsm.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+FSM_EVENT(QWEvValue) {
+  explicit QWEvValue(int v) : value(v) {}
+  int value;
+};
+FSM_EVENT(QWEvOpen){};
+
+struct QWPolicy : ufsm::DefaultPolicy {
+  static constexpr ufsm::Watermarks kPostedWatermarks{4, 1};
+  static constexpr ufsm::Watermarks kDeferredWatermarks{2, 0};
+};
+
+struct QWFixedPolicy : ufsm::DefaultPolicy {
+  using PostedQueue = ufsm::FixedEventQueue<3, ufsm::OverflowPolicy::kCallHook, QWEvValue, QWEvOpen>;
+};
+
+template <typename Policy>
+struct QWClosed;
+template <typename Policy>
+struct QWOpen;
+
+template <typename Policy>
+struct QWMachine : ufsm::StateMachine<QWMachine<Policy>, QWClosed<Policy>, Policy> {
+  std::vector<std::string> marks;
+  std::vector<int> seen;
+  int overflowed = 0;
+
+  void OnQueueHigh(ufsm::QueueKind queue, std::size_t depth) { Mark("high", queue, depth); }
+  void OnQueueLow(ufsm::QueueKind queue, std::size_t depth) { Mark("low", queue, depth); }
+  void OnQueueOverflow(const ufsm::detail::EventBase&) { ++overflowed; }
+
+  void Mark(const char* what, ufsm::QueueKind queue, std::size_t depth) {
+    marks.push_back(std::string(what) + (queue == ufsm::QueueKind::kPosted ? " posted " : " deferred ") +
+                    std::to_string(depth));
+  }
+};
+
+template <typename Policy>
+struct QWClosed : ufsm::State<QWClosed<Policy>, QWMachine<Policy>> {
+  using reactions = ufsm::List<ufsm::Deferral<QWEvValue>, ufsm::Transition<QWEvOpen, QWOpen<Policy>>>;
+};
+
+template <typename Policy>
+struct QWOpen : ufsm::State<QWOpen<Policy>, QWMachine<Policy>> {
+  using reactions = ufsm::List<ufsm::Reaction<QWEvValue>>;
+  void React(const QWEvValue& e) { this->OutermostContext().seen.push_back(e.value); }
+};
+
+using QWWatched = QWMachine<QWPolicy>;
+using QWFixed = QWMachine<QWFixedPolicy>;
+
+}  // namespace
+
+TEST(QueueWatermarkBehaviorTest, HighAndLowAreCalledOncePerCrossing) {
+  QWWatched machine;
+  machine.Initiate();
+  machine.ProcessEvent(QWEvOpen{});
+
+  for (int i = 0; i < 6; ++i) machine.PostEvent(QWEvValue{i});
+  EXPECT_EQ(machine.PostedDepth(), 6u);
+  EXPECT_EQ(machine.marks, (std::vector<std::string>{"high posted 4"}));
+
+  machine.ProcessEvent(QWEvValue{-1});
+  EXPECT_EQ(machine.PostedDepth(), 0u);
+  EXPECT_EQ(machine.marks, (std::vector<std::string>{"high posted 4", "low posted 1"}));
+  EXPECT_EQ(machine.seen.size(), 7u);
+}
+
+TEST(QueueWatermarkBehaviorTest, TryPostEventRefusesAtHighWatermark) {
+  QWWatched machine;
+  machine.Initiate();
+  machine.ProcessEvent(QWEvOpen{});
+
+  int accepted = 0;
+  for (int i = 0; i < 10; ++i) accepted += machine.TryPostEvent(QWEvValue{i});
+  EXPECT_EQ(accepted, 4);
+  EXPECT_EQ(machine.PostedDepth(), 4u);
+
+  machine.ProcessEvent(QWEvValue{-1});
+  EXPECT_EQ(machine.seen, (std::vector<int>{-1, 0, 1, 2, 3}));
+  EXPECT_TRUE(machine.TryPostEvent(QWEvValue{4}));
+}
+
+TEST(QueueWatermarkBehaviorTest, DeferredQueueReportsGrowthAndRelease) {
+  QWWatched machine;
+  machine.Initiate();
+  for (int i = 0; i < 3; ++i) machine.ProcessEvent(QWEvValue{i});
+  EXPECT_EQ(machine.DeferredDepth(), 3u);
+  EXPECT_EQ(machine.marks, (std::vector<std::string>{"high deferred 2"}));
+
+  // Opening releases the deferred events onto the posted queue, below its high watermark, and drains them.
+  machine.ProcessEvent(QWEvOpen{});
+  EXPECT_EQ(machine.DeferredDepth(), 0u);
+  EXPECT_EQ(machine.marks, (std::vector<std::string>{"high deferred 2", "low deferred 0"}));
+  EXPECT_EQ(machine.seen, (std::vector<int>{0, 1, 2}));
+}
+
+TEST(QueueWatermarkBehaviorTest, TerminateDrainsBelowLowWatermark) {
+  QWWatched machine;
+  machine.Initiate();
+  machine.ProcessEvent(QWEvOpen{});
+  for (int i = 0; i < 5; ++i) machine.PostEvent(QWEvValue{i});
+  machine.Terminate();
+  EXPECT_EQ(machine.marks, (std::vector<std::string>{"high posted 4", "low posted 0"}));
+}
+
+TEST(QueueWatermarkBehaviorTest, TryPostEventRefusesFullBoundedQueueWithoutOverflowHook) {
+  QWFixed machine;
+  machine.Initiate();
+  machine.ProcessEvent(QWEvOpen{});
+
+  for (int i = 0; i < 3; ++i) EXPECT_TRUE(machine.TryPostEvent(QWEvValue{i}));
+  EXPECT_FALSE(machine.TryPostEvent(QWEvValue{3}));
+  EXPECT_EQ(machine.overflowed, 0);
+  machine.PostEvent(QWEvValue{4});
+  EXPECT_EQ(machine.overflowed, 1);
+  EXPECT_TRUE(machine.marks.empty());
+}
@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+
+#include <ufsm/reactor.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+FSM_EVENT(RxEvMarker){};
+
+struct RxListening;
+
+FSM_STATE_MACHINE(RxMachine, RxListening) {
+  std::vector<std::string> log;
+  int pipe_read = -1;
+};
+
+FSM_STATE(RxListening, RxMachine) {
+  using reactions = ufsm::List<ufsm::Reaction<ufsm::IoReady>, ufsm::Reaction<ufsm::TimerExpired>,
+                               ufsm::Reaction<ufsm::Notified>, ufsm::Reaction<RxEvMarker>>;
+
+  ufsm::Result React(const ufsm::IoReady& ev) {
+    char buffer[16];
+    auto n = ::read(ev.fd, buffer, sizeof(buffer));
+    OutermostContext().log.push_back("io " + std::to_string(n));
+    // Lands behind the events of the same wakeup if they were batched into the posted queue.
+    PostEvent(RxEvMarker{});
+    return DiscardEvent();
+  }
+  ufsm::Result React(const ufsm::TimerExpired& ev) {
+    OutermostContext().log.push_back("timer " + std::to_string(ev.expirations));
+    return DiscardEvent();
+  }
+  ufsm::Result React(const ufsm::Notified& ev) {
+    OutermostContext().log.push_back("notified " + std::to_string(ev.count));
+    return DiscardEvent();
+  }
+  ufsm::Result React(const RxEvMarker&) {
+    OutermostContext().log.push_back("marker");
+    return DiscardEvent();
+  }
+};
+
+class ReactorBehaviorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(reactor.Valid());
+    ASSERT_EQ(::pipe2(fds, O_NONBLOCK | O_CLOEXEC), 0);
+    machine.Initiate();
+  }
+  void TearDown() override {
+    ::close(fds[0]);
+    ::close(fds[1]);
+  }
+
+  ufsm::Reactor reactor;
+  RxMachine machine;
+  int fds[2] = {-1, -1};
+};
+
+TEST_F(ReactorBehaviorTest, ReadyEventsOfOneWakeupAreProcessedInOneLoop) {
+  ASSERT_TRUE(reactor.Watch(machine, fds[0], EPOLLIN));
+  int notifier = reactor.AddNotifier(machine);
+  ASSERT_GE(notifier, 0);
+
+  ASSERT_EQ(::write(fds[1], "abc", 3), 3);
+  ASSERT_TRUE(ufsm::Reactor::Notify(notifier, 2));
+  ASSERT_TRUE(ufsm::Reactor::Notify(notifier, 3));
+
+  EXPECT_EQ(reactor.RunOnce(1000), 2);
+  ASSERT_EQ(machine.log.size(), 3u);
+  // Both readiness events were queued before the machine ran, so the marker comes last.
+  EXPECT_EQ(machine.log.back(), "marker");
+  EXPECT_NE(std::find(machine.log.begin(), machine.log.end(), "io 3"), machine.log.end());
+  EXPECT_NE(std::find(machine.log.begin(), machine.log.end(), "notified 5"), machine.log.end());
+
+  // Everything was consumed: nothing is ready any more.
+  EXPECT_EQ(reactor.RunOnce(0), 0);
+}
+
+TEST_F(ReactorBehaviorTest, TimerDeliversExpirations) {
+  int timer = reactor.AddTimer(machine, 1ms, 1ms);
+  ASSERT_GE(timer, 0);
+  ::usleep(5000);
+  EXPECT_EQ(reactor.RunOnce(1000), 1);
+  ASSERT_EQ(machine.log.size(), 1u);
+  EXPECT_EQ(machine.log[0].rfind("timer ", 0), 0u);
+  EXPECT_NE(machine.log[0], "timer 0");
+
+  EXPECT_TRUE(reactor.Remove(timer));
+  EXPECT_FALSE(reactor.Remove(timer));
+  EXPECT_EQ(reactor.RunOnce(10), 0);
+}
+
+TEST_F(ReactorBehaviorTest, ForgottenMachineGetsNoEvents) {
+  ASSERT_TRUE(reactor.Watch(machine, fds[0], EPOLLIN));
+  EXPECT_FALSE(reactor.Watch(machine, fds[0], EPOLLIN));
+  reactor.Forget(machine);
+
+  ASSERT_EQ(::write(fds[1], "x", 1), 1);
+  EXPECT_EQ(reactor.RunOnce(10), 0);
+  EXPECT_TRUE(machine.log.empty());
+}
@@ -0,0 +1,263 @@
+#include <gtest/gtest.h>
+
+#include <ufsm/runtime.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Idle
+// Active          initial Working
+//   Working       initial Fast
+//     Fast
+//     Slow
+//   Paused
+struct Chart {
+  ufsm::RuntimeBuilder builder;
+  ufsm::RuntimeId idle, active, working, fast, slow, paused;
+  ufsm::RuntimeId start, stop, pause, resume, slower, restart, ping, job;
+
+  Chart() {
+    idle = builder.AddState("Idle");
+    active = builder.AddState("Active");
+    working = builder.AddState("Working", active);
+    fast = builder.AddState("Fast", working);
+    slow = builder.AddState("Slow", working);
+    paused = builder.AddState("Paused", active);
+    for (auto state : {idle, active, working, fast, slow, paused}) {
+      builder.SetEntryAction(state, std::string("enter ") + kNames[state]);
+      builder.SetExitAction(state, std::string("exit ") + kNames[state]);
+    }
+
+    start = builder.AddEvent("Start");
+    stop = builder.AddEvent("Stop");
+    pause = builder.AddEvent("Pause");
+    resume = builder.AddEvent("Resume");
+    slower = builder.AddEvent("Slower");
+    restart = builder.AddEvent("Restart");
+    ping = builder.AddEvent("Ping");
+    job = builder.AddEvent("Job");
+
+    builder.AddTransition(idle, start, active, "started");
+    builder.AddDeferral(idle, job);
+    builder.AddTransition(active, stop, idle);
+    builder.AddInternal(active, ping, "pinged");
+    builder.AddInternal(active, job, "job");
+    builder.AddTransition(working, pause, paused);
+    builder.AddTransition(working, restart, working);
+    builder.AddTransition(fast, slower, slow);
+    builder.AddTransition(paused, resume, slow);
+  }
+
+  static constexpr const char* kNames[] = {"Idle", "Active", "Working", "Fast", "Slow", "Paused"};
+};
+
+// Actions that log their own names.
+ufsm::RuntimeActions LoggingActions(std::vector<std::string>& log) {
+  ufsm::RuntimeActions actions;
+  for (std::string name : {"started", "pinged", "job"})
+    actions.Register(name, [&log, name](ufsm::RuntimeMachine&) { log.push_back(name); });
+  for (std::string state : Chart::kNames) {
+    for (std::string verb : {"enter ", "exit "})
+      actions.Register(verb + state, [&log, name = verb + state](ufsm::RuntimeMachine&) { log.push_back(name); });
+  }
+  return actions;
+}
+
+class RuntimeMachineBehaviorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    bytes_ = chart_.builder.Build();
+    ASSERT_TRUE(definition_.Assign(bytes_.data(), bytes_.size()));
+    ASSERT_TRUE(definition_.Bind(LoggingActions(log_)));
+  }
+
+  Chart chart_;
+  std::vector<std::uint8_t> bytes_;
+  ufsm::RuntimeDefinition definition_;
+  std::vector<std::string> log_;
+};
+
+using Log = std::vector<std::string>;
+
+}  // namespace
+
+TEST_F(RuntimeMachineBehaviorTest, InitiateDrillsDownAndTransitionsExitToTheCommonAncestor) {
+  ufsm::RuntimeMachine machine(definition_);
+  machine.Initiate();
+  EXPECT_EQ(machine.Leaf(), chart_.idle);
+  EXPECT_EQ(log_, (Log{"enter Idle"}));
+
+  log_.clear();
+  EXPECT_EQ(machine.ProcessEvent(chart_.start), ufsm::Result::kConsumed);
+  EXPECT_EQ(log_, (Log{"exit Idle", "started", "enter Active", "enter Working", "enter Fast"}));
+  EXPECT_TRUE(machine.IsInState(chart_.active));
+  EXPECT_TRUE(machine.IsInState(chart_.working));
+  EXPECT_EQ(machine.Leaf(), chart_.fast);
+
+  // Fast -> Slow keeps Working; Working -> Paused keeps Active.
+  log_.clear();
+  machine.ProcessEvent(chart_.slower);
+  machine.ProcessEvent(chart_.pause);
+  EXPECT_EQ(log_, (Log{"exit Fast", "enter Slow", "exit Slow", "exit Working", "enter Paused"}));
+
+  // Paused -> Slow enters Working on the way down.
+  log_.clear();
+  machine.ProcessEvent(chart_.resume);
+  EXPECT_EQ(log_, (Log{"exit Paused", "enter Working", "enter Slow"}));
+  EXPECT_EQ(machine.Leaf(), chart_.slow);
+}
+
+TEST_F(RuntimeMachineBehaviorTest, SelfTransitionExitsAndReentersTheState) {
+  ufsm::RuntimeMachine machine(definition_);
+  machine.Initiate();
+  machine.ProcessEvent(chart_.start);
+  machine.ProcessEvent(chart_.slower);
+
+  log_.clear();
+  machine.ProcessEvent(chart_.restart);
+  EXPECT_EQ(log_, (Log{"exit Slow", "exit Working", "enter Working", "enter Fast"}));
+  EXPECT_EQ(machine.Leaf(), chart_.fast);
+}
+
+TEST_F(RuntimeMachineBehaviorTest, AncestorsReactToEventsTheLeafForwards) {
+  ufsm::RuntimeMachine machine(definition_);
+  machine.Initiate();
+  EXPECT_EQ(machine.ProcessEvent(chart_.ping), ufsm::Result::kForwardEvent);
+
+  machine.ProcessEvent(chart_.start);
+  log_.clear();
+  EXPECT_EQ(machine.ProcessEvent(chart_.ping), ufsm::Result::kConsumed);
+  EXPECT_EQ(log_, (Log{"pinged"}));
+  EXPECT_EQ(machine.Leaf(), chart_.fast);
+
+  machine.ProcessEvent(chart_.stop);
+  EXPECT_EQ(machine.Leaf(), chart_.idle);
+}
+
+TEST_F(RuntimeMachineBehaviorTest, DeferredEventsAreReleasedAheadOfPostedOnes) {
+  ufsm::RuntimeMachine machine(definition_);
+  machine.Initiate();
+  machine.ProcessEvent(chart_.job);
+  machine.ProcessEvent(chart_.job);
+  EXPECT_EQ(machine.Leaf(), chart_.idle);
+
+  // Start posts Ping from its action; the two deferred Jobs go ahead of it once Idle exits.
+  ufsm::RuntimeActions actions = LoggingActions(log_);
+  actions.Register("started", [&](ufsm::RuntimeMachine& m) {
+    log_.push_back("started");
+    m.PostEvent(chart_.ping);
+  });
+  ASSERT_TRUE(definition_.Bind(actions));
+
+  log_.clear();
+  machine.ProcessEvent(chart_.start);
+  EXPECT_EQ(log_, (Log{"exit Idle", "started", "enter Active", "enter Working", "enter Fast", "job", "job",
+                       "pinged"}));
+}
+
+TEST_F(RuntimeMachineBehaviorTest, ActionsSeeTheMachineAndItsContext) {
+  int context = 0;
+  ufsm::RuntimeActions actions = LoggingActions(log_);
+  actions.Register("started", [&](ufsm::RuntimeMachine& m) {
+    ++*static_cast<int*>(m.Context());
+    EXPECT_EQ(m.CurrentEvent(), chart_.start);
+    EXPECT_STREQ(m.Definition().EventName(m.CurrentEvent()), "Start");
+  });
+  ASSERT_TRUE(definition_.Bind(actions));
+
+  ufsm::RuntimeMachine machine(definition_, &context);
+  machine.Initiate();
+  machine.ProcessEvent(chart_.start);
+  EXPECT_EQ(context, 1);
+}
+
+TEST_F(RuntimeMachineBehaviorTest, TerminationExitsInnermostFirst) {
+  {
+    ufsm::RuntimeMachine machine(definition_);
+    machine.Initiate();
+    machine.ProcessEvent(chart_.start);
+    log_.clear();
+    machine.Terminate();
+    EXPECT_TRUE(machine.Terminated());
+    EXPECT_EQ(machine.Leaf(), ufsm::kRuntimeNone);
+    EXPECT_EQ(log_, (Log{"exit Fast", "exit Working", "exit Active"}));
+
+    machine.Initiate();
+    log_.clear();
+  }
+  EXPECT_EQ(log_, (Log{"exit Idle"}));
+}
+
+TEST_F(RuntimeMachineBehaviorTest, NamesAreLookedUp) {
+  EXPECT_EQ(definition_.FindState("Slow"), chart_.slow);
+  EXPECT_EQ(definition_.FindEvent("Resume"), chart_.resume);
+  EXPECT_EQ(definition_.FindEvent("Nope"), ufsm::kRuntimeNone);
+  EXPECT_STREQ(definition_.StateName(chart_.paused), "Paused");
+  EXPECT_EQ(definition_.Parent(chart_.fast), chart_.working);
+  EXPECT_EQ(definition_.StateCount(), 6u);
+  EXPECT_EQ(definition_.EventCount(), 8u);
+}
+
+TEST_F(RuntimeMachineBehaviorTest, BindingFailsForAnUnregisteredAction) {
+  ufsm::RuntimeActions actions;
+  actions.Register("started", [](ufsm::RuntimeMachine&) {});
+  EXPECT_FALSE(definition_.Bind(actions));
+}
+
+TEST_F(RuntimeMachineBehaviorTest, MalformedTablesAreRejected) {
+  ufsm::RuntimeDefinition definition;
+  EXPECT_FALSE(definition.Assign(bytes_.data(), bytes_.size() - 4));
+  EXPECT_EQ(errno, EINVAL);
+  EXPECT_FALSE(definition.Loaded());
+
+  auto corrupt = [&](std::size_t offset, std::uint32_t value) {
+    std::vector<std::uint8_t> bytes = bytes_;
+    std::memcpy(bytes.data() + offset, &value, sizeof(value));
+    return definition.Assign(bytes.data(), bytes.size());
+  };
+  using ufsm::detail::RuntimeHeader, ufsm::detail::RuntimeStateEntry;
+  EXPECT_FALSE(corrupt(offsetof(RuntimeHeader, magic), 0));
+  EXPECT_FALSE(corrupt(offsetof(RuntimeHeader, initial), chart_.fast));
+  // Fast naming Slow as its parent, which does not come first.
+  const std::size_t fast = sizeof(RuntimeHeader) + chart_.fast * sizeof(RuntimeStateEntry);
+  EXPECT_FALSE(corrupt(fast + offsetof(RuntimeStateEntry, parent), chart_.slow));
+  EXPECT_FALSE(corrupt(fast + offsetof(RuntimeStateEntry, depth), 2));
+  EXPECT_FALSE(corrupt(fast + offsetof(RuntimeStateEntry, name), 1 << 20));
+  // Idle's Start transition keeping a state Active is not below.
+  const std::size_t start = sizeof(RuntimeHeader) + 6 * sizeof(RuntimeStateEntry);
+  EXPECT_FALSE(corrupt(start + offsetof(ufsm::detail::RuntimeReactionEntry, kind), 1u << 16));
+  EXPECT_TRUE(corrupt(0, ufsm::detail::kRuntimeMagic));
+}
+
+TEST_F(RuntimeMachineBehaviorTest, TablesAreReadOrMappedFromFiles) {
+  const std::string path = ::testing::TempDir() + "ufsm_runtime_chart.bin";
+  std::FILE* file = std::fopen(path.c_str(), "wb");
+  ASSERT_NE(file, nullptr);
+  std::fwrite(bytes_.data(), 1, bytes_.size(), file);
+  std::fclose(file);
+
+  for (std::size_t threshold : {ufsm::RuntimeDefinition::kMapThreshold, std::size_t{0}}) {
+    ufsm::RuntimeDefinition definition;
+    ASSERT_TRUE(definition.Open(path.c_str(), threshold));
+#if defined(UFSM_RUNTIME_MMAP)
+    EXPECT_EQ(definition.Mapped(), threshold == 0);
+#endif
+    ASSERT_TRUE(definition.Bind(LoggingActions(log_)));
+
+    ufsm::RuntimeMachine machine(definition);
+    machine.Initiate();
+    machine.ProcessEvent(definition.FindEvent("Start"));
+    EXPECT_EQ(machine.Leaf(), definition.FindState("Fast"));
+  }
+  std::remove(path.c_str());
+
+  ufsm::RuntimeDefinition missing;
+  EXPECT_FALSE(missing.Open(path.c_str()));
+  EXPECT_EQ(errno, ENOENT);
+}
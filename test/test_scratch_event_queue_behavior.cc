@@ -0,0 +1,102 @@
+#include <gtest/gtest.h>
+
+#include <ufsm/ufsm.h>
+
+#include <vector>
+
+namespace {
+
+FSM_EVENT(SQEvStep) {
+  explicit SQEvStep(int v) : value(v) {}
+  int value;
+};
+FSM_EVENT(SQEvLater) {
+  explicit SQEvLater(int v) : value(v) {}
+  int value;
+};
+FSM_EVENT(SQEvOpen){};
+
+struct SQPolicy : ufsm::DefaultPolicy {
+  using PostedQueue = ufsm::ScratchEventQueue<256>;
+};
+
+struct SQClosed;
+struct SQOpen;
+
+FSM_STATE_MACHINE(SQMachine, SQClosed, SQPolicy) { std::vector<int> seen; };
+
+// Each step posts the next one and a later event, which is deferred until the machine opens.
+FSM_STATE(SQClosed, SQMachine) {
+  using reactions =
+      ufsm::List<ufsm::Reaction<SQEvStep>, ufsm::Deferral<SQEvLater>, ufsm::Transition<SQEvOpen, SQOpen>>;
+  void React(const SQEvStep& e) {
+    OutermostContext().seen.push_back(e.value);
+    if (e.value < 8) PostEvent(SQEvStep{e.value + 1});
+  }
+};
+
+FSM_STATE(SQOpen, SQMachine) {
+  using reactions = ufsm::List<ufsm::Reaction<SQEvLater>>;
+  void React(const SQEvLater& e) { OutermostContext().seen.push_back(e.value); }
+};
+
+using SmallQueue = ufsm::ScratchEventQueue<2 * sizeof(SQEvStep)>;
+
+int ValueOf(const ufsm::detail::EventBase& e) { return static_cast<const SQEvStep&>(e).value; }
+
+}  // namespace
+
+TEST(ScratchEventQueueBehaviorTest, EventsPostedAndConsumedInAStepDoNotAllocate) {
+  SQMachine machine;
+  machine.Initiate();
+  machine.WarmUp();
+  ufsm::NoAllocScope no_alloc;
+  machine.ProcessEvent(SQEvStep{1});
+  machine.ProcessEvent(SQEvStep{5});
+  EXPECT_EQ(machine.seen, (std::vector<int>{1, 2, 3, 4, 5, 6, 7, 8, 5, 6, 7, 8}));
+  EXPECT_EQ(no_alloc.Allocations(), 0u);
+}
+
+TEST(ScratchEventQueueBehaviorTest, DeferredEventsOutliveTheStep) {
+  SQMachine machine;
+  machine.Initiate();
+  machine.PostEvent(SQEvLater{10});
+  machine.PostEvent(SQEvLater{11});
+  machine.ProcessEvent(SQEvStep{7});  // Reuses the arena the deferred events were posted in.
+  machine.ProcessEvent(SQEvOpen{});
+  EXPECT_EQ(machine.seen, (std::vector<int>{7, 8, 10, 11}));
+}
+
+TEST(ScratchEventQueueBehaviorTest, FullArenaFallsBackToHeapInOrder) {
+  SmallQueue queue;
+  for (int i = 0; i < 4; ++i) queue.push_back(SQEvStep{i});
+  queue.push_front(SQEvStep{-1});
+  EXPECT_EQ(queue.arena_used(), 2 * sizeof(SQEvStep));
+
+  std::vector<int> taken;
+  while (!queue.empty()) taken.push_back(ValueOf(*queue.take_front()));
+  EXPECT_EQ(taken, (std::vector<int>{-1, 0, 1, 2, 3}));
+  EXPECT_EQ(queue.arena_used(), 0u);
+}
+
+TEST(ScratchEventQueueBehaviorTest, ArenaStartsOverOnlyOnceItIsEmpty) {
+  SmallQueue queue;
+  queue.push_back(SQEvStep{1});
+  queue.push_back(SQEvStep{2});
+  {
+    auto first = queue.take_front();
+    EXPECT_EQ(queue.arena_used(), 2 * sizeof(SQEvStep));
+  }
+  EXPECT_EQ(queue.arena_used(), 2 * sizeof(SQEvStep));
+  {
+    auto second = queue.take_front();
+    EXPECT_EQ(ValueOf(*second), 2);
+  }
+  EXPECT_EQ(queue.arena_used(), 0u);
+
+  ufsm::NoAllocScope no_alloc;
+  queue.push_back(SQEvStep{3});
+  EXPECT_EQ(ValueOf(queue.front()), 3);
+  queue.clear();
+  EXPECT_EQ(no_alloc.Allocations(), 0u);
+}
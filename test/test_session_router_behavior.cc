@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+
+#include <ufsm/router.h>
+
+#include <chrono>
+#include <ctime>
+#include <thread>
+#include <vector>
+
+FSM_EVENT(SrEvData) {
+  SrEvData(int producer, int seq) : producer(producer), seq(seq) {}
+  int producer;
+  int seq;
+};
+FSM_EVENT(SrEvClose){};
+
+struct SrOpen;
+
+FSM_STATE_MACHINE(SrSession, SrOpen) {
+  explicit SrSession(int key) : key(key) {}
+  int key;
+  std::vector<std::vector<int>> seen = std::vector<std::vector<int>>(4);  // Sequence numbers per producer.
+};
+
+FSM_STATE(SrOpen, SrSession) {
+  using reactions = ufsm::List<ufsm::Reaction<SrEvData>, ufsm::Reaction<SrEvClose>>;
+
+  ufsm::Result React(const SrEvData& ev) {
+    OutermostContext().seen[ev.producer].push_back(ev.seq);
+    return DiscardEvent();
+  }
+  ufsm::Result React(const SrEvClose&) { return TerminateMachine(); }
+};
+
+using Router = ufsm::SessionRouter<SrSession, int>;
+
+TEST(SessionRouterBehaviorTest, MachinesAreCreatedLazilyAndEvictedWhenTerminated) {
+  Router router({/*shards=*/2, /*producers=*/1, /*ring_capacity=*/16});
+  EXPECT_EQ(router.Find(7), nullptr);
+
+  ASSERT_TRUE(router.Route(0, 7, SrEvData{0, 1}));
+  ASSERT_TRUE(router.Route(0, 7, SrEvData{0, 2}));
+  ASSERT_TRUE(router.Route(0, 8, SrEvData{0, 1}));
+
+  std::size_t shard = router.ShardOf(7);
+  EXPECT_EQ(router.Poll(shard), shard == router.ShardOf(8) ? 3u : 2u);
+  SrSession* session = router.Find(7);
+  ASSERT_NE(session, nullptr);
+  EXPECT_EQ(session->key, 7);
+  EXPECT_EQ(session->seen[0], (std::vector<int>{1, 2}));
+
+  ASSERT_TRUE(router.Route(0, 7, SrEvClose{}));
+  std::size_t before = router.Sessions(shard);
+  router.Poll(shard);
+  EXPECT_EQ(router.Find(7), nullptr);
+  EXPECT_EQ(router.Sessions(shard), before - 1);
+}
+
+TEST(SessionRouterBehaviorTest, FullRingRejectsEvents) {
+  Router router({1, 1, 2});
+  {
+    // Events are copied into the ring slots, and a full ring is detected before copying.
+    ufsm::NoAllocScope no_alloc;
+    EXPECT_TRUE(router.Route(0, 1, SrEvData{0, 1}));
+    EXPECT_TRUE(router.Route(0, 1, SrEvData{0, 2}));
+    EXPECT_FALSE(router.Route(0, 1, SrEvData{0, 3}));
+  }
+  EXPECT_EQ(router.Poll(0, 1), 1u);
+  EXPECT_TRUE(router.Route(0, 1, SrEvData{0, 3}));
+  EXPECT_EQ(router.Poll(0), 2u);
+  EXPECT_EQ(router.Find(1)->seen[0], (std::vector<int>{1, 2, 3}));
+}
+
+TEST(SessionRouterBehaviorTest, EventsLargerThanTheSlotSpillToTheHeap) {
+  ufsm::SessionRouter<SrSession, int, std::hash<int>, 8> router({1, 1, 4});
+  ufsm::NoAllocScope scope(false);
+  ASSERT_TRUE(router.Route(0, 1, SrEvData{0, 1}));
+  ASSERT_TRUE(router.Route(0, 1, SrEvData{0, 2}));
+  EXPECT_EQ(scope.Allocations(), 2u);
+
+  // The second event is still queued when the router is destroyed, and freed with it.
+  EXPECT_EQ(router.Poll(0, 1), 1u);
+  EXPECT_EQ(router.Find(1)->seen[0], (std::vector<int>{1}));
+}
+
+TEST(SessionRouterBehaviorTest, ShardThreadsPreserveOrderPerKeyAndProducer) {
+  constexpr int kProducers = 4;
+  constexpr int kKeys = 64;
+  constexpr int kEventsPerKey = 200;
+  Router router({4, kProducers, 64});
+  router.Start();
+
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; ++p) {
+    producers.emplace_back([&router, p] {
+      for (int seq = 0; seq < kEventsPerKey; ++seq)
+        for (int key = 0; key < kKeys; ++key)
+          while (!router.Route(p, key, SrEvData{p, seq})) std::this_thread::yield();
+    });
+  }
+  for (auto& t : producers) t.join();
+  router.Stop();
+
+  std::size_t sessions = 0;
+  for (std::size_t s = 0; s < router.ShardCount(); ++s) sessions += router.Sessions(s);
+  EXPECT_EQ(sessions, static_cast<std::size_t>(kKeys));
+  for (int key = 0; key < kKeys; ++key) {
+    SrSession* session = router.Find(key);
+    ASSERT_NE(session, nullptr);
+    for (int p = 0; p < kProducers; ++p) {
+      ASSERT_EQ(session->seen[p].size(), static_cast<std::size_t>(kEventsPerKey));
+      for (int seq = 0; seq < kEventsPerKey; ++seq) ASSERT_EQ(session->seen[p][seq], seq);
+    }
+  }
+}
+
+TEST(SessionRouterBehaviorTest, IdleShardThreadsParkUntilAnEventIsRouted) {
+  using namespace std::chrono_literals;
+  Router router({2, 1, 8});
+  router.Start();
+  std::this_thread::sleep_for(50ms);  // Long enough for both shard threads to park.
+
+  // Parked threads use no CPU time while idle.
+  const std::clock_t cpu = std::clock();
+  std::this_thread::sleep_for(200ms);
+  EXPECT_LT(static_cast<double>(std::clock() - cpu) / CLOCKS_PER_SEC, 0.05);
+
+  // Routing wakes the key's shard.
+  ASSERT_TRUE(router.Route(0, 7, SrEvData{0, 1}));
+  const std::size_t shard = router.ShardOf(7);
+  for (int i = 0; i < 1000 && router.Sessions(shard) == 0; ++i) std::this_thread::sleep_for(1ms);
+  EXPECT_EQ(router.Sessions(shard), 1u);
+  router.Stop();
+}
@@ -0,0 +1,52 @@
+#include <gtest/gtest.h>
+
+#include "test_split_tu_machine.h"
+
+SplitConfigured::SplitConfigured(std::string name) : name_(std::move(name)) {}
+
+ufsm::Result SplitConfigured::React(const SplitEvStop&) {
+  OutermostContext().configured = name_;
+  return Transit<SplitIdle>();
+}
+
+FSM_INSTANTIATE_STATE(SplitConfigured, SplitMachine);
+
+TEST(SplitTranslationUnitBehaviorTest, TransitionsReachStatesInstantiatedElsewhere) {
+  SplitMachine machine;
+  machine.Initiate();
+  EXPECT_TRUE(machine.IsInState<SplitIdle>());
+
+  machine.ProcessEvent(SplitEvStart{});
+  EXPECT_TRUE(machine.IsInState<SplitBusy>());
+  EXPECT_TRUE(machine.IsInState<SplitWorking>());
+  EXPECT_EQ(machine.configured, "+working");
+
+  machine.ProcessEvent(SplitEvStop{});
+  EXPECT_TRUE(machine.IsInState<SplitIdle>());
+}
+
+TEST(SplitTranslationUnitBehaviorTest, TransitArgumentsCrossTranslationUnits) {
+  SplitMachine machine;
+  machine.Initiate();
+
+  SplitEvConfigure configure;
+  configure.name = "eth0";
+  machine.ProcessEvent(configure);
+  ASSERT_TRUE(machine.IsInState<SplitConfigured>());
+
+  machine.ProcessEvent(SplitEvStop{});
+  EXPECT_TRUE(machine.IsInState<SplitIdle>());
+  EXPECT_EQ(machine.configured, "eth0");
+}
+
+TEST(SplitTranslationUnitBehaviorTest, HibernationRestoresStatesInstantiatedElsewhere) {
+  SplitMachine machine;
+  machine.Initiate();
+  machine.ProcessEvent(SplitEvStart{});
+  machine.configured.clear();
+
+  ASSERT_TRUE(machine.Hibernate());
+  machine.Rehydrate();
+  EXPECT_TRUE(machine.IsInState<SplitWorking>());
+  EXPECT_EQ(machine.configured, "");  // Rehydration does not run OnEntry().
+}
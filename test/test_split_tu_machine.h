@@ -0,0 +1,44 @@
+#pragma once
+
+// A machine whose states are defined in two translation units: test_split_tu_states.cc and
+// test_split_tu_behavior.cc. Only declarations live here.
+
+#include <ufsm/ufsm.h>
+
+#include <string>
+
+FSM_EVENT(SplitEvStart){};
+FSM_EVENT(SplitEvStop){};
+FSM_EVENT(SplitEvConfigure) { std::string name; };
+
+struct SplitBusy;
+struct SplitWorking;
+struct SplitConfigured;
+
+FSM_STATE_MACHINE(SplitMachine, SplitIdle) { std::string configured; };
+
+FSM_STATE(SplitIdle, SplitMachine) {
+  using reactions = ufsm::List<ufsm::Transition<SplitEvStart, SplitBusy>, ufsm::Reaction<SplitEvConfigure>>;
+  ufsm::Result React(const SplitEvConfigure& event);
+};
+
+FSM_STATE(SplitBusy, SplitMachine, SplitWorking) {
+  using reactions = ufsm::List<ufsm::Transition<SplitEvStop, SplitIdle>>;
+};
+
+FSM_STATE(SplitWorking, SplitBusy) {
+  void OnEntry();
+};
+
+// Only entered with Transit arguments.
+FSM_STATE(SplitConfigured, SplitMachine) {
+  explicit SplitConfigured(std::string name);
+  using reactions = ufsm::List<ufsm::Reaction<SplitEvStop>>;
+  ufsm::Result React(const SplitEvStop&);
+  std::string name_;
+};
+
+FSM_EXTERN_STATE(SplitIdle, SplitMachine);
+FSM_EXTERN_STATE(SplitBusy, SplitMachine, SplitWorking);
+FSM_EXTERN_STATE(SplitWorking, SplitBusy);
+FSM_EXTERN_STATE(SplitConfigured, SplitMachine);
@@ -0,0 +1,11 @@
+#include "test_split_tu_machine.h"
+
+ufsm::Result SplitIdle::React(const SplitEvConfigure& event) {
+  return Transit<SplitConfigured>(ufsm::with_args, event.name);
+}
+
+void SplitWorking::OnEntry() { OutermostContext().configured += "+working"; }
+
+FSM_INSTANTIATE_STATE(SplitIdle, SplitMachine);
+FSM_INSTANTIATE_STATE(SplitBusy, SplitMachine, SplitWorking);
+FSM_INSTANTIATE_STATE(SplitWorking, SplitBusy);
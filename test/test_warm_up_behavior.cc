@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+
+#include <ufsm/ufsm.h>
+
+FSM_EVENT(WUEvNext){};
+FSM_EVENT(WUEvJump){};
+FSM_EVENT(WUEvHidden){};
+
+struct WUTop;
+struct WUFirst;
+struct WUSecond;
+struct WUOther;
+struct WUOtherLeaf;
+struct WUHidden;
+
+struct PooledPolicy : ufsm::DefaultPolicy {
+  static constexpr std::size_t kStatePoolSize = 1;
+};
+
+FSM_STATE_MACHINE(WarmMachine, WUTop, PooledPolicy){};
+
+FSM_STATE(WUTop, WarmMachine, WUFirst){};
+
+FSM_STATE(WUFirst, WUTop) {
+  using reactions = ufsm::List<ufsm::Transition<WUEvNext, WUSecond>, ufsm::Reaction<WUEvHidden>>;
+  // WUHidden is only named here, so WarmUp() cannot find it on its own.
+  ufsm::Result React(const WUEvHidden&) { return Transit<WUHidden>(); }
+};
+
+FSM_STATE(WUSecond, WUTop) {
+  using reactions = ufsm::List<ufsm::Transition<WUEvNext, WUFirst>, ufsm::Transition<WUEvJump, WUOtherLeaf>>;
+};
+
+// Entered through its child only: reached as an ancestor of a transition target.
+FSM_STATE(WUOther, WarmMachine, WUOtherLeaf) { using reactions = ufsm::List<ufsm::Transition<WUEvNext, WUTop>>; };
+
+FSM_STATE(WUOtherLeaf, WUOther){};
+
+FSM_STATE(WUHidden, WUTop) { using reactions = ufsm::List<ufsm::Transition<WUEvNext, WUFirst>>; };
+
+TEST(WarmUpBehaviorTest, WarmedUpMachineDoesNotAllocateOnFirstTransitions) {
+  WarmMachine machine;
+  machine.WarmUp<WUHidden>();
+
+  ufsm::NoAllocScope scope;
+  machine.Initiate();
+  machine.ProcessEvent(WUEvNext{});  // WUFirst -> WUSecond
+  machine.ProcessEvent(WUEvJump{});  // -> WUOther/WUOtherLeaf
+  machine.ProcessEvent(WUEvNext{});  // -> WUTop/WUFirst
+  machine.ProcessEvent(WUEvHidden{});
+  EXPECT_TRUE(machine.IsInState<WUHidden>());
+  EXPECT_EQ(scope.Allocations(), 0u);
+}
+
+TEST(WarmUpBehaviorTest, PooledStatesReuseMemoryAfterWarmUp) {
+  WarmMachine machine;
+  machine.Initiate();
+
+  // Each state type keeps one block once it has been exited.
+  machine.ProcessEvent(WUEvNext{});
+  machine.ProcessEvent(WUEvNext{});
+
+  ufsm::NoAllocScope scope;
+  for (int i = 0; i < 100; ++i) machine.ProcessEvent(WUEvNext{});
+  EXPECT_EQ(scope.Allocations(), 0u);
+}
@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+
+#include <ufsm/wire.h>
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+FSM_EVENT(WREvSpeed) {
+  static constexpr ufsm::WireId wire_id = 7;
+  explicit WREvSpeed(std::int32_t v) : value(v) {}
+  static ufsm::detail::EventBase* Decode(std::string_view bytes, void* storage) {
+    if (bytes.size() != sizeof(std::int32_t)) return nullptr;
+    std::int32_t value;
+    std::memcpy(&value, bytes.data(), sizeof(value));
+    return new (storage) WREvSpeed(value);
+  }
+  std::int32_t value;
+};
+
+FSM_EVENT(WREvText) {
+  static constexpr ufsm::WireId wire_id = ufsm::HashWireName("test.text");
+  explicit WREvText(ufsm::Payload p) : payload(std::move(p)) {}
+  WREvText Own() const { return WREvText{payload.Own()}; }
+  ufsm::Payload payload;
+};
+
+// Decoded by a function passed at registration rather than a member.
+ufsm::detail::EventBase* DecodeText(std::string_view bytes, void* storage) {
+  return new (storage) WREvText(ufsm::Payload::Borrow(bytes));
+}
+
+struct WRIdle;
+
+FSM_STATE_MACHINE(WRMachine, WRIdle) {
+  std::vector<std::string> seen;
+  const unsigned char* text_data = nullptr;
+  ufsm::WireRegistry* registry = nullptr;
+};
+
+FSM_STATE(WRIdle, WRMachine) {
+  using reactions = ufsm::List<ufsm::Reaction<WREvSpeed>, ufsm::Reaction<WREvText>>;
+  void React(const WREvSpeed& e) {
+    auto& machine = OutermostContext();
+    machine.seen.push_back("speed " + std::to_string(e.value));
+    if (machine.registry) {
+      const std::int32_t nested = 0;
+      EXPECT_FALSE(machine.registry->Dispatch(machine, WREvSpeed::wire_id,
+                                              {reinterpret_cast<const char*>(&nested), sizeof(nested)}));
+      EXPECT_EQ(errno, EBUSY);
+    }
+  }
+  void React(const WREvText& e) {
+    auto& machine = OutermostContext();
+    machine.seen.push_back("text " + std::string(e.payload.view()));
+    machine.text_data = e.payload.data();
+  }
+};
+
+std::string Encode(std::int32_t value) { return std::string(reinterpret_cast<const char*>(&value), sizeof(value)); }
+
+}  // namespace
+
+TEST(WireRegistryBehaviorTest, HashedIdsAreStableFnv1a) {
+  static_assert(ufsm::HashWireName("") == 0x811c9dc5u);
+  static_assert(ufsm::HashWireName("a") == 0xe40c292cu);
+  EXPECT_EQ(WREvText::wire_id, ufsm::HashWireName("test.text"));
+}
+
+TEST(WireRegistryBehaviorTest, DecodesInPlaceAndDispatchesWithoutAllocating) {
+  ufsm::WireRegistry registry;
+  ASSERT_TRUE(registry.Register<WREvSpeed>());
+  ASSERT_TRUE(registry.Register<WREvText>(&DecodeText));
+  EXPECT_EQ(registry.size(), 2u);
+  EXPECT_NE(registry.Name(7).find("WREvSpeed"), std::string_view::npos);
+
+  WRMachine machine;
+  machine.Initiate();
+  const std::string speed = Encode(42), text = "hello";
+  ufsm::NoAllocScope no_alloc;
+  ufsm::Result result = ufsm::Result::kNoReaction;
+  EXPECT_TRUE(registry.Dispatch(machine, 7, speed, &result));
+  EXPECT_EQ(result, ufsm::Result::kConsumed);
+  EXPECT_TRUE(registry.Dispatch(machine, WREvText::wire_id, text));
+  EXPECT_EQ(no_alloc.Allocations(), 0u);
+  EXPECT_EQ(machine.seen, (std::vector<std::string>{"speed 42", "text hello"}));
+  EXPECT_EQ(machine.text_data, reinterpret_cast<const unsigned char*>(text.data()));
+}
+
+TEST(WireRegistryBehaviorTest, FailuresSetErrno) {
+  ufsm::WireRegistry registry;
+  ASSERT_TRUE(registry.Register<WREvSpeed>());
+  errno = 0;
+  EXPECT_FALSE(registry.Register<WREvSpeed>());
+  EXPECT_EQ(errno, EEXIST);
+
+  WRMachine machine;
+  machine.Initiate();
+  EXPECT_FALSE(registry.Dispatch(machine, 8, Encode(1)));
+  EXPECT_EQ(errno, ENOENT);
+  EXPECT_FALSE(registry.Dispatch(machine, 7, "abc"));
+  EXPECT_EQ(errno, EBADMSG);
+  EXPECT_TRUE(machine.seen.empty());
+}
+
+TEST(WireRegistryBehaviorTest, BufferIsBusyDuringDispatch) {
+  ufsm::WireRegistry registry;
+  ASSERT_TRUE(registry.Register<WREvSpeed>());
+  WRMachine machine;
+  machine.Initiate();
+  machine.registry = &registry;
+  EXPECT_TRUE(registry.Dispatch(machine, 7, Encode(3)));
+  machine.registry = nullptr;
+  EXPECT_TRUE(registry.Dispatch(machine, 7, Encode(4)));
+  EXPECT_EQ(machine.seen, (std::vector<std::string>{"speed 3", "speed 4"}));
+}
+
+TEST(WireRegistryBehaviorTest, RegisteringIsRefusedDuringDecode) {
+  ufsm::WireRegistry registry;
+  ASSERT_TRUE(registry.Register<WREvSpeed>());
+  EXPECT_TRUE(registry.Decode(7, Encode(5), [&](const ufsm::detail::EventBase& event) {
+    EXPECT_FALSE(registry.Register<WREvText>(&DecodeText));
+    EXPECT_EQ(errno, EBUSY);
+    EXPECT_EQ(static_cast<const WREvSpeed&>(event).value, 5);
+  }));
+  EXPECT_TRUE(registry.Register<WREvText>(&DecodeText));
+  EXPECT_EQ(registry.size(), 2u);
+}